@@ -19,27 +19,39 @@
 #include "absl/memory/memory.h"
 #include "boost/container/vector.hpp"
 
-// The sender generates a GGMTree with N leaves and arity 2, and runs an
-// 1-out-of-2 OT for each level of the tree, for the client to receive enough
-// information to generates the tree locally, up to one path of the receiver's
-// choice. The messages in the OTs are, per each level, the xor of the
-// left(resp. right) children of all the nodes in that level. The OTs are
-// implemented using EMP.
+// The sender generates a GGMTree with N leaves and arity k, and runs an
+// (k-1)-out-of-k OT for each level of the tree, for the client to receive
+// enough information to generates the tree locally, up to one path of the
+// receiver's choice. The messages in the OTs are, per each level, the xor of
+// the children with the same sibling index of all the nodes in that level. For
+// k = 2, the OTs are 1-out-of-2 OTs implemented using EMP. For larger k, they
+// are built from 1-out-of-2 OTs using a small binary GGM tree, see
+// SendSiblingWiseXORs. If each leaf is split into p outputs, one more
+// (p-1)-out-of-p OT is run on the slots of the XOR of all leaves, see
+// SendTrees. With the half-tree construction, the trees are binary and only a
+// single key is sent, but the OTs are the same.
 
 namespace distributed_vector_ole {
 
 AllButOneRandomOT::AllButOneRandomOT(
     mpc_utils::comm_channel* channel,
     std::unique_ptr<mpc_utils::CommChannelEMPAdapter> channel_adapter,
-    double statistical_security)
+    double statistical_security, int arity, bool pack_leaves,
+    GGMTree::Construction construction)
     : channel_(channel),
       channel_adapter_(std::move(channel_adapter)),
       ot_extension_(channel_adapter_.get()),
-      statistical_security_(statistical_security) {}
+      statistical_security_(statistical_security),
+      arity_(arity),
+      pack_leaves_(pack_leaves),
+      construction_(construction),
+      forest_(construction) {}
 
 mpc_utils::StatusOr<std::unique_ptr<AllButOneRandomOT>>
 AllButOneRandomOT::Create(mpc_utils::comm_channel* channel,
-                          double statistical_security) {
+                          double statistical_security, int arity,
+                          bool pack_leaves,
+                          GGMTree::Construction construction) {
   if (!channel) {
     return mpc_utils::InvalidArgumentError("`channel` must not be NULL");
   }
@@ -47,87 +59,237 @@ AllButOneRandomOT::Create(mpc_utils::comm_channel* channel,
     return mpc_utils::InvalidArgumentError(
         "`statistical_security` must not be negative.");
   }
+  if (arity < 2) {
+    return mpc_utils::InvalidArgumentError("`arity` must be at least 2");
+  }
+  if (construction == GGMTree::Construction::kHalfTree && arity != 2) {
+    return mpc_utils::InvalidArgumentError(
+        "`arity` must be 2 for the half-tree construction");
+  }
+  // In a half-tree, the XOR of all leaves of a complete tree is the root seed.
+  // Packing would send all but one slot of that XOR, which together with the
+  // first level allows recovering the seed by brute force.
+  if (construction == GGMTree::Construction::kHalfTree && pack_leaves) {
+    return mpc_utils::InvalidArgumentError(
+        "`pack_leaves` is not supported with the half-tree construction");
+  }
   // Create EMP adapter. Use a direct connection if channel is not measured.
   channel->sync();
   ASSIGN_OR_RETURN(auto adapter, mpc_utils::CommChannelEMPAdapter::Create(
                                      channel, !channel->is_measured()));
   return absl::WrapUnique(
-      new AllButOneRandomOT(channel, std::move(adapter), statistical_security));
+      new AllButOneRandomOT(channel, std::move(adapter), statistical_security,
+                            arity, pack_leaves, construction));
+}
+
+namespace {
+
+// Keys for the binary GGM trees used to mask sibling-wise XORs if the arity
+// is larger than 2. The keys are public, so they can be fixed.
+const GGMTree::Block kMaskTreeKeys[2] = {
+    absl::MakeUint128(0x9e3779b97f4a7c15, 0xf39cc0605cedc834),
+    absl::MakeUint128(0x1082276bf3a27251, 0xf86c6a11d0c18e95)};
+
+// Returns the number of levels of a GGMTree with the given parameters.
+int NumLevels(int arity, int64_t num_leaves) {
+  return static_cast<int>(1 +
+                          std::ceil(std::log(num_leaves) / std::log(arity)));
+}
+
+// Returns the sibling index of the node on the path to `index` at each level
+// of a tree with `num_levels` levels, starting with the level below the root.
+std::vector<int> DigitsOfIndex(int arity, int num_levels, int64_t index) {
+  std::vector<int> digits(num_levels - 1);
+  for (int j = num_levels - 2; j >= 0; j--) {
+    digits[j] = static_cast<int>(index % arity);
+    index /= arity;
+  }
+  return digits;
+}
+
+// Returns the number of 1-out-of-2 OTs needed for a level of the given arity.
+int OTsPerLevel(int arity) { return arity == 2 ? 1 : NumLevels(2, arity) - 1; }
+
+}  // namespace
+
+mpc_utils::Status AllButOneRandomOT::SendSiblingWiseXORs(
+    absl::Span<const std::vector<std::vector<GGMTree::Block>>>
+        sibling_wise_xors,
+    absl::Span<const GGMTree::Block> keys) {
+  int num_trees = static_cast<int>(sibling_wise_xors.size());
+  std::vector<emp::block> opt0, opt1;
+  // Sibling-wise XORs masked with the leaves of a binary GGM tree. Only used
+  // for levels with arity > 2.
+  std::vector<GGMTree::Block> masked_xors;
+  std::vector<GGMTree::Block> masks;
+  std::vector<std::vector<GGMTree::Block>> mask_tree_xors;
+
+  // Prepare OT messages from sibling-wise XORs. For each level of each tree,
+  // the receiver will choose all XORs except the one on the path to its index.
+  for (int i = 0; i < num_trees; i++) {
+    for (const auto &level_xors : sibling_wise_xors[i]) {
+      int level_arity = static_cast<int>(level_xors.size());
+      if (level_arity < 2) {
+        return mpc_utils::InternalError(
+            "All sibling-wise XORs must have length at least 2");
+      }
+      if (level_arity == 2) {
+        // Set opt0 (resp. opt1) to xor of left (resp. right) siblings.
+        opt0.push_back(
+            all_but_one_random_ot_internal::GGMTreeToEMPBlock(level_xors[0]));
+        opt1.push_back(
+            all_but_one_random_ot_internal::GGMTreeToEMPBlock(level_xors[1]));
+        continue;
+      }
+      // Expand a binary tree with `arity` leaves from a random seed, and run
+      // 1-out-of-2 OTs on its sibling-wise XORs.
+      GGMTree::Block seed;
+      RAND_bytes(reinterpret_cast<uint8_t *>(&seed), sizeof(seed));
+      masks.resize(level_arity);
+      RETURN_IF_ERROR(GGMTree::ExpandLeaves(seed, kMaskTreeKeys,
+                                            absl::MakeSpan(masks),
+                                            &mask_tree_xors));
+      for (const auto &mask_level_xors : mask_tree_xors) {
+        opt0.push_back(all_but_one_random_ot_internal::GGMTreeToEMPBlock(
+            mask_level_xors[0]));
+        opt1.push_back(all_but_one_random_ot_internal::GGMTreeToEMPBlock(
+            mask_level_xors[1]));
+      }
+      for (int j = 0; j < level_arity; j++) {
+        masked_xors.push_back(level_xors[j] ^ masks[j]);
+      }
+    }
+  }
+
+  if (opt0.size() > 0) {
+    ot_extension_.send(opt0.data(), opt1.data(), opt0.size());
+  }
+  if (masked_xors.size() > 0) {
+    channel_adapter_->send_data(masked_xors.data(),
+                                sizeof(GGMTree::Block) * masked_xors.size());
+  }
+
+  channel_adapter_->send_data(keys.data(),
+                              sizeof(GGMTree::Block) * keys.size());
+  channel_adapter_->flush();
+  return mpc_utils::OkStatus();
 }
 
-mpc_utils::StatusOr<std::vector<std::unique_ptr<GGMTree>>>
-AllButOneRandomOT::ReceiveTrees(absl::Span<const int64_t> num_leaves,
-                                absl::Span<const int64_t> indices, int arity) {
-  if (num_leaves.size() != indices.size()) {
+mpc_utils::Status AllButOneRandomOT::ReceiveSiblingWiseXORs(
+    absl::Span<const int64_t> num_outputs, absl::Span<const int64_t> indices,
+    int arity, int elements_per_leaf,
+    std::vector<std::vector<std::vector<GGMTree::Block>>> *sibling_wise_xors,
+    std::vector<GGMTree::Block> *keys) {
+  if (num_outputs.size() != indices.size()) {
     return mpc_utils::InvalidArgumentError(
-        "`num_leaves` and `indices` must have the same size");
+        "`num_outputs` and `indices` must have the same size");
   }
-  int num_trees = static_cast<int>(num_leaves.size());
+  int num_trees = static_cast<int>(num_outputs.size());
   // std::vector<bool> is implemented as a bitstring, and thus does not use a
   // bool * internally, which EMP requires. So we use
   // boost::container::vector<bool> instead.
   boost::container::vector<bool> choices;
   std::vector<emp::block> ot_results;
-  std::vector<int> offsets(num_trees + 1, 0);
+  // Arity of each level of each tree, and the sibling index on the path to
+  // `indices[i]`.
+  std::vector<std::vector<int>> level_arities(num_trees);
+  std::vector<std::vector<int>> digits(num_trees);
+  int64_t num_masked_xors = 0;
   for (int i = 0; i < num_trees; i++) {
-    if (num_leaves[i] == 0) {
-      offsets[i + 1] = offsets[i];
+    if (num_outputs[i] == 0) {
       continue;
     }
 
-    int num_levels = static_cast<int>(
-        1 + std::ceil(std::log(num_leaves[i]) / std::log(arity)));
-    offsets[i + 1] = offsets[i] + num_levels - 1;
-    choices.resize(offsets[i + 1]);
+    // The path to `indices[i]` is given by the base-`arity` digits of the
+    // index of its leaf, followed by its slot within that leaf if leaves are
+    // packed.
+    int64_t num_leaves =
+        (num_outputs[i] + elements_per_leaf - 1) / elements_per_leaf;
+    int num_levels = NumLevels(arity, num_leaves);
+    digits[i] =
+        DigitsOfIndex(arity, num_levels, indices[i] / elements_per_leaf);
+    level_arities[i].assign(num_levels - 1, arity);
+    if (elements_per_leaf > 1) {
+      digits[i].push_back(static_cast<int>(indices[i] % elements_per_leaf));
+      level_arities[i].push_back(elements_per_leaf);
+    }
 
-    // Set choice bits to the negation of the binary encoding of `indices[i]`.
-    uint64_t index_bits = static_cast<uint64_t>(indices[i]);
-    for (int j = 0; j < num_levels - 1; ++j) {
-      choices[offsets[i] + num_levels - 2 - j] = (~index_bits >> j) & 1;
+    // For arity 2, set the choice bit to the negation of each digit.
+    // Otherwise, set the choice bits to the negation of the binary encoding of
+    // each digit, such that the receiver learns all leaves of the binary tree
+    // except that one.
+    for (int j = 0; j < static_cast<int>(digits[i].size()); ++j) {
+      uint64_t digit_bits = static_cast<uint64_t>(digits[i][j]);
+      int ots_per_level = OTsPerLevel(level_arities[i][j]);
+      int64_t choice_offset = choices.size();
+      choices.resize(choice_offset + ots_per_level);
+      for (int k = 0; k < ots_per_level; ++k) {
+        choices[choice_offset + ots_per_level - 1 - k] = (~digit_bits >> k) & 1;
+      }
+      if (level_arities[i][j] > 2) {
+        num_masked_xors += level_arities[i][j];
+      }
     }
   }
   ot_results.resize(choices.size());
-  // Run num_levels-OT_{block_size} OT as a receiver, choosing
-  // acccording to the bitwise negation of the binary representation of
-  // `indices[i]`
+  // Run the OTs as a receiver.
   if (choices.size() > 0) {
     ot_extension_.recv(ot_results.data(), choices.data(), choices.size());
   }
+  std::vector<GGMTree::Block> masked_xors(num_masked_xors);
+  if (num_masked_xors > 0) {
+    channel_adapter_->recv_data(masked_xors.data(),
+                                sizeof(GGMTree::Block) * masked_xors.size());
+  }
 
   // Receive keys from sender.
-  std::vector<GGMTree::Block> keys(arity);
-  channel_adapter_->recv_data(keys.data(), sizeof(GGMTree::Block) * arity);
+  keys->resize(GGMTree::NumKeys(construction_, arity));
+  channel_adapter_->recv_data(keys->data(),
+                              sizeof(GGMTree::Block) * keys->size());
 
-  mpc_utils::Status status = mpc_utils::OkStatus();
-  std::vector<std::unique_ptr<GGMTree>> trees(num_trees);
-#pragma omp parallel for schedule(guided)
+  // Construct sibling-wise xor from the result of the OT, ignoring the
+  // positions on the path to `indices[i]`.
+  sibling_wise_xors->resize(num_trees);
+  std::vector<GGMTree::Block> masks;
+  std::vector<std::vector<GGMTree::Block>> mask_tree_xors;
+  int64_t choice_offset = 0;
+  int64_t masked_xor_offset = 0;
   for (int i = 0; i < num_trees; i++) {
-    if (num_leaves[i] == 0) {
-      continue;
+    auto &xors = (*sibling_wise_xors)[i];
+    xors.clear();
+    for (int j = 0; j < static_cast<int>(digits[i].size()); ++j) {
+      int level_arity = level_arities[i][j];
+      int ots_per_level = OTsPerLevel(level_arity);
+      xors.emplace_back(level_arity, 0);
+      if (level_arity == 2) {
+        xors[j][choices[choice_offset] ? 1 : 0] =
+            all_but_one_random_ot_internal::EMPToGGMTreeBlock(
+                ot_results[choice_offset]);
+        choice_offset += ots_per_level;
+        continue;
+      }
+      // Reconstruct the masks and unmask all XORs except the one at
+      // `digits[i][j]`.
+      mask_tree_xors.assign(ots_per_level, std::vector<GGMTree::Block>(2, 0));
+      for (int k = 0; k < ots_per_level; ++k) {
+        mask_tree_xors[k][choices[choice_offset + k] ? 1 : 0] =
+            all_but_one_random_ot_internal::EMPToGGMTreeBlock(
+                ot_results[choice_offset + k]);
+      }
+      masks.resize(level_arity);
+      RETURN_IF_ERROR(GGMTree::ExpandLeavesFromSiblingWiseXOR(
+          2, digits[i][j], mask_tree_xors, kMaskTreeKeys,
+          absl::MakeSpan(masks)));
+      for (int k = 0; k < level_arity; ++k) {
+        if (k != digits[i][j]) {
+          xors[j][k] = masked_xors[masked_xor_offset + k] ^ masks[k];
+        }
+      }
+      choice_offset += ots_per_level;
+      masked_xor_offset += level_arity;
     }
-    int num_levels = offsets[i + 1] - offsets[i] + 1;
-    assert(num_levels >= 1);
-    // Construct sibling-wise xor from the result of the OT,
-    // ignoring the positions of the binary expansion of `index`.
-    std::vector<std::vector<GGMTree::Block>> xors(
-        num_levels - 1, std::vector<GGMTree::Block>(arity, 0));
-    for (int j = 0; j < num_levels - 1; ++j) {
-      xors[j][choices[offsets[i] + j] ? 1 : 0] =
-          all_but_one_random_ot_internal::EMPToGGMTreeBlock(
-              ot_results[offsets[i] + j]);
-    }
-    auto status_or_tree = GGMTree::CreateFromSiblingWiseXOR(
-        arity, num_leaves[i], indices[i], xors, keys);
-    if (status_or_tree.ok()) {
-      trees[i] = std::move(status_or_tree.ValueOrDie());
-    } else {
-      status = status_or_tree.status();
-    }
-  }
-  if (status.ok()) {
-    return trees;
   }
-  return status;
+  return mpc_utils::OkStatus();
 }
 
 }  // namespace distributed_vector_ole
@@ -21,10 +21,13 @@
 // The sender and the receiver obtain the same random vector of lengh `N`,
 // except for the ith position, for which the receiver obtains nothing.
 
+#include <omp.h>
+
 #include <vector>
 
 #include "absl/strings/str_cat.h"
 #include "absl/types/span.h"
+#include "distributed_vector_ole/ggm_forest.h"
 #include "distributed_vector_ole/ggm_tree.h"
 #include "distributed_vector_ole/internal/all_but_one_random_ot_internal.h"
 #include "emp-ot/emp-ot.h"
@@ -41,9 +44,22 @@ namespace distributed_vector_ole {
 class AllButOneRandomOT {
  public:
   // Creates an instance of AllButOneRandomOT that communicates over the given
-  // comm_channel.
+  // comm_channel. `arity` is the arity of the GGM trees used. Higher arities
+  // result in fewer levels, and therefore fewer OTs and PRG calls per leaf, at
+  // the cost of sending `arity` additional blocks per level. If `pack_leaves`
+  // is true, multiple outputs are derived from each leaf of the GGM trees
+  // whenever this is possible without violating `statistical_security`, see
+  // ElementsPerLeaf. `construction` selects how the children of GGM tree
+  // nodes are computed, see GGMTree. The half-tree construction needs only one
+  // AES call per inner node instead of two, requires `arity` to be 2, and
+  // does not support `pack_leaves`, as the XOR of all leaves of a half-tree is
+  // its seed. Both parties must use the same `statistical_security`,
+  // `pack_leaves`, and `construction`.
   static mpc_utils::StatusOr<std::unique_ptr<AllButOneRandomOT>> Create(
-      mpc_utils::comm_channel *channel, double statistical_security = 40);
+      mpc_utils::comm_channel *channel, double statistical_security = 40,
+      int arity = 2, bool pack_leaves = true,
+      GGMTree::Construction construction =
+          GGMTree::Construction::kOneKeyPerChild);
 
   // Runs the Server side of the protocol. `output` must point to an array of
   // pre-allocated Ts.
@@ -65,32 +81,64 @@ class AllButOneRandomOT {
                               absl::MakeSpan(&output, 1));
   }
 
+  // Returns the arity of the GGM trees used by this instance.
+  inline int arity() const { return arity_; }
+
+  // Returns the construction of the GGM trees used by this instance.
+  inline GGMTree::Construction construction() const { return construction_; }
+
+  // Returns the number of outputs of type T derived from each leaf of the GGM
+  // trees when computing a total of `total_num_outputs` outputs. Each leaf is
+  // split into this many slots of 128 / ElementsPerLeaf bits, where the number
+  // of slots is the largest power of two such that each T can still be sampled
+  // with `statistical_security + log2(total_num_outputs)` bits of statistical
+  // security. Always 1 if packing is disabled.
   template <typename T>
-  mpc_utils::Status RunSenderBatched(absl::Span<absl::Span<T>> outputs) {
-    std::vector<int64_t> sizes(outputs.size());
-    for (int i = 0; i < static_cast<int>(outputs.size()); i++) {
-      sizes[i] = outputs[i].size();
+  int ElementsPerLeaf(int64_t total_num_outputs) const {
+    if (!pack_leaves_ || total_num_outputs == 0) {
+      return 1;
     }
-    ASSIGN_OR_RETURN(auto trees, SendTrees<T>(sizes, 2));
-    NTLContext<T> context;
-    context.save();
-#pragma omp parallel
-    {
-      context.restore();
-#pragma omp for schedule(static)
-      for (int i = 0; i < static_cast<int>(outputs.size()); i++) {
-        if (outputs[i].size() == 0) {
-          continue;  // Do nothing if output array is empty.
-        }
-        all_but_one_random_ot_internal::UnpackLastLevel(*trees[i], outputs[i]);
-      }
+    return all_but_one_random_ot_internal::ElementsPerLeaf<T>(
+        std::log2(double(total_num_outputs)) + statistical_security_);
+  }
+
+  template <typename T>
+  mpc_utils::Status RunSenderBatched(absl::Span<absl::Span<T>> outputs) {
+    std::vector<T> sums(outputs.size());
+    return SendTrees<T>(outputs, arity_, absl::MakeSpan(sums), false);
+  }
+
+  // Same as above, but also sets sums[i] to the sum of the elements of
+  // outputs[i], and negates all outputs if `negate` is true. Both are computed
+  // while the trees are expanded, without another pass over `outputs`.
+  template <typename T>
+  mpc_utils::Status RunSenderBatched(absl::Span<absl::Span<T>> outputs,
+                                     absl::Span<T> sums, bool negate) {
+    if (sums.size() != outputs.size()) {
+      return mpc_utils::InvalidArgumentError(
+          "`sums` and `outputs` must have the same size");
     }
-    return mpc_utils::OkStatus();
+    return SendTrees<T>(outputs, arity_, sums, negate);
   }
 
   template <typename T>
   mpc_utils::Status RunReceiverBatched(absl::Span<const int64_t> indices,
                                        absl::Span<absl::Span<T>> outputs) {
+    std::vector<T> sums(outputs.size());
+    return RunReceiverBatched(indices, outputs, absl::MakeSpan(sums));
+  }
+
+  // Same as above, but also sets sums[i] to the sum of the elements of
+  // outputs[i]. outputs[i][indices[i]] is zero and therefore does not
+  // contribute to the sum.
+  template <typename T>
+  mpc_utils::Status RunReceiverBatched(absl::Span<const int64_t> indices,
+                                       absl::Span<absl::Span<T>> outputs,
+                                       absl::Span<T> sums) {
+    if (sums.size() != outputs.size()) {
+      return mpc_utils::InvalidArgumentError(
+          "`sums` and `outputs` must have the same size");
+    }
     if (outputs.size() != indices.size()) {
       return mpc_utils::InvalidArgumentError(
           "`indices` and `outputs` must have the same size");
@@ -103,126 +151,340 @@ class AllButOneRandomOT {
             absl::StrCat("`indices[", i, "]` out of range"));
       }
     }
-
-    std::vector<int64_t> sizes(outputs.size());
-    for (int i = 0; i < static_cast<int>(outputs.size()); i++) {
-      sizes[i] = outputs[i].size();
-    }
-    ASSIGN_OR_RETURN(auto trees, ReceiveTrees(sizes, indices, 2));
-    NTLContext<T> context;
-    context.save();
-#pragma omp parallel
-    {
-      context.restore();
-#pragma omp for schedule(static)
-      for (int i = 0; i < static_cast<int>(outputs.size()); i++) {
-        if (outputs[i].size() == 0) {
-          continue;  // Do nothing if output array is empty.
-        }
-        all_but_one_random_ot_internal::UnpackLastLevel(*trees[i], outputs[i]);
-      }
-    }
-    return mpc_utils::OkStatus();
+    return ReceiveTrees<T>(indices, outputs, arity_, sums);
   }
 
  private:
   AllButOneRandomOT(
       mpc_utils::comm_channel *channel,
       std::unique_ptr<mpc_utils::CommChannelEMPAdapter> channel_adapter,
-      double statistical_security);
+      double statistical_security, int arity, bool pack_leaves,
+      GGMTree::Construction construction);
 
-  // For each element of `num_leaves`, constructs a GGMTree and obliviously
-  // sends it to the client, except for the values on the path to an index
-  // chosen by the client. If T is a NTL modular integer, ensures that when the
-  // leaves are subsequently reduced modulo `T::modulus()`, all residue classes
-  // are sampled with equal probability.
+  // For each element of `outputs`, expands a GGMTree with outputs[i].size()
+  // leaves, writes the leaves to outputs[i], and obliviously sends the tree to
+  // the client, except for the values on the path to an index chosen by the
+  // client. The trees are never materialized; only their leaves and
+  // sibling-wise XORs are kept. Small trees are expanded together using
+  // `forest_`. If T is a NTL modular integer, ensures that
+  // when the leaves are subsequently reduced modulo `T::modulus()`, all residue
+  // classes are sampled with equal probability. The sum of each output is
+  // written to `sums`, and outputs are negated if `negate` is true.
+  //
+  // If ElementsPerLeaf<T> returns p > 1, the trees only have
+  // ceil(outputs[i].size() / p) leaves, each of which is split into p outputs.
+  // The receiver then misses a whole leaf instead of a single output. To let it
+  // recover all outputs of that leaf except the one at its index, the XOR of
+  // all leaves is sent as an additional level of arity p, whose i-th
+  // sibling-wise XOR is the i-th slot of that XOR.
   template <typename T>
-  mpc_utils::StatusOr<std::vector<std::unique_ptr<GGMTree>>> SendTrees(
-      absl::Span<const int64_t> num_leaves, int arity);
+  mpc_utils::Status SendTrees(absl::Span<absl::Span<T>> outputs, int arity,
+                              absl::Span<T> sums, bool negate);
+
+  // Obliviously receives GGMTrees, where the i-th tree is equal to the
+  // server's except at `indices[i]`, and writes their leaves to outputs[i] and
+  // their sum to sums[i].
+  template <typename T>
+  mpc_utils::Status ReceiveTrees(absl::Span<const int64_t> indices,
+                                 absl::Span<absl::Span<T>> outputs, int arity,
+                                 absl::Span<T> sums);
+
+  // Returns true if there are enough large trees to keep all threads busy.
+  // Otherwise, trees are expanded one after the other, and GGMTree
+  // distributes the work for each tree among threads.
+  static bool ParallelizeOverTrees(int num_large_trees) {
+    return num_large_trees >= omp_get_max_threads();
+  }
 
-  // Obliviously receives GGMTrees, where the i-th tree is equal to the server's
-  // except at `indices[i]`.
-  mpc_utils::StatusOr<std::vector<std::unique_ptr<GGMTree>>> ReceiveTrees(
-      absl::Span<const int64_t> num_leaves, absl::Span<const int64_t> indices,
-      int arity);
+  // Obliviously sends all sibling-wise XORs of all trees except the ones at
+  // the receiver's choice on each level, and sends the public `keys` used to
+  // expand the trees. Trees with zero leaves are passed as empty elements of
+  // `sibling_wise_xors`. The arity of each level is given by the number of its
+  // sibling-wise XORs, which is `keys.size()` except for the additional level
+  // used for packing. For arity 2, this is a 1-out-of-2 OT per level. For
+  // larger arities, each level uses an (arity-1)-out-of-arity OT built from
+  // a binary GGM tree with `arity` leaves: The receiver learns all leaves of
+  // that tree except the one at its choice using 1-out-of-2 OTs, and the
+  // sender sends the sibling-wise XORs masked with the leaves.
+  //
+  // Chosen OT costs two blocks per binary level. Correlated OT
+  // (send_cot_ft/recv_cot) does not reduce this: its one block per OT only
+  // transfers a random value x or f(x), and the sibling-wise XORs are fixed by
+  // the tree, so the sender would have to send their offset from x as a second
+  // block. This also holds for half-trees, even though the two XORs of a
+  // complete level differ by the seed.
+  mpc_utils::Status SendSiblingWiseXORs(
+      absl::Span<const std::vector<std::vector<GGMTree::Block>>>
+          sibling_wise_xors,
+      absl::Span<const GGMTree::Block> keys);
+
+  // Receiver side of SendSiblingWiseXORs. For each tree, returns the
+  // sibling-wise XORs that are not on the path to `indices[i]` in
+  // `sibling_wise_xors`, and the sender's keys in `keys`. `num_outputs` and
+  // `indices` are given in outputs, not leaves. If `elements_per_leaf` > 1,
+  // the XORs of each tree include the additional packing level.
+  mpc_utils::Status ReceiveSiblingWiseXORs(
+      absl::Span<const int64_t> num_outputs, absl::Span<const int64_t> indices,
+      int arity, int elements_per_leaf,
+      std::vector<std::vector<std::vector<GGMTree::Block>>> *sibling_wise_xors,
+      std::vector<GGMTree::Block> *keys);
 
   mpc_utils::comm_channel *channel_;
   std::unique_ptr<mpc_utils::CommChannelEMPAdapter> channel_adapter_;
   emp::SHOTExtension<mpc_utils::CommChannelEMPAdapter> ot_extension_;
   double statistical_security_;
+  const int arity_;
+  const bool pack_leaves_;
+  const GGMTree::Construction construction_;
+  // Reused across calls to avoid allocating buffers for each tree.
+  GGMForest forest_;
 };
 
 template <typename T>
-mpc_utils::StatusOr<std::vector<std::unique_ptr<GGMTree>>>
-AllButOneRandomOT::SendTrees(absl::Span<const int64_t> num_leaves, int arity) {
-  int num_trees = static_cast<int>(num_leaves.size());
+mpc_utils::Status AllButOneRandomOT::SendTrees(
+    absl::Span<absl::Span<T>> outputs, int arity, absl::Span<T> sums,
+    bool negate) {
+  int num_trees = static_cast<int>(outputs.size());
   // Check the modulus to satisfy statistical security.
-  int64_t total_num_leaves =
-      std::accumulate(num_leaves.begin(), num_leaves.end(), 0);
-  // Statistical security needed for each leaf to ensure that all leaves are
-  // uniform.
-  double statistical_security_per_leaf =
-      std::log2(double(total_num_leaves)) + statistical_security_;
-  if (!ScalarHelper<T>::CanBeHashedInto(statistical_security_per_leaf)) {
+  int64_t total_num_outputs = 0;
+  for (int i = 0; i < num_trees; i++) {
+    total_num_outputs += outputs[i].size();
+  }
+  // Statistical security needed for each output to ensure that all outputs
+  // are uniform.
+  double statistical_security_per_output =
+      std::log2(double(total_num_outputs)) + statistical_security_;
+  if (!ScalarHelper<T>::CanBeHashedInto(statistical_security_per_output)) {
     return mpc_utils::InvalidArgumentError(
         absl::StrCat("Cannot ensure statistical security of ",
                      statistical_security_, "bits with the given modulus"));
   }
+  int elements_per_leaf = ElementsPerLeaf<T>(total_num_outputs);
 
-  std::vector<std::unique_ptr<GGMTree>> trees(num_trees);
-  std::vector<emp::block> opt0, opt1;
-  std::vector<int> offsets(num_trees + 1, 0);
-  std::vector<GGMTree::Block> keys(arity);
-  for (int i = 0; i < arity; i++) {
-    RAND_bytes(reinterpret_cast<uint8_t *>(&keys[i]), GGMTree::kBlockSize);
-  }
+  std::vector<GGMTree::Block> keys(GGMTree::NumKeys(construction_, arity));
+  RAND_bytes(reinterpret_cast<uint8_t *>(keys.data()),
+             keys.size() * GGMTree::kBlockSize);
 
-  // Create GGMTrees in parallel.
-  std::vector<mpc_utils::StatusOr<std::unique_ptr<GGMTree>>> status_or_trees(
-      num_trees);
-#pragma omp parallel for schedule(guided)
+  // Trees with at most GGMForest::kMaxLeavesPerTree leaves are expanded
+  // together in `forest_`. Larger trees are expanded one by one.
+  std::vector<GGMTree::Block> seeds(num_trees);
+  RAND_bytes(reinterpret_cast<uint8_t *>(seeds.data()),
+             num_trees * sizeof(GGMTree::Block));
+  std::vector<int64_t> num_leaves(num_trees), forest_num_leaves(num_trees, 0);
+  std::vector<int> large_trees;
   for (int i = 0; i < num_trees; i++) {
-    if (num_leaves[i] == 0) {
-      continue;
+    sums[i] = T(0);
+    num_leaves[i] =
+        (outputs[i].size() + elements_per_leaf - 1) / elements_per_leaf;
+    if (num_leaves[i] <= GGMForest::kMaxLeavesPerTree) {
+      forest_num_leaves[i] = num_leaves[i];
+    } else {
+      large_trees.push_back(i);
+    }
+  }
+  std::vector<std::vector<std::vector<GGMTree::Block>>> xors(num_trees);
+  NTLContext<T> context;
+  context.save();
+  RETURN_IF_ERROR(forest_.Expand(
+      forest_num_leaves, seeds, keys,
+      [outputs, sums, negate, elements_per_leaf, &context](
+          int tree, absl::Span<const GGMTree::Block> leaves) {
+        context.restore();
+        sums[tree] = all_but_one_random_ot_internal::UnpackAndSumLeaves(
+            leaves, outputs[tree], negate, elements_per_leaf);
+      },
+      &xors));
+
+  // Expand large GGMTrees in parallel, writing the leaves directly to
+  // `outputs`. If there are only a few trees, each of them is split across
+  // threads instead.
+  int num_large_trees = static_cast<int>(large_trees.size());
+  mpc_utils::Status status = mpc_utils::OkStatus();
+#pragma omp parallel if (ParallelizeOverTrees(num_large_trees))
+  {
+    context.restore();
+#pragma omp for schedule(guided)
+    for (int j = 0; j < num_large_trees; j++) {
+      int i = large_trees[j];
+      absl::Span<T> output = outputs[i];
+      T *sum = &sums[i];
+      auto tree_status = GGMTree::ExpandLeaves(
+          num_leaves[i], seeds[i], keys,
+          [output, sum, negate, elements_per_leaf, &context](
+              int64_t first_leaf, absl::Span<const GGMTree::Block> leaves) {
+            // Might be called from threads started by GGMTree, in which case
+            // chunks of the same tree are processed concurrently.
+            context.restore();
+            T chunk_sum = all_but_one_random_ot_internal::UnpackAndSumLeaves(
+                leaves,
+                output.subspan(first_leaf * elements_per_leaf,
+                               leaves.size() * elements_per_leaf),
+                negate, elements_per_leaf);
+#pragma omp critical(all_but_one_random_ot_sums)
+            *sum += chunk_sum;
+          },
+          &xors[i], construction_);
+      if (!tree_status.ok()) {
+#pragma omp critical
+        status = tree_status;
+      }
+    }
+  }
+  RETURN_IF_ERROR(status);
+
+  if (elements_per_leaf > 1) {
+    for (int i = 0; i < num_trees; i++) {
+      if (num_leaves[i] == 0) {
+        continue;
+      }
+      // The XOR of all leaves is the XOR of the last level's sibling-wise
+      // XORs, or the seed if the tree only has a single leaf.
+      GGMTree::Block leaf_xor = seeds[i];
+      if (!xors[i].empty()) {
+        leaf_xor = 0;
+        for (const auto &sibling_xor : xors[i].back()) {
+          leaf_xor ^= sibling_xor;
+        }
+      }
+      std::vector<GGMTree::Block> slot_xors(elements_per_leaf);
+      for (int j = 0; j < elements_per_leaf; j++) {
+        slot_xors[j] = leaf_xor & all_but_one_random_ot_internal::SlotMask(
+                                      j, elements_per_leaf);
+      }
+      xors[i].push_back(std::move(slot_xors));
     }
-    // Create tree from random seed.
-    GGMTree::Block seed;
-    RAND_bytes(reinterpret_cast<unsigned char *>(&seed), sizeof(seed));
-    status_or_trees[i] = GGMTree::Create(num_leaves[i], seed, keys);
   }
+  return SendSiblingWiseXORs(xors, keys);
+}
+
+template <typename T>
+mpc_utils::Status AllButOneRandomOT::ReceiveTrees(
+    absl::Span<const int64_t> indices, absl::Span<absl::Span<T>> outputs,
+    int arity, absl::Span<T> sums) {
+  int num_trees = static_cast<int>(outputs.size());
+  std::vector<int64_t> num_outputs(num_trees);
+  int64_t total_num_outputs = 0;
+  for (int i = 0; i < num_trees; i++) {
+    num_outputs[i] = outputs[i].size();
+    total_num_outputs += num_outputs[i];
+  }
+  int elements_per_leaf = ElementsPerLeaf<T>(total_num_outputs);
+  std::vector<std::vector<std::vector<GGMTree::Block>>> xors;
+  std::vector<GGMTree::Block> keys;
+  RETURN_IF_ERROR(ReceiveSiblingWiseXORs(num_outputs, indices, arity,
+                                         elements_per_leaf, &xors, &keys));
 
-  // Prepare OT messages from sibling-wise XORs. For each level of each tree,
-  // the receiver will choose either the XOR of the left or of the right
-  // children.
+  // As in SendTrees, small trees are reconstructed together in `forest_`.
+  // If leaves are packed, packed_leaf_xors[i] is the XOR of the sender's
+  // leaves except for the slot at `indices[i]`, and leaf_xors[i] is the XOR of
+  // the leaves known to the receiver.
+  std::vector<int64_t> num_leaves(num_trees), forest_num_leaves(num_trees, 0);
+  std::vector<int64_t> missing_leaves(num_trees);
+  std::vector<int> large_trees;
+  std::vector<GGMTree::Block> packed_leaf_xors(num_trees, 0);
+  std::vector<GGMTree::Block> leaf_xors(num_trees, 0);
   for (int i = 0; i < num_trees; i++) {
+    sums[i] = T(0);
+    num_leaves[i] =
+        (outputs[i].size() + elements_per_leaf - 1) / elements_per_leaf;
+    missing_leaves[i] = indices[i] / elements_per_leaf;
     if (num_leaves[i] == 0) {
-      offsets[i + 1] = offsets[i];
       continue;
     }
-    ASSIGN_OR_RETURN(trees[i], std::move(status_or_trees[i]));
-    offsets[i + 1] = offsets[i] + trees[i]->num_levels() - 1;
-
-    auto xors = trees[i]->GetSiblingWiseXOR();
-    opt0.resize(offsets[i + 1]);
-    opt1.resize(offsets[i + 1]);
-
-    // Set opt0 (resp. opt1) to xor of left (resp. right) siblings for each
-    // level
-    for (int j = 0; j < static_cast<int>(trees[i]->num_levels()) - 1; ++j) {
-      opt0[offsets[i] + j] =
-          all_but_one_random_ot_internal::GGMTreeToEMPBlock(xors[j][0]);
-      opt1[offsets[i] + j] =
-          all_but_one_random_ot_internal::GGMTreeToEMPBlock(xors[j][1]);
+    if (elements_per_leaf > 1) {
+      for (const auto &slot_xor : xors[i].back()) {
+        packed_leaf_xors[i] ^= slot_xor;
+      }
+      xors[i].pop_back();
+    }
+    if (num_leaves[i] <= GGMForest::kMaxLeavesPerTree) {
+      forest_num_leaves[i] = num_leaves[i];
+    } else {
+      large_trees.push_back(i);
     }
   }
+  NTLContext<T> context;
+  context.save();
+  RETURN_IF_ERROR(forest_.ExpandFromSiblingWiseXOR(
+      forest_num_leaves, missing_leaves, xors, keys,
+      [outputs, sums, elements_per_leaf, &leaf_xors, &context](
+          int tree, absl::Span<const GGMTree::Block> leaves) {
+        context.restore();
+        sums[tree] = all_but_one_random_ot_internal::UnpackAndSumLeaves(
+            leaves, outputs[tree], false, elements_per_leaf);
+        if (elements_per_leaf > 1) {
+          for (const auto &leaf : leaves) {
+            leaf_xors[tree] ^= leaf;
+          }
+        }
+      }));
 
-  if (opt0.size() > 0) {
-    ot_extension_.send(opt0.data(), opt1.data(), opt0.size());
+  // Reconstruct large GGMTrees in parallel, writing the leaves directly to
+  // `outputs`.
+  int num_large_trees = static_cast<int>(large_trees.size());
+  mpc_utils::Status status = mpc_utils::OkStatus();
+#pragma omp parallel if (ParallelizeOverTrees(num_large_trees))
+  {
+    context.restore();
+#pragma omp for schedule(guided)
+    for (int j = 0; j < num_large_trees; j++) {
+      int i = large_trees[j];
+      absl::Span<T> output = outputs[i];
+      T *sum = &sums[i];
+      GGMTree::Block *leaf_xor = &leaf_xors[i];
+      auto tree_status = GGMTree::ExpandLeavesFromSiblingWiseXOR(
+          arity, num_leaves[i], missing_leaves[i], xors[i], keys,
+          [output, sum, leaf_xor, elements_per_leaf, &context](
+              int64_t first_leaf, absl::Span<const GGMTree::Block> leaves) {
+            // Might be called from threads started by GGMTree, in which case
+            // chunks of the same tree are processed concurrently.
+            context.restore();
+            T chunk_sum = all_but_one_random_ot_internal::UnpackAndSumLeaves(
+                leaves,
+                output.subspan(first_leaf * elements_per_leaf,
+                               leaves.size() * elements_per_leaf),
+                false, elements_per_leaf);
+            GGMTree::Block chunk_xor = 0;
+            if (elements_per_leaf > 1) {
+              for (const auto &leaf : leaves) {
+                chunk_xor ^= leaf;
+              }
+            }
+#pragma omp critical(all_but_one_random_ot_sums)
+            {
+              *sum += chunk_sum;
+              *leaf_xor ^= chunk_xor;
+            }
+          },
+          construction_);
+      if (!tree_status.ok()) {
+#pragma omp critical
+        status = tree_status;
+      }
+    }
   }
+  RETURN_IF_ERROR(status);
 
-  channel_adapter_->send_data(keys.data(), sizeof(GGMTree::Block) * arity);
-  channel_adapter_->flush();
-  return trees;
+  if (elements_per_leaf > 1) {
+    for (int i = 0; i < num_trees; i++) {
+      if (num_leaves[i] == 0) {
+        continue;
+      }
+      // Recover the missing leaf, except for the slot at `indices[i]`, which
+      // stays zero. The missing leaf was passed to the callback as zero, so
+      // its outputs can simply be overwritten.
+      int slot = static_cast<int>(indices[i] % elements_per_leaf);
+      GGMTree::Block leaf =
+          (packed_leaf_xors[i] ^ leaf_xors[i]) &
+          ~all_but_one_random_ot_internal::SlotMask(slot, elements_per_leaf);
+      sums[i] += all_but_one_random_ot_internal::UnpackAndSumLeaves(
+          absl::MakeConstSpan(&leaf, 1),
+          outputs[i].subspan(missing_leaves[i] * elements_per_leaf,
+                             elements_per_leaf),
+          false, elements_per_leaf);
+    }
+  }
+  return mpc_utils::OkStatus();
 }
 
 }  // namespace distributed_vector_ole
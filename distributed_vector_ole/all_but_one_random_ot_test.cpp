@@ -34,14 +34,23 @@ template <typename T>
 class AllButOneRandomOTTest : public ::testing::Test {
  protected:
   AllButOneRandomOTTest() : helper_(false) {}
-  void SetUp() {
+  void SetUp() { CreateInstances(2); }
+
+  // (Re-)creates both parties' instances with the given arity.
+  void CreateInstances(int arity, bool pack_leaves = true,
+                       GGMTree::Construction construction =
+                           GGMTree::Construction::kOneKeyPerChild) {
     comm_channel *chan0 = helper_.GetChannel(0);
     comm_channel *chan1 = helper_.GetChannel(1);
-    std::thread thread1([this, chan1] {
-      ASSERT_OK_AND_ASSIGN(all_but_one_rot_1_,
-                           AllButOneRandomOT::Create(chan1));
+    std::thread thread1([this, chan1, arity, pack_leaves, construction] {
+      ASSERT_OK_AND_ASSIGN(
+          all_but_one_rot_1_,
+          AllButOneRandomOT::Create(chan1, 40, arity, pack_leaves,
+                                    construction));
     });
-    ASSERT_OK_AND_ASSIGN(all_but_one_rot_0_, AllButOneRandomOT::Create(chan0));
+    ASSERT_OK_AND_ASSIGN(all_but_one_rot_0_,
+                         AllButOneRandomOT::Create(chan0, 40, arity,
+                                                   pack_leaves, construction));
     thread1.join();
   }
 
@@ -118,6 +127,69 @@ TYPED_TEST(AllButOneRandomOTTest, TestSmallVectors) {
 
 TYPED_TEST(AllButOneRandomOTTest, TestEmpty) { this->TestVector(0, 0); }
 
+TYPED_TEST(AllButOneRandomOTTest, TestArities) {
+  if (std::is_same<TypeParam, NTL::ZZ_p>::value) {
+    NTL::ZZ_p::init(NTL::conv<NTL::ZZ>("4294967291"));  // 2^32 - 5
+  } else if (std::is_same<TypeParam, NTL::zz_p>::value) {
+    NTL::zz_p::init(4294967291L);  // 2^32 - 5
+  }
+  for (int arity : {3, 4, 8, 16}) {
+    this->CreateInstances(arity);
+    for (int size : {1, 2, 15, 16, 17, 100, 300}) {
+      for (int index : {0, size / 3, size - 1}) {
+        this->TestVector(size, index);
+      }
+    }
+  }
+}
+
+TYPED_TEST(AllButOneRandomOTTest, TestWithoutPacking) {
+  if (std::is_same<TypeParam, NTL::ZZ_p>::value) {
+    NTL::ZZ_p::init(NTL::conv<NTL::ZZ>("251"));  // 2^8 - 5
+  } else if (std::is_same<TypeParam, NTL::zz_p>::value) {
+    NTL::zz_p::init(251L);  // 2^8 - 5
+  }
+  for (int arity : {2, 4}) {
+    this->CreateInstances(arity, false);
+    EXPECT_EQ(
+        this->all_but_one_rot_0_->template ElementsPerLeaf<TypeParam>(100), 1);
+    for (int size : {1, 2, 15, 16, 17, 100}) {
+      for (int index : {0, size / 3, size - 1}) {
+        this->TestVector(size, index);
+      }
+    }
+  }
+}
+
+TYPED_TEST(AllButOneRandomOTTest, TestHalfTree) {
+  if (std::is_same<TypeParam, NTL::ZZ_p>::value) {
+    NTL::ZZ_p::init(NTL::conv<NTL::ZZ>("4294967291"));  // 2^32 - 5
+  } else if (std::is_same<TypeParam, NTL::zz_p>::value) {
+    NTL::zz_p::init(4294967291L);  // 2^32 - 5
+  }
+  this->CreateInstances(2, false, GGMTree::Construction::kHalfTree);
+  for (int size : {1, 2, 15, 16, 17, 100, 5000}) {
+    for (int index : {0, size / 3, size - 1}) {
+      this->TestVector(size, index);
+    }
+  }
+}
+
+TYPED_TEST(AllButOneRandomOTTest, TestElementsPerLeaf) {
+  int expected = GGMTree::kBlockSize / sizeof(TypeParam);
+  if (std::is_same<TypeParam, NTL::ZZ_p>::value) {
+    NTL::ZZ_p::init(NTL::conv<NTL::ZZ>("251"));  // 2^8 - 5
+    // Reducing 64 bits modulo 251 is still statistically close to uniform,
+    // but reducing 32 bits is not.
+    expected = 2;
+  } else if (std::is_same<TypeParam, NTL::zz_p>::value) {
+    NTL::zz_p::init(251L);  // 2^8 - 5
+    expected = 2;
+  }
+  EXPECT_EQ(this->all_but_one_rot_0_->template ElementsPerLeaf<TypeParam>(1000),
+            expected);
+}
+
 TYPED_TEST(AllButOneRandomOTTest, TestDifferentSizesReceiverMulti) {
   std::vector<int> output = {1};
   std::vector<absl::Span<int>> outputs = {absl::MakeSpan(output)};
@@ -151,6 +223,85 @@ TYPED_TEST(AllButOneRandomOTTest, TestNegativeStatisticalSecurity) {
             "`statistical_security` must not be negative.");
 }
 
+TYPED_TEST(AllButOneRandomOTTest, TestSums) {
+  if (std::is_same<TypeParam, NTL::ZZ_p>::value) {
+    NTL::ZZ_p::init(NTL::conv<NTL::ZZ>("4294967291"));  // 2^32 - 5
+  } else if (std::is_same<TypeParam, NTL::zz_p>::value) {
+    NTL::zz_p::init(4294967291L);  // 2^32 - 5
+  }
+  std::vector<int64_t> sizes = {0, 1, 7, 100, 5000};
+  std::vector<int64_t> indices = {0, 0, 3, 99, 1234};
+  std::vector<std::vector<TypeParam>> outputs_0, outputs_1;
+  std::vector<absl::Span<TypeParam>> spans_0, spans_1;
+  for (int64_t size : sizes) {
+    outputs_0.emplace_back(size);
+    outputs_1.emplace_back(size);
+  }
+  for (int i = 0; i < static_cast<int>(sizes.size()); i++) {
+    spans_0.push_back(absl::MakeSpan(outputs_0[i]));
+    spans_1.push_back(absl::MakeSpan(outputs_1[i]));
+  }
+  std::vector<TypeParam> sums_0(sizes.size()), sums_1(sizes.size());
+
+  NTLContext<TypeParam> ntl_context;
+  ntl_context.save();
+  std::thread thread1([this, &spans_0, &sums_0, &ntl_context] {
+    ntl_context.restore();
+    EXPECT_TRUE(this->all_but_one_rot_0_
+                    ->RunSenderBatched(absl::MakeSpan(spans_0),
+                                       absl::MakeSpan(sums_0), true)
+                    .ok());
+  });
+  EXPECT_TRUE(this->all_but_one_rot_1_
+                  ->RunReceiverBatched(absl::MakeConstSpan(indices),
+                                       absl::MakeSpan(spans_1),
+                                       absl::MakeSpan(sums_1))
+                  .ok());
+  thread1.join();
+
+  for (int i = 0; i < static_cast<int>(sizes.size()); i++) {
+    TypeParam sum_0(0), sum_1(0);
+    for (int64_t j = 0; j < sizes[i]; j++) {
+      // The sender's outputs are negated.
+      sum_0 -= outputs_0[i][j];
+      sum_1 += outputs_1[i][j];
+      if (j == indices[i]) {
+        EXPECT_EQ(outputs_1[i][j], TypeParam(0));
+      } else {
+        EXPECT_EQ(-outputs_0[i][j], outputs_1[i][j]);
+      }
+    }
+    EXPECT_EQ(sums_0[i], sum_0);
+    EXPECT_EQ(sums_1[i], sum_1);
+  }
+}
+
+TYPED_TEST(AllButOneRandomOTTest, TestArityTooSmall) {
+  auto status = AllButOneRandomOT::Create(this->helper_.GetChannel(0), 40, 1);
+  ASSERT_FALSE(status.ok());
+  EXPECT_EQ(status.status().message(), "`arity` must be at least 2");
+}
+
+TYPED_TEST(AllButOneRandomOTTest, TestHalfTreeRequiresArityTwo) {
+  auto status = AllButOneRandomOT::Create(this->helper_.GetChannel(0), 40, 4,
+                                          false,
+                                          GGMTree::Construction::kHalfTree);
+  ASSERT_FALSE(status.ok());
+  EXPECT_EQ(status.status().message(),
+            "`arity` must be 2 for the half-tree construction");
+}
+
+TYPED_TEST(AllButOneRandomOTTest, TestHalfTreeRejectsPacking) {
+  // The XOR of all leaves of a half-tree is its seed, so sending all but one
+  // slot of it as part of packing would leak the seed.
+  auto status = AllButOneRandomOT::Create(this->helper_.GetChannel(0), 40, 2,
+                                          true,
+                                          GGMTree::Construction::kHalfTree);
+  ASSERT_FALSE(status.ok());
+  EXPECT_EQ(status.status().message(),
+            "`pack_leaves` is not supported with the half-tree construction");
+}
+
 TEST(AllButOneRandomOT, TestNullChannel) {
   auto status = AllButOneRandomOT::Create(nullptr);
   ASSERT_FALSE(status.ok());
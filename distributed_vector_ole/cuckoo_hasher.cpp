@@ -23,26 +23,78 @@
 
 namespace distributed_vector_ole {
 
-CuckooHasher::CuckooHasher(AES_KEY expanded_seed, int num_hash_functions,
-                           double statistical_security)
+namespace {
+
+// Returns floor(value * range / 2^64), see [1] in the header.
+inline int64_t ReduceToRange(uint64_t value, int64_t range) {
+  return absl::Uint128High64(absl::uint128(value) *
+                             static_cast<uint64_t>(range));
+}
+
+// Returns floor(value * range / 2^128).
+inline int64_t ReduceToRange(absl::uint128 value, int64_t range) {
+  absl::uint128 low = absl::uint128(absl::Uint128Low64(value)) *
+                      static_cast<uint64_t>(range);
+  absl::uint128 high = absl::uint128(absl::Uint128High64(value)) *
+                       static_cast<uint64_t>(range);
+  return absl::Uint128High64(high + absl::Uint128High64(low));
+}
+
+}  // namespace
+
+CuckooHasher::CuckooHasher(AES_KEY expanded_seed, FixedKeyAES aes,
+                           int num_hash_functions, double statistical_security,
+                           int stash_size, HashFamily hash_family)
     : expanded_seed_(expanded_seed),
+      aes_(aes),
       num_hash_functions_(num_hash_functions),
-      statistical_security_(statistical_security) {}
+      statistical_security_(statistical_security),
+      stash_size_(stash_size),
+      hash_family_(hash_family) {
+  // Derive the parameters of the other hash families by encrypting a counter.
+  // The high 64 bits of the counter are distinct from the ones used by
+  // HashFamily::kBatchedAES, since there are less than 2^63 hash functions.
+  std::vector<FixedKeyAES::Block> blocks;
+  if (hash_family == HashFamily::kTabulation) {
+    blocks.resize(num_hash_functions * 8 * 256);
+  } else if (hash_family == HashFamily::kMultiplyShift) {
+    blocks.resize(2 * num_hash_functions);
+  }
+  for (int64_t i = 0; i < static_cast<int64_t>(blocks.size()); i++) {
+    blocks[i] = absl::MakeUint128(uint64_t{1} << 63, i);
+  }
+  aes_.Encrypt(blocks, absl::MakeSpan(blocks));
+  if (hash_family == HashFamily::kTabulation) {
+    tables_.resize(blocks.size());
+    for (int64_t i = 0; i < static_cast<int64_t>(blocks.size()); i++) {
+      tables_[i] = absl::Uint128Low64(blocks[i]);
+    }
+  } else if (hash_family == HashFamily::kMultiplyShift) {
+    multipliers_ = std::move(blocks);
+  }
+}
 
 mpc_utils::StatusOr<std::unique_ptr<CuckooHasher>> CuckooHasher::Create(
-    absl::uint128 seed, int num_hash_functions, double statistical_security) {
+    absl::uint128 seed, int num_hash_functions, double statistical_security,
+    int stash_size, HashFamily hash_family) {
   if (num_hash_functions <= 0) {
     return mpc_utils::InvalidArgumentError(
         "`num_hash_functions` must be positive");
   }
+  if (stash_size < 0) {
+    return mpc_utils::InvalidArgumentError(
+        "`stash_size` must not be negative");
+  }
   // Expand seed as AES key.
   AES_KEY expanded_seed;
   if (0 != AES_set_encrypt_key(reinterpret_cast<uint8_t *>(&seed),
                                8 * sizeof(seed), &expanded_seed)) {
     return mpc_utils::InternalError(ERR_reason_error_string(ERR_get_error()));
   }
-  return absl::WrapUnique(new CuckooHasher(expanded_seed, num_hash_functions,
-                                           statistical_security));
+  ASSIGN_OR_RETURN(auto aes, FixedKeyAES::Create(seed));
+  return absl::WrapUnique(
+      new CuckooHasher(expanded_seed, aes, num_hash_functions,
+                       statistical_security, stash_size, hash_family));
 }
 
 int64_t CuckooHasher::HashToBucket(absl::uint128 hash, int64_t num_buckets,
@@ -55,6 +107,56 @@ int64_t CuckooHasher::HashToBucket(absl::uint128 hash, int64_t num_buckets,
   return absl::Uint128Low64(hash % num_buckets);
 }
 
+void CuckooHasher::HashBatch(absl::Span<const uint64_t> inputs,
+                             int64_t num_buckets,
+                             absl::Span<int64_t> hashes) const {
+  int64_t num_inputs = inputs.size();
+  switch (hash_family_) {
+    case HashFamily::kBatchedAES: {
+      std::vector<FixedKeyAES::Block> blocks(num_inputs * num_hash_functions_);
+      for (int64_t i = 0; i < num_inputs; i++) {
+        for (int j = 0; j < num_hash_functions_; j++) {
+          blocks[i * num_hash_functions_ + j] =
+              absl::MakeUint128(j, inputs[i]);
+        }
+      }
+      aes_.Encrypt(blocks, absl::MakeSpan(blocks));
+      for (int64_t i = 0; i < static_cast<int64_t>(blocks.size()); i++) {
+        hashes[i] = ReduceToRange(blocks[i], num_buckets);
+      }
+      break;
+    }
+    case HashFamily::kTabulation: {
+      for (int64_t i = 0; i < num_inputs; i++) {
+        for (int j = 0; j < num_hash_functions_; j++) {
+          const uint64_t *table = tables_.data() + j * 8 * 256;
+          uint64_t hash = 0;
+          for (int k = 0; k < 8; k++) {
+            hash ^= table[k * 256 + ((inputs[i] >> (8 * k)) & 0xff)];
+          }
+          hashes[i * num_hash_functions_ + j] =
+              ReduceToRange(hash, num_buckets);
+        }
+      }
+      break;
+    }
+    case HashFamily::kMultiplyShift: {
+      for (int64_t i = 0; i < num_inputs; i++) {
+        for (int j = 0; j < num_hash_functions_; j++) {
+          uint64_t hash = absl::Uint128High64(
+              multipliers_[2 * j] * inputs[i] + multipliers_[2 * j + 1]);
+          hashes[i * num_hash_functions_ + j] =
+              ReduceToRange(hash, num_buckets);
+        }
+      }
+      break;
+    }
+    case HashFamily::kAES:
+      // Handled in Hash.
+      break;
+  }
+}
+
 mpc_utils::StatusOr<int64_t> CuckooHasher::GetOptimalNumberOfBuckets(
     int64_t num_inputs) {
   if (num_inputs < 0) {
@@ -64,13 +166,11 @@ mpc_utils::StatusOr<int64_t> CuckooHasher::GetOptimalNumberOfBuckets(
     return 1;  // num_buckets must be positive in other CuckooHasher functions.
   }
 
-  int stash_size =
-      0;  // We curently don't support a stash, but we might in the future.
   double log_n = std::log2(num_inputs);
 
   // The following is based on this version of cryptoTools:
   // https://github.com/ladnir/cryptoTools/blob/85da63e335c3ad3019af3958b48d3ff6750c3d92/cryptoTools/Common/CuckooIndex.cpp#L122
-  if (stash_size == 0 && num_hash_functions_ == 3) {
+  if (num_hash_functions_ == 3) {
     const double a_max = 123.5, b_max = -130, a_sd = 2.3, b_sd = 2.18,
                  a_mean = 6.3, b_mean = 6.45;
 
@@ -82,6 +182,10 @@ mpc_utils::StatusOr<int64_t> CuckooHasher::GetOptimalNumberOfBuckets(
         b_max / 2 * (1 + std::erf((log_n - b_mean) / (b_sd * std::sqrt(2)))) -
         log_n;
 
+    // cryptoTools only has an estimate for three hash functions without a
+    // stash. A stash can only make insertion fail less often, so the estimate
+    // still holds with a stash, and we do not reduce the number of buckets.
+    //
     // We have that statistical_security_ = a e + b, where e = |cuckoo|/|set| is
     // the expansion factor. Therefore we have that
     //
@@ -96,7 +200,7 @@ mpc_utils::StatusOr<int64_t> CuckooHasher::GetOptimalNumberOfBuckets(
     // - For e < 8, statistical_security_ -> 0 at e = 2. This is what the
     //   pow(...) does...
     auto sec = [=](double e) {
-      return (1 + g * stash_size) *
+      return (1 + g * stash_size_) *
              (b * std::log2(e) + a + log_n - (f * log_n + d) * std::pow(e, -c));
     };
 
@@ -33,6 +33,7 @@
 #include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
 #include "absl/types/span.h"
+#include "distributed_vector_ole/fixed_key_aes.h"
 #include "mpc_utils/canonical_errors.h"
 #include "mpc_utils/status_macros.h"
 #include "mpc_utils/statusor.h"
@@ -43,56 +44,208 @@ namespace distributed_vector_ole {
 class CuckooHasher {
  public:
   static const int kDefaultHashFunctions = 3;
-  // Creates a new hasher with `num_hash_functions` hash functions, using the
-  // passed `seed`.
+
+  // Families of hash functions to choose from. All of them are derived
+  // deterministically from the seed passed to Create, so two parties with the
+  // same seed get the same buckets. The hash functions are only assumed to be
+  // independent of the inputs, which holds for public inputs as well as for
+  // inputs chosen without knowledge of the seed.
+  enum class HashFamily {
+    // Hashes each input x to H(x) = AES(x) ^ x, and computes the i-th hash
+    // function for i > 0 as H(H(x) ^ i). Maps the 128-bit results to buckets
+    // using the remainder modulo the number of buckets. Supports inputs of up
+    // to 128 bits.
+    kAES,
+    // Computes the i-th hash function as AES(i || x), where x is padded to 64
+    // bits, using pipelined AES-NI on batches of inputs. Maps the 128-bit
+    // results to buckets with Lemire's multiply-shift reduction [1]. As AES is
+    // a pseudorandom permutation, and all (i, x) are distinct, the results are
+    // indistinguishable from independent uniform values, up to a distance of
+    // q^2 / 2^129 for q evaluations. Reduction to num_buckets buckets adds a
+    // statistical distance of at most num_buckets / 2^128 per hash, as for
+    // kAES. Cuckoo Hashing thus fails with the same probability as with
+    // random hash functions. Only supports inputs of up to 64 bits.
+    kBatchedAES,
+    // Simple tabulation hashing [2]: XORs one random 64-bit table entry for
+    // each byte of the input, with separate tables for each hash function.
+    // Bucket loads are as concentrated as with random hash functions [2], so
+    // it is suitable for HashSimple, where only the balance of the buckets
+    // matters. However, Cuckoo Hashing fails with probability
+    // Theta(n^(-1/3)) [2], which is far from 2^(-statistical_security), so
+    // HashCuckoo does not allow it. Only supports inputs of up to 64 bits.
+    kTabulation,
+    // Multiply-add-shift hashing [3]: Computes the i-th hash function as the
+    // upper 64 bits of a_i x + b_i mod 2^128, for random a_i and b_i, which is
+    // 2-independent. Gives balanced buckets in expectation, which suffices
+    // for HashSimple. 2-independent families make Cuckoo Hashing fail with
+    // constant probability on structured inputs such as intervals [4], so
+    // HashCuckoo does not allow it. Only supports inputs of up to 64 bits.
+    kMultiplyShift,
+  };
+  // [1] Lemire, Daniel. "Fast random integer generation in an interval." ACM
+  // Transactions on Modeling and Computer Simulation 29.1 (2019).
+  // [2] Patrascu, Mihai, and Mikkel Thorup. "The power of simple tabulation
+  // hashing." Journal of the ACM 59.3 (2012).
+  // [3] Dietzfelbinger, Martin. "Universal hashing and k-wise independent
+  // random variables via integer arithmetic without primes." STACS 1996.
+  // [4] Dietzfelbinger, Martin, and Ulf Schellbach. "On risks of using cuckoo
+  // hashing with simple universal hash classes." SODA 2009.
+
+  // Output of HashSimple in compressed sparse row (CSR) layout. The indices in
+  // the i-th bucket are stored in ascending order in elements()[offsets()[i]]
+  // to elements()[offsets()[i + 1] - 1].
+  class Buckets {
+   public:
+    Buckets() : offsets_(1, 0) {}
+
+    // Returns the number of buckets.
+    int64_t size() const { return static_cast<int64_t>(offsets_.size()) - 1; }
+
+    // Returns the indices in the i-th bucket.
+    absl::Span<const int64_t> operator[](int64_t i) const {
+      return absl::MakeConstSpan(elements_.data() + offsets_[i],
+                                 offsets_[i + 1] - offsets_[i]);
+    }
+
+    // Returns the start of each bucket in elements(), followed by
+    // elements().size().
+    absl::Span<const int64_t> offsets() const { return offsets_; }
+
+    // Returns the indices in all buckets, one bucket after the other.
+    absl::Span<const int64_t> elements() const { return elements_; }
+
+    // Returns the positions in elements() at which `input` occurs, one for
+    // each hash function. Allows to process all buckets of an input at once,
+    // e.g., to gather values stored in the same layout as elements().
+    absl::Span<const int64_t> PositionsOf(int64_t input) const {
+      return absl::MakeConstSpan(
+          positions_.data() + input * num_hash_functions_,
+          num_hash_functions_);
+    }
+
+    // Returns the bucket that contains the given position in elements().
+    // Together with PositionsOf, this recovers the hashes of an input, e.g.,
+    // to pass them to InsertCuckoo without hashing the input again.
+    int64_t BucketOf(int64_t position) const {
+      return std::upper_bound(offsets_.begin(), offsets_.end(), position) -
+             offsets_.begin() - 1;
+    }
+
+   private:
+    friend class CuckooHasher;
+
+    std::vector<int64_t> offsets_;
+    std::vector<int64_t> elements_;
+    // positions_[i * num_hash_functions_ + j] is the position in `elements_`
+    // of the i-th input in the bucket of the j-th hash function.
+    std::vector<int64_t> positions_;
+    int num_hash_functions_ = 0;
+  };
+
+  // Creates a new hasher with `num_hash_functions` hash functions from the
+  // given family, using the passed `seed`. Cuckoo Hashing uses a stash of
+  // `stash_size` elements. With two hash functions, this reduces the number of
+  // buckets needed for the given statistical security, see
+  // GetOptimalNumberOfBuckets.
   //
-  // Returns INVALID_ARGUMENT if `num_hash_functions` is not postive.
+  // Returns INVALID_ARGUMENT if `num_hash_functions` is not postive or
+  // `stash_size` is negative.
   static mpc_utils::StatusOr<std::unique_ptr<CuckooHasher>> Create(
       absl::uint128 seed, int num_hash_functions = kDefaultHashFunctions,
-      double statistical_security = 40);
+      double statistical_security = 40, int stash_size = 0,
+      HashFamily hash_family = HashFamily::kAES);
+
+  // Returns the size of the stash used by HashCuckoo.
+  int stash_size() const { return stash_size_; }
 
   // Hashes the input with each of the hash functions. Returns a vector that
   // contains for each element the indices of the buckets assigned to it.
   //
-  // Returns INVALID_ARGUMENT if `num_buckets` is not  positive.
+  // Returns INVALID_ARGUMENT if `num_buckets` is not  positive, or if T has
+  // more than 64 bits and the hash family is not HashFamily::kAES.
   template <typename T, int compiled_num_hash_functions = kDefaultHashFunctions>
   mpc_utils::StatusOr<
       std::vector<absl::InlinedVector<int64_t, compiled_num_hash_functions>>>
   Hash(absl::Span<const T> inputs, int64_t num_buckets);
 
   // Hashes the inputs to `num_buckets` buckets using all hash functions created
-  // at construction. Returns the vector of buckets, containing indices into
-  // `inputs`.
+  // at construction. Returns the buckets, containing indices into `inputs`,
+  // together with the inverse mapping from inputs to their positions in the
+  // buckets. The result does not depend on the number of threads.
   //
   // Returns INVALID_ARGUMENT if `num_buckets` is not  positive.
   template <typename T>
-  mpc_utils::StatusOr<std::vector<std::vector<int64_t>>> HashSimple(
+  mpc_utils::StatusOr<Buckets> HashSimple(
       absl::Span<const T> inputs, int64_t num_buckets);
 
   // Hashes the inputs to `num_buckets` buckets using Cuckoo Hashing.
   // Returns a vector of indices into `inputs`, or -1 in positions that no input
-  // get mapped to.
+  // get mapped to. If a stash was specified at construction, the vector
+  // contains `num_buckets` + stash_size() entries, where the last stash_size()
+  // entries are the stash.
   //
-  // Returns INVALID_ARGUMENT if `num_buckets` is not  positive or
-  // `inputs.size()` is larger than `num_buckets`.
-  // Returns INTERNAL if insertion fails after trying to insert an element
-  // `inputs.size()` times.
+  // Returns INVALID_ARGUMENT if `num_buckets` is not  positive,
+  // `inputs.size()` is larger than `num_buckets`, or the hash family is not
+  // suitable for Cuckoo Hashing.
+  // Returns INTERNAL if an element cannot be inserted and the stash is full.
   template <typename T>
   mpc_utils::StatusOr<std::vector<int64_t>> HashCuckoo(
       absl::Span<const T> inputs, int64_t num_buckets);
 
+  // Inserts elements into `num_buckets` buckets using Cuckoo Hashing, where
+  // hashes[i][j] is the bucket of the i-th element under the j-th hash
+  // function. Allows to use Cuckoo Hashing with other hash functions, see
+  // PermutationBuckets. Elements that cannot be inserted go to a stash of
+  // `stash_size` entries. Returns the buckets followed by the stash as in
+  // HashCuckoo.
+  //
+  // Elements are inserted one by one, either into one of their buckets that is
+  // still empty, or along a shortest path of evictions to an empty bucket,
+  // found by breadth-first search. An element only goes to the stash if no
+  // such path exists, so the number of stashed elements is minimal for the
+  // given hashes.
+  //
+  // Returns INTERNAL if an element cannot be inserted and the stash is full.
+  template <int compiled_num_hash_functions = kDefaultHashFunctions>
+  static mpc_utils::StatusOr<std::vector<int64_t>> InsertCuckoo(
+      absl::Span<
+          const absl::InlinedVector<int64_t, compiled_num_hash_functions>>
+          hashes,
+      int64_t num_buckets, int stash_size = 0);
+
   // Returns the number of buckets necessary such that inserting `num_inputs`
-  // inputs fails with probability at most 2**(-statistical_security_). The
-  // parameters for this function have been chosen experimentally as described
-  // in this paper: https://eprint.iacr.org/2018/579.pdf
+  // inputs with a stash of stash_size() elements fails with probability at
+  // most 2**(-statistical_security_). The parameters for this function have
+  // been chosen experimentally as described in this paper:
+  // https://eprint.iacr.org/2018/579.pdf
+  // Only the estimate for two hash functions takes the stash into account. For
+  // three hash functions, the number of buckets is the same as without a stash.
   //
   // Returns UNIMPLEMENTED if the number of hash functions is not 2 or 3.
   // Returns INVALID_ARGUMENT if num_inputs is negative.
   mpc_utils::StatusOr<int64_t> GetOptimalNumberOfBuckets(int64_t num_inputs);
 
  private:
-  explicit CuckooHasher(AES_KEY expanded_seed, int num_hash_functions,
-                        double statistical_security);
+  explicit CuckooHasher(AES_KEY expanded_seed, FixedKeyAES aes,
+                        int num_hash_functions, double statistical_security,
+                        int stash_size, HashFamily hash_family);
+
+  // Number of inputs that Hash passes to HashBatch at once.
+  static const int64_t kHashTileSize = 1 << 10;
+
+  // Tries to insert `element` into `buckets` along a shortest path of
+  // evictions found by breadth-first search, see InsertCuckoo. Returns false
+  // if no path to an empty bucket exists. `visited`, `parents`, and `queue`
+  // are scratch space, where `visited` must have one entry per bucket that is
+  // different from `element` + 1 on the first call.
+  template <int compiled_num_hash_functions>
+  static bool InsertWithEvictions(
+      absl::Span<
+          const absl::InlinedVector<int64_t, compiled_num_hash_functions>>
+          hashes,
+      int64_t element, absl::Span<int64_t> buckets,
+      std::vector<int64_t> *visited, std::vector<int64_t> *parents,
+      std::vector<int64_t> *queue);
 
   // Hashes `input` to a uint128.
   template <typename T>
@@ -103,9 +256,25 @@ class CuckooHasher {
   int64_t HashToBucket(absl::uint128 hash, int64_t num_buckets,
                        int hash_function);
 
+  // Sets hashes[i * num_hash_functions_ + j] to the bucket of inputs[i] under
+  // the j-th hash function, for all hash families except HashFamily::kAES.
+  void HashBatch(absl::Span<const uint64_t> inputs, int64_t num_buckets,
+                 absl::Span<int64_t> hashes) const;
+
   AES_KEY expanded_seed_;
+  // Same key as expanded_seed_, used by HashFamily::kBatchedAES and to
+  // generate the parameters of the other hash families.
+  FixedKeyAES aes_;
   int num_hash_functions_;
   double statistical_security_;
+  int stash_size_;
+  HashFamily hash_family_;
+  // For HashFamily::kTabulation, tables_[(j * 8 + k) * 256 + b] is the entry
+  // for byte value b at the k-th byte of the input in the j-th hash function.
+  std::vector<uint64_t> tables_;
+  // For HashFamily::kMultiplyShift, the j-th hash function uses
+  // multipliers_[2 * j] as a_j and multipliers_[2 * j + 1] as b_j.
+  std::vector<absl::uint128> multipliers_;
 };
 
 template <typename T, int compiled_num_hash_functions>
@@ -115,9 +284,41 @@ CuckooHasher::Hash(absl::Span<const T> inputs, int64_t num_buckets) {
   if (num_buckets <= 0) {
     return mpc_utils::InvalidArgumentError("`num_buckets` must be positive");
   }
+  if (hash_family_ != HashFamily::kAES && sizeof(T) > sizeof(uint64_t)) {
+    return mpc_utils::InvalidArgumentError(
+        "Only HashFamily::kAES supports inputs of more than 64 bits");
+  }
   std::vector<absl::InlinedVector<int64_t, compiled_num_hash_functions>> result(
       inputs.size(), absl::InlinedVector<int64_t, compiled_num_hash_functions>(
                          num_hash_functions_));
+  if (hash_family_ != HashFamily::kAES) {
+    int64_t num_inputs = static_cast<int64_t>(inputs.size());
+    int64_t num_tiles = (num_inputs + kHashTileSize - 1) / kHashTileSize;
+#pragma omp parallel
+    {
+      std::vector<uint64_t> tile_inputs(kHashTileSize);
+      std::vector<int64_t> tile_hashes(kHashTileSize * num_hash_functions_);
+#pragma omp for schedule(static)
+      for (int64_t tile = 0; tile < num_tiles; tile++) {
+        int64_t first_input = tile * kHashTileSize;
+        int64_t tile_size = std::min(kHashTileSize, num_inputs - first_input);
+        for (int64_t i = 0; i < tile_size; i++) {
+          tile_inputs[i] = static_cast<uint64_t>(inputs[first_input + i]);
+        }
+        HashBatch(absl::MakeConstSpan(tile_inputs).subspan(0, tile_size),
+                  num_buckets,
+                  absl::MakeSpan(tile_hashes)
+                      .subspan(0, tile_size * num_hash_functions_));
+        for (int64_t i = 0; i < tile_size; i++) {
+          for (int j = 0; j < num_hash_functions_; j++) {
+            result[first_input + i][j] =
+                tile_hashes[i * num_hash_functions_ + j];
+          }
+        }
+      }
+    }
+    return result;
+  }
 #pragma omp parallel for schedule(static)
   for (int64_t i = 0; i < static_cast<int64_t>(inputs.size()); i++) {
     absl::uint128 current_hash = HashToUint128(inputs[i]);
@@ -129,7 +330,7 @@ CuckooHasher::Hash(absl::Span<const T> inputs, int64_t num_buckets) {
 }
 
 template <typename T>
-mpc_utils::StatusOr<std::vector<std::vector<int64_t>>> CuckooHasher::HashSimple(
+mpc_utils::StatusOr<CuckooHasher::Buckets> CuckooHasher::HashSimple(
     absl::Span<const T> inputs, int64_t num_buckets) {
   if (num_buckets <= 0) {
     return mpc_utils::InvalidArgumentError("`num_buckets` must be positive");
@@ -144,28 +345,52 @@ mpc_utils::StatusOr<std::vector<std::vector<int64_t>>> CuckooHasher::HashSimple(
         " bits. The current hash function only supports 128 bits"));
   }
   ASSIGN_OR_RETURN(auto hashes, Hash(inputs, num_buckets));
-  std::vector<std::vector<int64_t>> result(num_buckets);
+  int64_t num_inputs = static_cast<int64_t>(inputs.size());
+  Buckets result;
+  result.offsets_.resize(num_buckets + 1);
+  result.elements_.resize(num_inputs * num_hash_functions_);
+  result.positions_.resize(num_inputs * num_hash_functions_);
+  result.num_hash_functions_ = num_hash_functions_;
+  // Counting sort in two passes. Each thread first counts how many elements of
+  // its chunk of the inputs go to each bucket. From these counts, each thread
+  // gets its own range in each bucket, such that the second pass places all
+  // elements in ascending order. Both loops use schedule(static) with the same
+  // bounds, so each thread processes the same chunk in both.
+  // thread_offsets[t * num_buckets + i] is the count, and later the next free
+  // position, of thread t in bucket i.
+  std::vector<int64_t> thread_offsets;
 #pragma omp parallel
   {
-    // Split the input interval into evenly-sized chunks and assign one to
-    // each thread. schedule(static) is needed to ensure the result can be
-    // merged in order (see below).
-    std::vector<std::vector<int64_t>> thread_result(num_buckets);
-#pragma omp for schedule(static) nowait
-    for (int64_t i = 0; i < static_cast<int64_t>(inputs.size()); i++) {
+#pragma omp single
+    thread_offsets.assign(omp_get_num_threads() * num_buckets, 0);
+    int64_t *offsets =
+        thread_offsets.data() + omp_get_thread_num() * num_buckets;
+#pragma omp for schedule(static)
+    for (int64_t i = 0; i < num_inputs; i++) {
       for (int j = 0; j < num_hash_functions_; j++) {
-        thread_result[hashes[i][j]].push_back(i);
+        offsets[hashes[i][j]]++;
       }
     }
-    // Have each thread append their buckets to the result, ensuring the order
-    // remains deterministic.
-    // See also: https://stackoverflow.com/a/18671256
-#pragma omp for schedule(static) ordered
-    for (int thread = 0; thread < omp_get_num_threads(); thread++) {
-#pragma omp ordered
+#pragma omp single
+    {
+      int num_threads = omp_get_num_threads();
+      int64_t position = 0;
       for (int64_t i = 0; i < num_buckets; i++) {
-        result[i].insert(result[i].end(), thread_result[i].begin(),
-                         thread_result[i].end());
+        result.offsets_[i] = position;
+        for (int thread = 0; thread < num_threads; thread++) {
+          int64_t count = thread_offsets[thread * num_buckets + i];
+          thread_offsets[thread * num_buckets + i] = position;
+          position += count;
+        }
+      }
+      result.offsets_[num_buckets] = position;
+    }
+#pragma omp for schedule(static)
+    for (int64_t i = 0; i < num_inputs; i++) {
+      for (int j = 0; j < num_hash_functions_; j++) {
+        int64_t position = offsets[hashes[i][j]]++;
+        result.elements_[position] = i;
+        result.positions_[i * num_hash_functions_ + j] = position;
       }
     }
   }
@@ -180,6 +405,12 @@ mpc_utils::StatusOr<std::vector<int64_t>> CuckooHasher::HashCuckoo(
         "`HashCuckoo` can only be called when at least 2 hash functions were "
         "specified at construction");
   }
+  if (hash_family_ == HashFamily::kTabulation ||
+      hash_family_ == HashFamily::kMultiplyShift) {
+    return mpc_utils::InvalidArgumentError(
+        "`HashCuckoo` can only be called with HashFamily::kAES or "
+        "HashFamily::kBatchedAES");
+  }
   if (num_buckets <= 0) {
     return mpc_utils::InvalidArgumentError("`num_buckets` must be positive");
   }
@@ -196,40 +427,92 @@ mpc_utils::StatusOr<std::vector<int64_t>> CuckooHasher::HashCuckoo(
         statistical_security_,
         " bits. The current hash function only supports 128 bits"));
   }
-  std::vector<int64_t> buckets(num_buckets, -1);
-  std::vector<int> next_hash_function(num_buckets, 0);
-  int64_t num_tries = inputs.size();
-
   // Hash all elements.
   ASSIGN_OR_RETURN(auto hashes, Hash(inputs, num_buckets));
+  return InsertCuckoo<kDefaultHashFunctions>(absl::MakeConstSpan(hashes),
+                                             num_buckets, stash_size_);
+}
+
+template <int compiled_num_hash_functions>
+mpc_utils::StatusOr<std::vector<int64_t>> CuckooHasher::InsertCuckoo(
+    absl::Span<const absl::InlinedVector<int64_t, compiled_num_hash_functions>>
+        hashes,
+    int64_t num_buckets, int stash_size) {
+  std::vector<int64_t> buckets(num_buckets + stash_size, -1);
+  if (hashes.empty()) {
+    return buckets;
+  }
+  int64_t num_elements = static_cast<int64_t>(hashes.size());
 
   // Insert inputs one by one.
-  for (int64_t i = 0; i < static_cast<int64_t>(inputs.size()); i++) {
-    int64_t current_element = i;
-    int current_hash_function = 0;
-    for (int64_t tries = 0; tries < num_tries + 1; tries++) {
-      if (tries == num_tries) {
-        return mpc_utils::InternalError(
-            "Failed to insert element, maximum number of tries exhausted");
-      }
-      int64_t index = hashes[current_element][current_hash_function];
-      if (buckets[index] == -1) {
-        // Bucket empty -> simply insert.
-        buckets[index] = current_element;
-        break;
-      } else {
-        // Bucket full -> evict element and increment hash function counter.
-        std::swap(current_element, buckets[index]);
-        std::swap(current_hash_function, next_hash_function[index]);
-        next_hash_function[index] =
-            (next_hash_function[index] + 1) % num_hash_functions_;
-      }
+  std::vector<int64_t> visited(num_buckets, 0), parents(num_buckets), queue;
+  int64_t stash_used = 0;
+  for (int64_t i = 0; i < num_elements; i++) {
+    if (InsertWithEvictions<compiled_num_hash_functions>(
+            hashes, i, absl::MakeSpan(buckets).subspan(0, num_buckets),
+            &visited, &parents, &queue)) {
+      continue;
     }
+    if (stash_used == stash_size) {
+      return mpc_utils::InternalError(
+          "Failed to insert element, maximum number of tries exhausted");
+    }
+    buckets[num_buckets + stash_used++] = i;
   }
 
   return buckets;
 }
 
+template <int compiled_num_hash_functions>
+bool CuckooHasher::InsertWithEvictions(
+    absl::Span<const absl::InlinedVector<int64_t, compiled_num_hash_functions>>
+        hashes,
+    int64_t element, absl::Span<int64_t> buckets, std::vector<int64_t> *visited,
+    std::vector<int64_t> *parents, std::vector<int64_t> *queue) {
+  // Most elements find an empty bucket right away.
+  for (int64_t bucket : hashes[element]) {
+    if (buckets[bucket] == -1) {
+      buckets[bucket] = element;
+      return true;
+    }
+  }
+
+  // Otherwise, search for a path from a full bucket of `element` to an empty
+  // one. Each call marks visited buckets with its own value, so `visited`
+  // never needs to be cleared. Only full buckets are added to the queue.
+  int64_t mark = element + 1;
+  queue->clear();
+  for (int64_t bucket : hashes[element]) {
+    if ((*visited)[bucket] != mark) {
+      (*visited)[bucket] = mark;
+      (*parents)[bucket] = -1;
+      queue->push_back(bucket);
+    }
+  }
+  for (int64_t head = 0; head < static_cast<int64_t>(queue->size()); head++) {
+    int64_t bucket = (*queue)[head];
+    for (int64_t next : hashes[buckets[bucket]]) {
+      if ((*visited)[next] == mark) {
+        continue;
+      }
+      (*visited)[next] = mark;
+      (*parents)[next] = bucket;
+      if (buckets[next] != -1) {
+        queue->push_back(next);
+        continue;
+      }
+      // Move each element on the path to the next bucket, starting at the end.
+      while ((*parents)[next] != -1) {
+        buckets[next] = buckets[(*parents)[next]];
+        next = (*parents)[next];
+      }
+      buckets[next] = element;
+      return true;
+    }
+  }
+  return false;
+}
+
 // Works for any type that's convertible to absl::uint128.
 template <typename T>
 absl::uint128 CuckooHasher::HashToUint128(const T &in) {
@@ -69,6 +69,38 @@ BENCHMARK(BM_HashSimple)
     ->Arg(1 << 20)
     ->Arg(1 << 24);
 
+// Compares the hash families on HashSimple. The first argument is the number of
+// elements, the second one the hash family.
+void BM_HashSimpleHashFamily(benchmark::State& state) {
+  int num_hash_functions = 3;
+  int num_elements = state.range(0);
+  auto hash_family = static_cast<CuckooHasher::HashFamily>(state.range(1));
+  int num_buckets =
+      static_cast<int>(std::max(200., std::ceil(1.5 * num_elements)));
+  std::vector<int64_t> inputs(num_elements);
+  std::iota(inputs.begin(), inputs.end(), 0);
+  absl::uint128 seed(-1234);
+  auto hasher =
+      CuckooHasher::Create(seed, num_hash_functions, 40, 0, hash_family)
+          .ValueOrDie();
+  for (auto _ : state) {
+    auto result = hasher->HashSimple(absl::MakeConstSpan(inputs), num_buckets)
+                      .ValueOrDie();
+    ::benchmark::DoNotOptimize(result);
+  }
+}
+void HashFamilyArguments(benchmark::internal::Benchmark* b) {
+  for (int num_elements : {1 << 16, 1 << 20, 10000000}) {
+    for (auto hash_family : {CuckooHasher::HashFamily::kAES,
+                             CuckooHasher::HashFamily::kBatchedAES,
+                             CuckooHasher::HashFamily::kTabulation,
+                             CuckooHasher::HashFamily::kMultiplyShift}) {
+      b->Args({num_elements, static_cast<int>(hash_family)});
+    }
+  }
+}
+BENCHMARK(BM_HashSimpleHashFamily)->Apply(HashFamilyArguments);
+
 }  // namespace
 
 }  // namespace distributed_vector_ole
\ No newline at end of file
@@ -16,6 +16,8 @@
 
 #include "distributed_vector_ole/cuckoo_hasher.h"
 
+#include <omp.h>
+
 #include <numeric>
 
 #include "absl/container/flat_hash_map.h"
@@ -36,10 +38,13 @@ std::vector<T> GenerateInputs(int num_elements) {
 
 template <typename T>
 void TestSimpleHashing(int num_elements, int num_buckets,
-                       int num_hash_functions) {
+                       int num_hash_functions,
+                       CuckooHasher::HashFamily hash_family =
+                           CuckooHasher::HashFamily::kAES) {
   absl::uint128 seed(-1234);
   ASSERT_OK_AND_ASSIGN(auto hasher,
-                       CuckooHasher::Create(seed, num_hash_functions));
+                       CuckooHasher::Create(seed, num_hash_functions, 40, 0,
+                                            hash_family));
   std::vector<T> input = GenerateInputs<T>(num_elements);
 
   ASSERT_OK_AND_ASSIGN(
@@ -60,10 +65,13 @@ void TestSimpleHashing(int num_elements, int num_buckets,
 
 template <typename T>
 void TestCuckooHashing(int num_elements, int num_buckets,
-                       int num_hash_functions) {
+                       int num_hash_functions,
+                       CuckooHasher::HashFamily hash_family =
+                           CuckooHasher::HashFamily::kAES) {
   absl::uint128 seed(-1234);
   ASSERT_OK_AND_ASSIGN(auto hasher,
-                       CuckooHasher::Create(seed, num_hash_functions));
+                       CuckooHasher::Create(seed, num_hash_functions, 40, 0,
+                                            hash_family));
   std::vector<T> inputs = GenerateInputs<T>(num_elements);
 
   ASSERT_OK_AND_ASSIGN(
@@ -95,6 +103,113 @@ TEST(CuckooHasher, TestSimpleHashing) {
   }
 }
 
+TEST(CuckooHasher, TestSimpleHashingWithHashFamilies) {
+  for (auto hash_family : {CuckooHasher::HashFamily::kBatchedAES,
+                           CuckooHasher::HashFamily::kTabulation,
+                           CuckooHasher::HashFamily::kMultiplyShift}) {
+    for (int num_elements : {0, 1, 1000, 5000}) {
+      for (int num_buckets : {1, 37, 1000}) {
+        TestSimpleHashing<int>(num_elements, num_buckets, 3, hash_family);
+        TestSimpleHashing<uint64_t>(num_elements, num_buckets, 3,
+                                    hash_family);
+      }
+    }
+  }
+}
+
+TEST(CuckooHasher, TestHashFamiliesAreBalancedAndSeeded) {
+  std::vector<int64_t> inputs = GenerateInputs<int64_t>(100000);
+  int num_buckets = 100;
+  for (auto hash_family : {CuckooHasher::HashFamily::kBatchedAES,
+                           CuckooHasher::HashFamily::kTabulation,
+                           CuckooHasher::HashFamily::kMultiplyShift}) {
+    ASSERT_OK_AND_ASSIGN(auto hasher0,
+                         CuckooHasher::Create(1, 3, 40, 0, hash_family));
+    ASSERT_OK_AND_ASSIGN(auto hasher1,
+                         CuckooHasher::Create(1, 3, 40, 0, hash_family));
+    ASSERT_OK_AND_ASSIGN(auto hasher2,
+                         CuckooHasher::Create(2, 3, 40, 0, hash_family));
+    ASSERT_OK_AND_ASSIGN(
+        auto hashes0, hasher0->Hash(absl::MakeConstSpan(inputs), num_buckets));
+    ASSERT_OK_AND_ASSIGN(
+        auto hashes1, hasher1->Hash(absl::MakeConstSpan(inputs), num_buckets));
+    ASSERT_OK_AND_ASSIGN(
+        auto hashes2, hasher2->Hash(absl::MakeConstSpan(inputs), num_buckets));
+    // The same seed gives the same hashes, a different one different hashes.
+    EXPECT_EQ(hashes0, hashes1);
+    EXPECT_NE(hashes0, hashes2);
+    // Each bucket gets 3000 elements in expectation, with a standard deviation
+    // of about 55.
+    std::vector<int> counts(num_buckets, 0);
+    for (const auto &hashes : hashes0) {
+      for (int64_t bucket : hashes) {
+        ASSERT_GE(bucket, 0);
+        ASSERT_LT(bucket, num_buckets);
+        counts[bucket]++;
+      }
+    }
+    for (int count : counts) {
+      EXPECT_GT(count, 2700);
+      EXPECT_LT(count, 3300);
+    }
+  }
+}
+
+TEST(CuckooHasher, TestHashFamiliesRejectWideInputs) {
+  absl::uint128 seed(-1234);
+  ASSERT_OK_AND_ASSIGN(
+      auto hasher,
+      CuckooHasher::Create(seed, 3, 40, 0,
+                           CuckooHasher::HashFamily::kBatchedAES));
+  auto status = hasher->Hash(absl::Span<const absl::uint128>(), 1);
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ(status.status().message(),
+            "Only HashFamily::kAES supports inputs of more than 64 bits");
+}
+
+TEST(CuckooHasher, TestSimpleHashingLayoutIsDeterministic) {
+  absl::uint128 seed(-1234);
+  ASSERT_OK_AND_ASSIGN(auto hasher, CuckooHasher::Create(seed, 3));
+  std::vector<int64_t> inputs = GenerateInputs<int64_t>(100000);
+  int num_buckets = 1000;
+  ASSERT_OK_AND_ASSIGN(auto hashes,
+                       hasher->Hash(absl::MakeConstSpan(inputs), num_buckets));
+  // Insert sequentially in order of the inputs.
+  std::vector<std::vector<int64_t>> expected(num_buckets);
+  for (int64_t i = 0; i < static_cast<int64_t>(inputs.size()); i++) {
+    for (int64_t bucket : hashes[i]) {
+      expected[bucket].push_back(i);
+    }
+  }
+
+  int num_threads = omp_get_max_threads();
+  for (int threads : {1, 3, 8}) {
+    omp_set_num_threads(threads);
+    ASSERT_OK_AND_ASSIGN(
+        auto buckets,
+        hasher->HashSimple(absl::MakeConstSpan(inputs), num_buckets));
+    ASSERT_EQ(buckets.size(), num_buckets);
+    ASSERT_EQ(buckets.offsets().size(), num_buckets + 1);
+    EXPECT_EQ(buckets.offsets().back(), buckets.elements().size());
+    for (int i = 0; i < num_buckets; i++) {
+      EXPECT_EQ(std::vector<int64_t>(buckets[i].begin(), buckets[i].end()),
+                expected[i]);
+    }
+    // Check the inverse mapping.
+    for (int64_t i = 0; i < static_cast<int64_t>(inputs.size()); i++) {
+      auto positions = buckets.PositionsOf(i);
+      ASSERT_EQ(positions.size(), 3);
+      for (int j = 0; j < 3; j++) {
+        EXPECT_EQ(buckets.elements()[positions[j]], i);
+        EXPECT_GE(positions[j], buckets.offsets()[hashes[i][j]]);
+        EXPECT_LT(positions[j], buckets.offsets()[hashes[i][j] + 1]);
+        EXPECT_EQ(buckets.BucketOf(positions[j]), hashes[i][j]);
+      }
+    }
+  }
+  omp_set_num_threads(num_threads);
+}
+
 TEST(CuckooHasher, TestCuckooHashing) {
   // With 200 buckets
   const int num_hash_functions = 3;
@@ -110,6 +225,71 @@ TEST(CuckooHasher, TestCuckooHashing) {
   }
 }
 
+TEST(CuckooHasher, TestCuckooHashingBatchedAES) {
+  for (int num_buckets = 200; num_buckets < 1000; num_buckets += 100) {
+    for (int num_elements = 0; 1.5 * num_elements < num_buckets;
+         num_elements += 100) {
+      TestCuckooHashing<int>(num_elements, num_buckets, 3,
+                             CuckooHasher::HashFamily::kBatchedAES);
+      TestCuckooHashing<uint64_t>(num_elements, num_buckets, 3,
+                                  CuckooHasher::HashFamily::kBatchedAES);
+    }
+  }
+}
+
+TEST(CuckooHasher, TestCuckooHashingRejectsWeakHashFamilies) {
+  absl::uint128 seed(-1234);
+  for (auto hash_family : {CuckooHasher::HashFamily::kTabulation,
+                           CuckooHasher::HashFamily::kMultiplyShift}) {
+    ASSERT_OK_AND_ASSIGN(auto hasher,
+                         CuckooHasher::Create(seed, 3, 40, 0, hash_family));
+    auto status = hasher->HashCuckoo(absl::Span<const int>({1, 2}), 10);
+    EXPECT_FALSE(status.ok());
+    EXPECT_EQ(status.status().message(),
+              "`HashCuckoo` can only be called with HashFamily::kAES or "
+              "HashFamily::kBatchedAES");
+  }
+}
+
+TEST(CuckooHasher, TestCuckooHashingLargeInput) {
+  const int num_elements = 1 << 16;
+  absl::uint128 seed(-1234);
+  ASSERT_OK_AND_ASSIGN(auto hasher, CuckooHasher::Create(seed, 3));
+  ASSERT_OK_AND_ASSIGN(int64_t num_buckets,
+                       hasher->GetOptimalNumberOfBuckets(num_elements));
+  std::vector<int64_t> inputs = GenerateInputs<int64_t>(num_elements);
+  ASSERT_OK_AND_ASSIGN(auto hashes,
+                       hasher->Hash(absl::MakeConstSpan(inputs), num_buckets));
+  ASSERT_OK_AND_ASSIGN(
+      auto buckets,
+      hasher->HashCuckoo(absl::MakeConstSpan(inputs), num_buckets));
+
+  // Each element is in exactly one of its buckets.
+  std::vector<int> counts(num_elements, 0);
+  for (int64_t i = 0; i < num_buckets; i++) {
+    if (buckets[i] == -1) {
+      continue;
+    }
+    counts[buckets[i]]++;
+    EXPECT_NE(
+        std::find(hashes[buckets[i]].begin(), hashes[buckets[i]].end(), i),
+        hashes[buckets[i]].end());
+  }
+  for (int count : counts) {
+    EXPECT_EQ(count, 1);
+  }
+}
+
+TEST(CuckooHasher, TestCuckooHashingFollowsEvictionPaths) {
+  // Elements 0 and 1 go to buckets 0 and 1 directly. Element 2 can then only
+  // be inserted by moving element 1 to bucket 2.
+  std::vector<absl::InlinedVector<int64_t, 2>> hashes = {
+      {0, 1}, {1, 2}, {0, 1}};
+  ASSERT_OK_AND_ASSIGN(auto buckets, CuckooHasher::InsertCuckoo<2>(
+                                         absl::MakeConstSpan(hashes), 3));
+  EXPECT_EQ(buckets, std::vector<int64_t>({0, 2, 1}));
+}
+
 TEST(Cuckoohasher, TestGetOptimalNumberOfBuckets) {
   absl::uint128 seed(-1234);
   ASSERT_OK_AND_ASSIGN(auto hasher, CuckooHasher::Create(seed, 3, 40));
@@ -122,6 +302,58 @@ TEST(Cuckoohasher, TestGetOptimalNumberOfBuckets) {
   EXPECT_LT(num_buckets / num_elements, 1.6);
 }
 
+TEST(CuckooHasher, TestGetOptimalNumberOfBucketsWithStash) {
+  absl::uint128 seed(-1234);
+  for (int num_hash_functions : {2, 3}) {
+    for (int64_t num_elements : {57, 1324, 1 << 20}) {
+      ASSERT_OK_AND_ASSIGN(auto hasher,
+                           CuckooHasher::Create(seed, num_hash_functions, 40));
+      ASSERT_OK_AND_ASSIGN(
+          auto hasher_with_stash,
+          CuckooHasher::Create(seed, num_hash_functions, 40, 4));
+      ASSERT_OK_AND_ASSIGN(int64_t num_buckets,
+                           hasher->GetOptimalNumberOfBuckets(num_elements));
+      ASSERT_OK_AND_ASSIGN(
+          int64_t num_buckets_with_stash,
+          hasher_with_stash->GetOptimalNumberOfBuckets(num_elements));
+      if (num_hash_functions == 2) {
+        EXPECT_LT(num_buckets_with_stash, num_buckets);
+        EXPECT_GT(num_buckets_with_stash, num_elements);
+      } else {
+        // There is no estimate for three hash functions with a stash.
+        EXPECT_EQ(num_buckets_with_stash, num_buckets);
+      }
+    }
+  }
+}
+
+TEST(CuckooHasher, TestCuckooHashingWithStash) {
+  // All elements go to buckets 0 and 1, so two of them end up in the stash.
+  std::vector<absl::InlinedVector<int64_t, 2>> hashes(4, {0, 1});
+  ASSERT_OK_AND_ASSIGN(auto buckets, CuckooHasher::InsertCuckoo<2>(
+                                         absl::MakeConstSpan(hashes), 3, 2));
+  ASSERT_EQ(buckets.size(), 5);
+  EXPECT_EQ(buckets[2], -1);
+  std::vector<int64_t> sorted = {buckets[0], buckets[1], buckets[3],
+                                 buckets[4]};
+  std::sort(sorted.begin(), sorted.end());
+  EXPECT_EQ(sorted, std::vector<int64_t>({0, 1, 2, 3}));
+
+  // A stash that is too small.
+  auto status =
+      CuckooHasher::InsertCuckoo<2>(absl::MakeConstSpan(hashes), 3, 1);
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ(status.status().message(),
+            "Failed to insert element, maximum number of tries exhausted");
+}
+
+TEST(CuckooHasher, TestConstructorNegativeStashSize) {
+  absl::uint128 seed(-1234);
+  auto status = CuckooHasher::Create(seed, 3, 40, -1);
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ(status.status().message(), "`stash_size` must not be negative");
+}
+
 TEST(CuckooHasher, TestConstructorNoHashFunctions) {
   absl::uint128 seed(-1234);
   auto status = CuckooHasher::Create(seed, 0);
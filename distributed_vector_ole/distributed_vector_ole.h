@@ -25,7 +25,10 @@
 
 #include "Eigen/Dense"
 #include "Eigen/Sparse"
+#include "absl/container/inlined_vector.h"
+#include "absl/types/optional.h"
 #include "distributed_vector_ole/aes_uniform_bit_generator.h"
+#include "distributed_vector_ole/fixed_key_aes.h"
 #include "distributed_vector_ole/internal/scalar_helpers.h"
 #include "distributed_vector_ole/mpfss_known_indices.h"
 #include "mpc_utils/boost_serialization/eigen.hpp"
@@ -62,10 +65,51 @@ class DistributedVectorOLE {
     T delta;
   };
 
+  // How the LPN code generator is represented during expansion. Both modes
+  // give the same matrix for the same shared seed.
+  enum class CodeGeneratorMode {
+    // Samples the generator once per output size in PrecomputeCommon, and
+    // stores it as a sparse matrix, which takes kCodeGeneratorNonzeros values
+    // and row indices per output element.
+    kStored,
+    // Only stores the shared seed, and samples each column of the generator
+    // again whenever it is needed during expansion. Uses no memory
+    // proportional to the output size for the generator, at the cost of about
+    // 2 * kCodeGeneratorNonzeros AES calls per column in each expansion.
+    kImplicit,
+  };
+
+  // Nonzero entries of the LPN code generator. Both parties must use the same
+  // coefficients.
+  enum class CodeGeneratorCoefficients {
+    // Each nonzero is a uniformly random element of T.
+    kRandom,
+    // Each nonzero is 1, so the expansion only needs additions, and only the
+    // row indices of the nonzeros are stored. Uses the same VOLEParameters as
+    // kRandom, which have not been analyzed separately for this case. Not
+    // supported if T has even characteristic, such as gf128 and unsigned
+    // integers: reducing modulo 2 then splits the instance into LPN instances
+    // over F_2 with the same generator, where each noise value is nonzero only
+    // with probability 1/2, so the noise rate is only t / (2 * output_size).
+    kBinary,
+  };
+
   // Returns a new Vector-OLE generator that communicates over the given
-  // comm_channel, with the given statistical_security.
+  // comm_channel, with the given statistical_security. `bucket_mapping` is
+  // passed to MPFSSKnownIndices. With BucketMapping::kRegular, the LPN noise
+  // is regular, i.e., the output of each expansion is split into as many
+  // blocks as there are noise indices, and each block contains exactly one
+  // noise index. Otherwise, noise indices are sampled uniformly from the whole
+  // output. Both parties must use the same bucket mapping. The parties may use
+  // different values of `code_generator_mode`, but must use the same
+  // `code_generator_coefficients`.
   static mpc_utils::StatusOr<std::unique_ptr<DistributedVectorOLE>> Create(
-      mpc_utils::comm_channel *channel, double statistical_security = 40);
+      mpc_utils::comm_channel *channel, double statistical_security = 40,
+      MPFSSKnownIndices::BucketMapping bucket_mapping =
+          MPFSSKnownIndices::BucketMapping::kPrecomputed,
+      CodeGeneratorMode code_generator_mode = CodeGeneratorMode::kStored,
+      CodeGeneratorCoefficients code_generator_coefficients =
+          CodeGeneratorCoefficients::kRandom);
 
   // Performs precomputation such that subsequent calls to RunSender return
   // faster. Optionally updates the batch size.
@@ -95,6 +139,8 @@ class DistributedVectorOLE {
   DistributedVectorOLE(std::unique_ptr<MPFSSKnownIndices> mpfss,
                        std::unique_ptr<ScalarVectorGilboaProduct> gilboa,
                        Eigen::SparseMatrix<T, Eigen::ColMajor> code_generator,
+                       CodeGeneratorMode code_generator_mode,
+                       CodeGeneratorCoefficients code_generator_coefficients,
                        mpc_utils::comm_channel *channel,
                        double statistical_security);
 
@@ -102,6 +148,42 @@ class DistributedVectorOLE {
   // PrecomputeSender and PrecomputeReceiver.
   mpc_utils::Status PrecomputeCommon(int64_t output_size);
 
+  // Samples the `col`-th column of the code generator from AES in counter mode
+  // under `prg`, starting at `nonce`. Writes kCodeGeneratorNonzeros distinct
+  // row indices in ascending order to `rows`, and the corresponding random
+  // values to `values`, unless `values` is null. Only depends on the
+  // arguments, so both parties get the same column, no matter in which order
+  // or on which thread it is sampled.
+  static void SampleCodeGeneratorColumn(const FixedKeyAES &prg,
+                                        absl::uint128 nonce, int64_t col,
+                                        int num_rows, int *rows, T *values);
+
+  // One product of a seed with the code generator, computed by
+  // MultiplyCodeGenerator. Sets output[col] to `seed` times the col-th column,
+  // plus or minus addend[col] if `addend` is not null. For
+  // CodeGeneratorCoefficients::kBinary, the product is the sum of the seed
+  // elements in the rows of the column.
+  struct Expansion {
+    const Vector<T> *seed;
+    const Vector<T> *addend;
+    bool subtract;
+    T *output;
+  };
+
+  // Computes all `expansions` in a single pass over the code generator, so
+  // that each column is only loaded, or sampled for
+  // CodeGeneratorMode::kImplicit, once. Columns are processed in parallel in
+  // tiles of kExpansionTileSize, and each product is computed with
+  // ScalarHelper<T>::GatherDotProduct.
+  void MultiplyCodeGenerator(absl::Span<const Expansion> expansions) const;
+
+  // Number of columns per tile in MultiplyCodeGenerator.
+  static const int64_t kExpansionTileSize = 1 << 12;
+
+  // Number of columns ahead of the current one for which
+  // MultiplyCodeGenerator prefetches the seed elements.
+  static const int kPrefetchDistance = 8;
+
   // Expands the sender's seeds to `size`, using the given LPN noise parameter.
   // Updates sender_cached_, sender_vole_seed_ and sender_mpfss_seed_ with the
   // result of the expansion.
@@ -134,9 +216,30 @@ class DistributedVectorOLE {
   // Gilboa instance for computing the short seeds during precomputation.
   std::unique_ptr<ScalarVectorGilboaProduct> gilboa_;
 
-  // Code generator matrix for expanding the seeds.
+  // Code generator matrix for expanding the seeds. Empty for
+  // CodeGeneratorMode::kImplicit and CodeGeneratorCoefficients::kBinary.
   Eigen::SparseMatrix<T, Eigen::ColMajor> code_generator_;
 
+  // Rows of the nonzeros of the code generator for
+  // CodeGeneratorCoefficients::kBinary, kCodeGeneratorNonzeros per column.
+  // Empty for CodeGeneratorMode::kImplicit.
+  std::vector<int> binary_code_generator_;
+
+  // See CodeGeneratorMode.
+  const CodeGeneratorMode code_generator_mode_;
+
+  // See CodeGeneratorCoefficients.
+  const CodeGeneratorCoefficients code_generator_coefficients_;
+
+  // Dimensions of the current code generator, in both modes.
+  int64_t code_generator_rows_;
+  int64_t code_generator_cols_;
+
+  // AES key and first counter of the current code generator, derived from the
+  // shared seed in PrecomputeCommon. Passed to SampleCodeGeneratorColumn.
+  absl::optional<FixedKeyAES> code_generator_prg_;
+  absl::uint128 code_generator_nonce_;
+
   // Cached vectors u, v for the sender.
   SenderResult sender_cached_;
 
@@ -187,10 +290,17 @@ DistributedVectorOLE<T>::DistributedVectorOLE(
     std::unique_ptr<MPFSSKnownIndices> mpfss,
     std::unique_ptr<ScalarVectorGilboaProduct> gilboa,
     Eigen::SparseMatrix<T, Eigen::ColMajor> code_generator,
+    CodeGeneratorMode code_generator_mode,
+    CodeGeneratorCoefficients code_generator_coefficients,
     mpc_utils::comm_channel *channel, double statistical_security)
     : mpfss_(std::move(mpfss)),
       gilboa_(std::move(gilboa)),
       code_generator_(std::move(code_generator)),
+      code_generator_mode_(code_generator_mode),
+      code_generator_coefficients_(code_generator_coefficients),
+      code_generator_rows_(0),
+      code_generator_cols_(0),
+      code_generator_nonce_(0),
       channel_(channel),
       batch_size_(0),
       vole_seed_size_(0),
@@ -202,8 +312,11 @@ DistributedVectorOLE<T>::DistributedVectorOLE(
 
 template <typename T>
 mpc_utils::StatusOr<std::unique_ptr<DistributedVectorOLE<T>>>
-DistributedVectorOLE<T>::Create(comm_channel *channel,
-                                double statistical_security) {
+DistributedVectorOLE<T>::Create(
+    comm_channel *channel, double statistical_security,
+    MPFSSKnownIndices::BucketMapping bucket_mapping,
+    CodeGeneratorMode code_generator_mode,
+    CodeGeneratorCoefficients code_generator_coefficients) {
   if (!channel) {
     return mpc_utils::InvalidArgumentError("`channel` must not be NULL");
   }
@@ -211,6 +324,12 @@ DistributedVectorOLE<T>::Create(comm_channel *channel,
     return mpc_utils::InvalidArgumentError(
         "`statistical_security` must not be negative.");
   }
+  if (code_generator_coefficients == CodeGeneratorCoefficients::kBinary &&
+      ScalarHelper<T>::HasEvenCharacteristic()) {
+    return mpc_utils::InvalidArgumentError(
+        "CodeGeneratorCoefficients::kBinary is not supported for types of even "
+        "characteristic");
+  }
   // Make sure we have enough bits of statistical security for MPFSS, Gilboa and
   // generator sampling to fail independently.
   statistical_security += std::log2(3);
@@ -226,11 +345,14 @@ DistributedVectorOLE<T>::Create(comm_channel *channel,
   ASSIGN_OR_RETURN(auto gilboa, ScalarVectorGilboaProduct::Create(
                                     channel, statistical_security));
   ASSIGN_OR_RETURN(auto mpfss,
-                   MPFSSKnownIndices::Create(channel, statistical_security));
+                   MPFSSKnownIndices::Create(
+                       channel, statistical_security, 2,
+                       GGMTree::Construction::kOneKeyPerChild, bucket_mapping));
   Eigen::SparseMatrix<T, Eigen::ColMajor> code_generator;
 
   return absl::WrapUnique(new DistributedVectorOLE<T>(
-      std::move(mpfss), std::move(gilboa), std::move(code_generator), channel,
+      std::move(mpfss), std::move(gilboa), std::move(code_generator),
+      code_generator_mode, code_generator_coefficients, channel,
       statistical_security));
 }
 
@@ -365,9 +487,6 @@ mpc_utils::Status DistributedVectorOLE<T>::PrecomputeCommon(
   RETURN_IF_ERROR(mpfss_->UpdateBuckets(output_size, num_noise_indices_));
 
   // Lower ID creates random seed for generator  matrix and sends it over.
-  std::vector<Eigen::Triplet<T>> triplets;
-  triplets.reserve(VOLEParameters::kCodeGeneratorNonzeros * output_size);
-  code_generator_.resize(vole_seed_size_, output_size);
   std::vector<uint8_t> seed(32);
   if (channel_->get_id() < channel_->get_peer_id()) {
     RAND_bytes(seed.data(), seed.size());
@@ -376,47 +495,212 @@ mpc_utils::Status DistributedVectorOLE<T>::PrecomputeCommon(
   } else {
     channel_->recv(seed);
   }
-  ASSIGN_OR_RETURN(auto rng, AESUniformBitGenerator::Create(
-                                 seed, VOLEParameters::kCodeGeneratorNonzeros *
-                                           output_size));
 
   // Check we can sample enough random elements with the given statistical
   // security.
   double statistical_security_per_element =
       std::log2(double(VOLEParameters::kCodeGeneratorNonzeros * output_size)) +
       statistical_security_;
-  if (!ScalarHelper<T>::CanBeHashedInto(statistical_security_per_element,
-                                        128)) {
+  bool binary =
+      code_generator_coefficients_ == CodeGeneratorCoefficients::kBinary;
+  if (!binary && !ScalarHelper<T>::CanBeHashedInto(
+                     statistical_security_per_element, 128)) {
     return mpc_utils::InvalidArgumentError(
         "Cannot sample enough random elements for the code generator with the "
         "given statistical security");
   }
-  // Sample random elements for code generator.
-  Vector<T> random_elements(VOLEParameters::kCodeGeneratorNonzeros *
-                            output_size);
-  for (int64_t i = 0; i < VOLEParameters::kCodeGeneratorNonzeros * output_size;
-       i++) {
-    absl::uint128 random128 = absl::MakeUint128(rng(), rng());
-    random_elements[i] = ScalarHelper<T>::FromUint128(random128);
+  // Write the generator directly in compressed column layout. Each column has
+  // exactly kCodeGeneratorNonzeros entries, and is sampled from its own range
+  // of counters, so columns can be sampled in any order and in parallel.
+  const int nonzeros = VOLEParameters::kCodeGeneratorNonzeros;
+  if (vole_seed_size_ < nonzeros) {
+    return mpc_utils::InvalidArgumentError(
+        "The VOLE seed must have at least kCodeGeneratorNonzeros elements");
   }
-
-  // Sample random indexes for code generator.
-  // TODO: This can posibbly be parallelized by inserting into block matrices
-  //   and then joining them in the end.
-  std::uniform_int_distribution<int> dist(0, vole_seed_size_ - 1);
-  code_generator_.reserve(Eigen::VectorXi::Constant(
-      output_size, VOLEParameters::kCodeGeneratorNonzeros));
-  for (int64_t col = 0; col < output_size; col++) {
-    for (int i = 0; i < VOLEParameters::kCodeGeneratorNonzeros; i++) {
-      int row = dist(rng);
-      code_generator_.coeffRef(row, col) = std::move(
-          random_elements[col * VOLEParameters::kCodeGeneratorNonzeros + i]);
+  absl::uint128 key = *reinterpret_cast<const absl::uint128 *>(seed.data());
+  ASSIGN_OR_RETURN(auto prg, FixedKeyAES::Create(key));
+  absl::uint128 nonce =
+      *reinterpret_cast<const absl::uint128 *>(seed.data() + 16);
+  code_generator_prg_ = prg;
+  code_generator_nonce_ = nonce;
+  code_generator_rows_ = vole_seed_size_;
+  code_generator_cols_ = output_size;
+  if (code_generator_mode_ == CodeGeneratorMode::kImplicit) {
+    return mpc_utils::OkStatus();
+  }
+  if (binary) {
+    binary_code_generator_.resize(nonzeros * output_size);
+#pragma omp parallel for schedule(static)
+    for (int64_t col = 0; col < output_size; col++) {
+      SampleCodeGeneratorColumn(prg, nonce, col, vole_seed_size_,
+                                binary_code_generator_.data() + col * nonzeros,
+                                nullptr);
     }
+    return mpc_utils::OkStatus();
   }
-  code_generator_.makeCompressed();
+  code_generator_.resize(vole_seed_size_, output_size);
+  code_generator_.resizeNonZeros(nonzeros * output_size);
+  int *outer_index = code_generator_.outerIndexPtr();
+  int *inner_index = code_generator_.innerIndexPtr();
+  T *values = code_generator_.valuePtr();
+#pragma omp parallel for schedule(static)
+  for (int64_t col = 0; col < output_size; col++) {
+    outer_index[col] = static_cast<int>(col * nonzeros);
+    SampleCodeGeneratorColumn(prg, nonce, col, vole_seed_size_,
+                              inner_index + col * nonzeros,
+                              values + col * nonzeros);
+  }
+  outer_index[output_size] = static_cast<int>(output_size * nonzeros);
   return mpc_utils::OkStatus();
 }
 
+template <typename T>
+void DistributedVectorOLE<T>::SampleCodeGeneratorColumn(
+    const FixedKeyAES &prg, absl::uint128 nonce, int64_t col, int num_rows,
+    int *rows, T *values) {
+  const int nonzeros = VOLEParameters::kCodeGeneratorNonzeros;
+  // The k-th counter of column `col` is nonce + (col, k), so the ranges of
+  // different columns never overlap. The first `nonzeros` blocks are the
+  // values, the following ones the rows.
+  absl::InlinedVector<absl::uint128, 20> blocks(2 * nonzeros);
+  for (int k = 0; k < 2 * nonzeros; k++) {
+    blocks[k] = nonce + absl::MakeUint128(col, k);
+  }
+  if (values) {
+    prg.Encrypt(blocks, absl::MakeSpan(blocks));
+    for (int i = 0; i < nonzeros; i++) {
+      values[i] = ScalarHelper<T>::FromUint128(blocks[i]);
+    }
+  } else {
+    auto row_blocks = absl::MakeSpan(blocks).subspan(nonzeros);
+    prg.Encrypt(row_blocks, row_blocks);
+  }
+
+  // Map each block to a row with Lemire's multiply-shift reduction, i.e.,
+  // floor(block * num_rows / 2^128), and skip rows we already have. Repeated
+  // rows are rare, so we only encrypt additional blocks one at a time.
+  int num_sampled = 0;
+  for (int64_t k = nonzeros; num_sampled < nonzeros; k++) {
+    absl::uint128 block;
+    if (k < 2 * nonzeros) {
+      block = blocks[k];
+    } else {
+      block = nonce + absl::MakeUint128(col, k);
+      prg.Encrypt(absl::MakeConstSpan(&block, 1), absl::MakeSpan(&block, 1));
+    }
+    absl::uint128 low =
+        absl::uint128(absl::Uint128Low64(block)) * uint64_t(num_rows);
+    int row = static_cast<int>(absl::Uint128High64(
+        absl::uint128(absl::Uint128High64(block)) * uint64_t(num_rows) +
+        absl::Uint128High64(low)));
+    // Insert into the sorted prefix of `rows`, unless it is already there.
+    int position = num_sampled;
+    while (position > 0 && rows[position - 1] > row) {
+      position--;
+    }
+    if (position > 0 && rows[position - 1] == row) {
+      continue;
+    }
+    std::copy_backward(rows + position, rows + num_sampled,
+                       rows + num_sampled + 1);
+    rows[position] = row;
+    num_sampled++;
+  }
+}
+
+template <typename T>
+void DistributedVectorOLE<T>::MultiplyCodeGenerator(
+    absl::Span<const Expansion> expansions) const {
+  // Computes all expansions for the given column.
+  auto expand_column = [expansions](int64_t col, const int *rows,
+                                    const T *values, int num_values) {
+    for (const Expansion &expansion : expansions) {
+      T result(0);
+      if (values) {
+        result = ScalarHelper<T>::GatherDotProduct(expansion.seed->data(), rows,
+                                                   values, num_values);
+      } else {
+        for (int i = 0; i < num_values; i++) {
+          result += (*expansion.seed)[rows[i]];
+        }
+      }
+      if (expansion.addend && expansion.subtract) {
+        result -= (*expansion.addend)[col];
+      } else if (expansion.addend) {
+        result += (*expansion.addend)[col];
+      }
+      expansion.output[col] = std::move(result);
+    }
+  };
+
+  const int nonzeros = VOLEParameters::kCodeGeneratorNonzeros;
+  int64_t num_cols = code_generator_cols_;
+  int64_t num_tiles = (num_cols + kExpansionTileSize - 1) / kExpansionTileSize;
+  bool binary =
+      code_generator_coefficients_ == CodeGeneratorCoefficients::kBinary;
+  if (code_generator_mode_ == CodeGeneratorMode::kStored && binary) {
+    const int *rows = binary_code_generator_.data();
+#pragma omp parallel for schedule(static)
+    for (int64_t tile = 0; tile < num_tiles; tile++) {
+      int64_t tile_end = std::min(num_cols, (tile + 1) * kExpansionTileSize);
+      for (int64_t col = tile * kExpansionTileSize; col < tile_end; col++) {
+        if (col + kPrefetchDistance < tile_end) {
+          for (int k = 0; k < nonzeros; k++) {
+            for (const Expansion &expansion : expansions) {
+              __builtin_prefetch(
+                  expansion.seed->data() +
+                  rows[(col + kPrefetchDistance) * nonzeros + k]);
+            }
+          }
+        }
+        expand_column(col, rows + col * nonzeros, nullptr, nonzeros);
+      }
+    }
+    return;
+  }
+  if (code_generator_mode_ == CodeGeneratorMode::kStored) {
+    const int *outer_index = code_generator_.outerIndexPtr();
+    const int *inner_index = code_generator_.innerIndexPtr();
+    const T *values = code_generator_.valuePtr();
+#pragma omp parallel for schedule(static)
+    for (int64_t tile = 0; tile < num_tiles; tile++) {
+      int64_t tile_end = std::min(num_cols, (tile + 1) * kExpansionTileSize);
+      for (int64_t col = tile * kExpansionTileSize; col < tile_end; col++) {
+        // The seed elements of each column are scattered randomly, so we
+        // prefetch them a few columns ahead.
+        if (col + kPrefetchDistance < tile_end) {
+          for (int k = outer_index[col + kPrefetchDistance];
+               k < outer_index[col + kPrefetchDistance + 1]; k++) {
+            for (const Expansion &expansion : expansions) {
+              __builtin_prefetch(expansion.seed->data() + inner_index[k]);
+            }
+          }
+        }
+        expand_column(col, inner_index + outer_index[col],
+                      values + outer_index[col],
+                      outer_index[col + 1] - outer_index[col]);
+      }
+    }
+    return;
+  }
+#pragma omp parallel
+  {
+    std::vector<int> rows(nonzeros);
+    std::vector<T> values_buffer(binary ? 0 : nonzeros);
+    T *values = binary ? nullptr : values_buffer.data();
+#pragma omp for schedule(static)
+    for (int64_t tile = 0; tile < num_tiles; tile++) {
+      int64_t tile_end = std::min(num_cols, (tile + 1) * kExpansionTileSize);
+      for (int64_t col = tile * kExpansionTileSize; col < tile_end; col++) {
+        SampleCodeGeneratorColumn(*code_generator_prg_, code_generator_nonce_,
+                                  col, static_cast<int>(code_generator_rows_),
+                                  rows.data(), values);
+        expand_column(col, rows.data(), values, nonzeros);
+      }
+    }
+  }
+}
+
 template <typename T>
 mpc_utils::Status DistributedVectorOLE<T>::ExpandSender(
     int64_t output_size, int new_vole_seed_size, int new_mpfss_seed_size) {
@@ -425,9 +709,9 @@ mpc_utils::Status DistributedVectorOLE<T>::ExpandSender(
     return mpc_utils::InternalError("Both seeds must have the same size");
   }
 
-  if (code_generator_.rows() !=
+  if (code_generator_rows_ !=
           static_cast<int64_t>(sender_vole_seed_.u.size()) ||
-      code_generator_.cols() != output_size) {
+      code_generator_cols_ != output_size) {
     return mpc_utils::InternalError("Code generator has the wrong dimensions");
   }
 
@@ -436,33 +720,50 @@ mpc_utils::Status DistributedVectorOLE<T>::ExpandSender(
   RAND_bytes(seed.data(), seed.size());
   ASSIGN_OR_RETURN(auto rng,
                    AESUniformBitGenerator::Create(seed, num_noise_indices_));
-  absl::flat_hash_set<int64_t> indices_set;
-  std::uniform_int_distribution<int64_t> dist(0, output_size - 1);
-  while (static_cast<int>(indices_set.size()) < num_noise_indices_) {
-    indices_set.insert(dist(rng));
+  std::vector<int64_t> indices;
+  if (mpfss_->bucket_mapping() ==
+      MPFSSKnownIndices::BucketMapping::kRegular) {
+    // Regular noise: one index in each block.
+    indices.resize(num_noise_indices_);
+    for (int i = 0; i < num_noise_indices_; i++) {
+      std::uniform_int_distribution<int64_t> dist(
+          MPFSSKnownIndices::RegularBlockStart(output_size, num_noise_indices_,
+                                               i),
+          MPFSSKnownIndices::RegularBlockStart(output_size, num_noise_indices_,
+                                               i + 1) -
+              1);
+      indices[i] = dist(rng);
+    }
+  } else {
+    absl::flat_hash_set<int64_t> indices_set;
+    std::uniform_int_distribution<int64_t> dist(0, output_size - 1);
+    while (static_cast<int>(indices_set.size()) < num_noise_indices_) {
+      indices_set.insert(dist(rng));
+    }
+    indices.assign(indices_set.begin(), indices_set.end());
   }
-  std::vector<int64_t> indices(indices_set.begin(), indices_set.end());
   Vector<T> y(num_noise_indices_), v0(output_size);
   ScalarHelper<T>::Randomize(absl::MakeSpan(y));
   RETURN_IF_ERROR(mpfss_->RunIndexProviderVectorOLE<T>(
       y, indices, sender_mpfss_seed_.u, sender_mpfss_seed_.v,
       absl::MakeSpan(v0)));
 
-  // Spread y into mu.
-  Vector<T> mu(output_size);
-  std::fill(mu.data(), mu.data() + output_size, T(0));
+  // Compute expansion and append it to the cache. Both expansions share a
+  // single pass over the code generator. The noise vector has y[i] at
+  // indices[i] and is zero elsewhere, so we add it afterwards.
+  int64_t cached_size = sender_cached_.u.size();
+  sender_cached_.u.conservativeResize(cached_size + output_size);
+  sender_cached_.v.conservativeResize(cached_size + output_size);
+  T *u_expanded = sender_cached_.u.data() + cached_size;
+  Expansion expansions[] = {
+      {&sender_vole_seed_.u, nullptr, false, u_expanded},
+      {&sender_vole_seed_.v, &v0, true, sender_cached_.v.data() + cached_size},
+  };
+  MultiplyCodeGenerator(expansions);
   for (int i = 0; i < num_noise_indices_; i++) {
-    mu[indices[i]] = y[i];
+    u_expanded[indices[i]] += y[i];
   }
 
-  // Compute expansion and append it to the cache.
-  sender_cached_.u.conservativeResize(sender_cached_.u.size() + output_size);
-  sender_cached_.v.conservativeResize(sender_cached_.v.size() + output_size);
-  sender_cached_.u.tail(output_size) =
-      sender_vole_seed_.u * code_generator_ + mu;
-  sender_cached_.v.tail(output_size) =
-      sender_vole_seed_.v * code_generator_ - v0;
-
   // Update seeds.
   ASSIGN_OR_RETURN(sender_vole_seed_, GetSenderCached(new_vole_seed_size));
   ASSIGN_OR_RETURN(sender_mpfss_seed_, GetSenderCached(new_mpfss_seed_size));
@@ -476,21 +777,22 @@ template <typename T>
 mpc_utils::Status DistributedVectorOLE<T>::ExpandReceiver(
     int64_t output_size, int new_vole_seed_size, int new_mpfss_seed_size) {
   // Sanity-check code generator dimensions.
-  if (code_generator_.rows() !=
+  if (code_generator_rows_ !=
           static_cast<int64_t>(receiver_vole_seed_.w.size()) ||
-      code_generator_.cols() != output_size) {
+      code_generator_cols_ != output_size) {
     return mpc_utils::InternalError("Code generator has the wrong dimensions");
   }
 
   // Compute MPFSS and expand seed, appending to the cache.
-  receiver_cached_.w.conservativeResize(receiver_cached_.w.size() +
-                                        output_size);
+  int64_t cached_size = receiver_cached_.w.size();
+  receiver_cached_.w.conservativeResize(cached_size + output_size);
   Vector<T> v1(output_size);
   RETURN_IF_ERROR(mpfss_->RunValueProviderVectorOLE<T>(
       receiver_mpfss_seed_.delta, num_noise_indices_, receiver_mpfss_seed_.w,
       absl::MakeSpan(v1)));
-  receiver_cached_.w.tail(output_size) =
-      receiver_vole_seed_.w * code_generator_ + v1;
+  Expansion expansion = {&receiver_vole_seed_.w, &v1, false,
+                         receiver_cached_.w.data() + cached_size};
+  MultiplyCodeGenerator(absl::MakeConstSpan(&expansion, 1));
 
   // Update seeds.
   ASSIGN_OR_RETURN(receiver_vole_seed_, GetReceiverCached(new_vole_seed_size));
@@ -31,15 +31,34 @@ namespace {
 template <typename T>
 class DistributedVectorOLETest : public ::testing::Test {
  protected:
+  using CodeGeneratorMode = typename DistributedVectorOLE<T>::CodeGeneratorMode;
+  using CodeGeneratorCoefficients =
+      typename DistributedVectorOLE<T>::CodeGeneratorCoefficients;
+
   DistributedVectorOLETest() : helper_(false) {}
   void SetUp() {
     emp::initialize_relic();
+    CreateInstances(MPFSSKnownIndices::BucketMapping::kPrecomputed);
+  }
+
+  // (Re-)creates both DistributedVectorOLE instances with the given bucket
+  // mapping, code generator modes, and code generator coefficients.
+  void CreateInstances(
+      MPFSSKnownIndices::BucketMapping bucket_mapping,
+      CodeGeneratorMode mode_0 = CodeGeneratorMode::kStored,
+      CodeGeneratorMode mode_1 = CodeGeneratorMode::kStored,
+      CodeGeneratorCoefficients coefficients =
+          CodeGeneratorCoefficients::kRandom) {
     comm_channel *chan0 = helper_.GetChannel(0);
     comm_channel *chan1 = helper_.GetChannel(1);
-    std::thread thread1([this, chan1] {
-      ASSERT_OK_AND_ASSIGN(vole_1_, DistributedVectorOLE<T>::Create(chan1));
+    std::thread thread1([this, chan1, bucket_mapping, mode_1, coefficients] {
+      ASSERT_OK_AND_ASSIGN(
+          vole_1_, DistributedVectorOLE<T>::Create(chan1, 40, bucket_mapping,
+                                                   mode_1, coefficients));
     });
-    ASSERT_OK_AND_ASSIGN(vole_0_, DistributedVectorOLE<T>::Create(chan0));
+    ASSERT_OK_AND_ASSIGN(
+        vole_0_, DistributedVectorOLE<T>::Create(chan0, 40, bucket_mapping,
+                                                 mode_0, coefficients));
     thread1.join();
   }
 
@@ -113,5 +132,81 @@ TYPED_TEST(DistributedVectorOLETest, TestLargeVector) {  // Set up NTL.
   this->TestVector(size);
 }
 
+TYPED_TEST(DistributedVectorOLETest, TestRegularNoise) {
+  int64_t modulus = 1152921504606846883L;  // 2^60 - 93
+  if (std::is_same<TypeParam, NTL::ZZ_p>::value) {
+    NTL::ZZ_p::init(NTL::conv<NTL::ZZ>(modulus));
+  } else if (std::is_same<TypeParam, NTL::zz_p>::value) {
+    NTL::zz_p::init(modulus);
+  }
+
+  this->CreateInstances(MPFSSKnownIndices::BucketMapping::kRegular);
+  for (int size : {1, 123, 100000}) {
+    this->TestVector(size);
+  }
+}
+
+TYPED_TEST(DistributedVectorOLETest, TestImplicitCodeGenerator) {
+  int64_t modulus = 1152921504606846883L;  // 2^60 - 93
+  if (std::is_same<TypeParam, NTL::ZZ_p>::value) {
+    NTL::ZZ_p::init(NTL::conv<NTL::ZZ>(modulus));
+  } else if (std::is_same<TypeParam, NTL::zz_p>::value) {
+    NTL::zz_p::init(modulus);
+  }
+
+  using CodeGeneratorMode =
+      typename DistributedVectorOLE<TypeParam>::CodeGeneratorMode;
+  this->CreateInstances(MPFSSKnownIndices::BucketMapping::kPrecomputed,
+                        CodeGeneratorMode::kImplicit,
+                        CodeGeneratorMode::kImplicit);
+  for (int size : {1, 123, 100000}) {
+    this->TestVector(size);
+  }
+
+  // Both modes give the same generator, so they can be mixed.
+  this->CreateInstances(MPFSSKnownIndices::BucketMapping::kPrecomputed,
+                        CodeGeneratorMode::kStored,
+                        CodeGeneratorMode::kImplicit);
+  this->TestVector(100000);
+}
+
+TYPED_TEST(DistributedVectorOLETest, TestBinaryCodeGenerator) {
+  int64_t modulus = 1152921504606846883L;  // 2^60 - 93
+  if (std::is_same<TypeParam, NTL::ZZ_p>::value) {
+    NTL::ZZ_p::init(NTL::conv<NTL::ZZ>(modulus));
+  } else if (std::is_same<TypeParam, NTL::zz_p>::value) {
+    NTL::zz_p::init(modulus);
+  }
+
+  using CodeGeneratorMode =
+      typename DistributedVectorOLE<TypeParam>::CodeGeneratorMode;
+  using CodeGeneratorCoefficients =
+      typename DistributedVectorOLE<TypeParam>::CodeGeneratorCoefficients;
+  if (ScalarHelper<TypeParam>::HasEvenCharacteristic()) {
+    // Binary generators are rejected for types of even characteristic.
+    auto status = DistributedVectorOLE<TypeParam>::Create(
+        this->helper_.GetChannel(0), 40,
+        MPFSSKnownIndices::BucketMapping::kPrecomputed,
+        CodeGeneratorMode::kStored, CodeGeneratorCoefficients::kBinary);
+    ASSERT_FALSE(status.ok());
+    EXPECT_EQ(status.status().message(),
+              "CodeGeneratorCoefficients::kBinary is not supported for types "
+              "of even characteristic");
+    return;
+  }
+  this->CreateInstances(MPFSSKnownIndices::BucketMapping::kPrecomputed,
+                        CodeGeneratorMode::kStored, CodeGeneratorMode::kStored,
+                        CodeGeneratorCoefficients::kBinary);
+  for (int size : {1, 123, 100000}) {
+    this->TestVector(size);
+  }
+
+  this->CreateInstances(MPFSSKnownIndices::BucketMapping::kPrecomputed,
+                        CodeGeneratorMode::kStored,
+                        CodeGeneratorMode::kImplicit,
+                        CodeGeneratorCoefficients::kBinary);
+  this->TestVector(100000);
+}
+
 }  // namespace
 }  // namespace distributed_vector_ole
@@ -0,0 +1,221 @@
+//    Distributed Vector-OLE
+//    Copyright (C) 2019 Phillipp Schoppmann and Adria Gascon
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "distributed_vector_ole/fixed_key_aes.h"
+
+#include <atomic>
+#include <cassert>
+
+#include "mpc_utils/canonical_errors.h"
+#include "openssl/err.h"
+
+#ifdef USE_ASM
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+namespace distributed_vector_ole {
+
+namespace {
+
+// Set by SetHardwareAESEnabled(false).
+std::atomic<bool> hardware_aes_disabled(false);
+
+bool CPUSupportsAESNI() {
+#if defined(USE_ASM) && (defined(__x86_64__) || defined(__i386__))
+  static const bool supported = [] {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("aes") && __builtin_cpu_supports("sse2");
+  }();
+  return supported;
+#else
+  return false;
+#endif
+}
+
+#ifdef USE_ASM
+// One step of the AES-128 key schedule. `assist` is the result of
+// _mm_aeskeygenassist_si128 on the previous round key.
+__attribute__((target("aes,sse2"))) __m128i KeyScheduleStep(__m128i key,
+                                                            __m128i assist) {
+  assist = _mm_shuffle_epi32(assist, 0xff);
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  return _mm_xor_si128(key, assist);
+}
+
+// Computes the 11 round keys of AES-128. The round constants have to be
+// immediates, so the loop is unrolled by hand.
+__attribute__((target("aes,sse2"))) void ExpandKeyAESNI(
+    const FixedKeyAES::Block &key, FixedKeyAES::Block *round_keys) {
+  __m128i *rk = reinterpret_cast<__m128i *>(round_keys);
+  rk[0] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&key));
+  rk[1] = KeyScheduleStep(rk[0], _mm_aeskeygenassist_si128(rk[0], 0x01));
+  rk[2] = KeyScheduleStep(rk[1], _mm_aeskeygenassist_si128(rk[1], 0x02));
+  rk[3] = KeyScheduleStep(rk[2], _mm_aeskeygenassist_si128(rk[2], 0x04));
+  rk[4] = KeyScheduleStep(rk[3], _mm_aeskeygenassist_si128(rk[3], 0x08));
+  rk[5] = KeyScheduleStep(rk[4], _mm_aeskeygenassist_si128(rk[4], 0x10));
+  rk[6] = KeyScheduleStep(rk[5], _mm_aeskeygenassist_si128(rk[5], 0x20));
+  rk[7] = KeyScheduleStep(rk[6], _mm_aeskeygenassist_si128(rk[6], 0x40));
+  rk[8] = KeyScheduleStep(rk[7], _mm_aeskeygenassist_si128(rk[7], 0x80));
+  rk[9] = KeyScheduleStep(rk[8], _mm_aeskeygenassist_si128(rk[8], 0x1b));
+  rk[10] = KeyScheduleStep(rk[9], _mm_aeskeygenassist_si128(rk[9], 0x36));
+}
+
+// FixedKeyAES::Sigma on an SSE register. Swaps the two 64-bit halves, and
+// XORs the upper half of `x` onto the new upper half.
+__attribute__((target("sse2"))) inline __m128i SigmaSSE(__m128i x) {
+  __m128i high_mask = _mm_set_epi64x(-1, 0);
+  return _mm_xor_si128(_mm_shuffle_epi32(x, 0x4e),
+                       _mm_and_si128(x, high_mask));
+}
+
+// Encrypts `num_blocks` blocks from `in` and writes them to `out` with the
+// given stride. If `sigma` is true, the inputs are first mapped through
+// FixedKeyAES::Sigma. If `xor_input` is true, each (mapped) input block is
+// XORed onto the corresponding output. Blocks are processed in groups of
+// kPipelineWidth, with the rounds of all blocks in a group interleaved.
+template <bool xor_input, bool sigma = false>
+__attribute__((target("aes,sse2"))) void EncryptAESNI(
+    const FixedKeyAES::Block *round_keys, const FixedKeyAES::Block *in,
+    int64_t num_blocks, FixedKeyAES::Block *out, int64_t out_stride) {
+  constexpr int kWidth = FixedKeyAES::kPipelineWidth;
+  const __m128i *rk = reinterpret_cast<const __m128i *>(round_keys);
+  int64_t i = 0;
+  for (; i + kWidth <= num_blocks; i += kWidth) {
+    __m128i input[kWidth], state[kWidth];
+    for (int j = 0; j < kWidth; j++) {
+      input[j] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i + j));
+      if (sigma) {
+        input[j] = SigmaSSE(input[j]);
+      }
+      state[j] = _mm_xor_si128(input[j], rk[0]);
+    }
+    for (int round = 1; round < 10; round++) {
+      __m128i round_key = rk[round];
+      for (int j = 0; j < kWidth; j++) {
+        state[j] = _mm_aesenc_si128(state[j], round_key);
+      }
+    }
+    for (int j = 0; j < kWidth; j++) {
+      state[j] = _mm_aesenclast_si128(state[j], rk[10]);
+      if (xor_input) {
+        state[j] = _mm_xor_si128(state[j], input[j]);
+      }
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + (i + j) * out_stride),
+                       state[j]);
+    }
+  }
+  // Remaining blocks one at a time.
+  for (; i < num_blocks; i++) {
+    __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    if (sigma) {
+      input = SigmaSSE(input);
+    }
+    __m128i state = _mm_xor_si128(input, rk[0]);
+    for (int round = 1; round < 10; round++) {
+      state = _mm_aesenc_si128(state, rk[round]);
+    }
+    state = _mm_aesenclast_si128(state, rk[10]);
+    if (xor_input) {
+      state = _mm_xor_si128(state, input);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * out_stride), state);
+  }
+}
+#endif  // USE_ASM
+
+// Portable version of EncryptAESNI using OpenSSL.
+template <bool xor_input, bool sigma = false>
+void EncryptFallback(const AES_KEY &expanded_key, const FixedKeyAES::Block *in,
+                     int64_t num_blocks, FixedKeyAES::Block *out,
+                     int64_t out_stride) {
+  for (int64_t i = 0; i < num_blocks; i++) {
+    // Copy the input first, since `in` and `out` may overlap.
+    FixedKeyAES::Block input = sigma ? FixedKeyAES::Sigma(in[i]) : in[i];
+    FixedKeyAES::Block result;
+    AES_encrypt(reinterpret_cast<const uint8_t *>(&input),
+                reinterpret_cast<uint8_t *>(&result), &expanded_key);
+    if (xor_input) {
+      result ^= input;
+    }
+    out[i * out_stride] = result;
+  }
+}
+
+}  // namespace
+
+mpc_utils::StatusOr<FixedKeyAES> FixedKeyAES::Create(Block key) {
+  FixedKeyAES result;
+  if (0 != AES_set_encrypt_key(reinterpret_cast<const uint8_t *>(&key),
+                               8 * sizeof(key), &result.expanded_key_)) {
+    return mpc_utils::InternalError(ERR_reason_error_string(ERR_get_error()));
+  }
+#ifdef USE_ASM
+  if (CPUSupportsAESNI()) {
+    ExpandKeyAESNI(key, result.round_keys_);
+  }
+#endif
+  return result;
+}
+
+void FixedKeyAES::Encrypt(absl::Span<const Block> in,
+                          absl::Span<Block> out) const {
+  assert(in.size() == out.size());
+#ifdef USE_ASM
+  if (HardwareAESEnabled()) {
+    EncryptAESNI<false>(round_keys_, in.data(), in.size(), out.data(), 1);
+    return;
+  }
+#endif
+  EncryptFallback<false>(expanded_key_, in.data(), in.size(), out.data(), 1);
+}
+
+void FixedKeyAES::Hash(absl::Span<const Block> in, Block *out,
+                       int64_t out_stride) const {
+#ifdef USE_ASM
+  if (HardwareAESEnabled()) {
+    EncryptAESNI<true>(round_keys_, in.data(), in.size(), out, out_stride);
+    return;
+  }
+#endif
+  EncryptFallback<true>(expanded_key_, in.data(), in.size(), out, out_stride);
+}
+
+void FixedKeyAES::CCRHash(absl::Span<const Block> in, Block *out,
+                          int64_t out_stride) const {
+#ifdef USE_ASM
+  if (HardwareAESEnabled()) {
+    EncryptAESNI<true, true>(round_keys_, in.data(), in.size(), out,
+                             out_stride);
+    return;
+  }
+#endif
+  EncryptFallback<true, true>(expanded_key_, in.data(), in.size(), out,
+                              out_stride);
+}
+
+bool FixedKeyAES::HardwareAESEnabled() {
+  return CPUSupportsAESNI() &&
+         !hardware_aes_disabled.load(std::memory_order_relaxed);
+}
+
+void FixedKeyAES::SetHardwareAESEnabled(bool enabled) {
+  hardware_aes_disabled.store(!enabled, std::memory_order_relaxed);
+}
+
+}  // namespace distributed_vector_ole
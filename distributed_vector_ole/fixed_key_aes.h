@@ -0,0 +1,111 @@
+//    Distributed Vector-OLE
+//    Copyright (C) 2019 Phillipp Schoppmann and Adria Gascon
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef DISTRIBUTED_VECTOR_OLE_FIXED_KEY_AES_H_
+#define DISTRIBUTED_VECTOR_OLE_FIXED_KEY_AES_H_
+
+// AES-128 with a fixed key, evaluated on many blocks per call. On CPUs that
+// support AES-NI, blocks are processed in groups of kPipelineWidth, and the
+// rounds of all blocks in a group are interleaved. This keeps the AES unit
+// busy, as opposed to calling AES_encrypt once per block, where each round has
+// to wait for the result of the previous one. On other CPUs, or if hardware
+// AES is disabled using SetHardwareAESEnabled, OpenSSL's AES_encrypt is called
+// for each block.
+
+#include <cstdint>
+
+#include "absl/numeric/int128.h"
+#include "absl/types/span.h"
+#include "mpc_utils/statusor.h"
+#include "openssl/aes.h"
+
+namespace distributed_vector_ole {
+
+class FixedKeyAES {
+ public:
+  using Block = absl::uint128;
+  static_assert(sizeof(Block) == AES_BLOCK_SIZE, "AES block size is not 128");
+
+  // Number of blocks processed in parallel by the AES-NI kernel.
+  static const int kPipelineWidth = 8;
+
+  // Expands `key` into a FixedKeyAES instance.
+  static mpc_utils::StatusOr<FixedKeyAES> Create(Block key);
+
+  // Sets out[i] = AES(key, in[i]). `in` and `out` must have the same size, and
+  // may point to the same memory.
+  void Encrypt(absl::Span<const Block> in, absl::Span<Block> out) const;
+
+  // Sets out[i * out_stride] = AES(key, in[i]) ^ in[i] for all i. This is the
+  // PRG used for expanding GGM trees. The output stride allows writing the
+  // children of consecutive nodes directly into the next level of a tree.
+  void Hash(absl::Span<const Block> in, Block *out,
+            int64_t out_stride = 1) const;
+
+  // Single-block version of the above.
+  Block Hash(Block in) const {
+    Block out;
+    Hash(absl::MakeConstSpan(&in, 1), &out);
+    return out;
+  }
+
+  // Sets out[i * out_stride] = AES(key, s) ^ s for all i, where s =
+  // Sigma(in[i]). This is a circular correlation-robust hash [1], as required
+  // by the half-tree construction of GGM trees.
+  //
+  // [1] Guo, Xiaojie, et al. "Half-Tree: Halving the Cost of Tree Expansion in
+  // COT and DPF." EUROCRYPT 2023.
+  void CCRHash(absl::Span<const Block> in, Block *out,
+               int64_t out_stride = 1) const;
+
+  // Single-block version of the above.
+  Block CCRHash(Block in) const {
+    Block out;
+    CCRHash(absl::MakeConstSpan(&in, 1), &out);
+    return out;
+  }
+
+  // The linear orthomorphism used by CCRHash. Maps x_L || x_R to
+  // (x_L ^ x_R) || x_L, where x_L are the upper 64 bits of x.
+  static Block Sigma(Block x) {
+    uint64_t high = absl::Uint128High64(x);
+    return absl::MakeUint128(high ^ absl::Uint128Low64(x), high);
+  }
+
+  // Returns the key schedule in OpenSSL's format.
+  inline const AES_KEY &expanded_key() const { return expanded_key_; }
+
+  // Returns true if the pipelined AES-NI kernel is used.
+  static bool HardwareAESEnabled();
+
+  // Enables or disables the pipelined AES-NI kernel, e.g., for benchmarking
+  // the fallback. Enabling has no effect if the CPU does not support AES-NI.
+  static void SetHardwareAESEnabled(bool enabled);
+
+ private:
+  FixedKeyAES() = default;
+
+  // Key schedule used by the OpenSSL fallback.
+  AES_KEY expanded_key_;
+
+  // Round keys in the layout expected by the AES-NI instructions. Only
+  // initialized if the CPU supports AES-NI.
+  alignas(16) Block round_keys_[11];
+};
+
+}  // namespace distributed_vector_ole
+
+#endif  // DISTRIBUTED_VECTOR_OLE_FIXED_KEY_AES_H_
@@ -0,0 +1,132 @@
+//    Distributed Vector-OLE
+//    Copyright (C) 2019 Phillipp Schoppmann and Adria Gascon
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "distributed_vector_ole/fixed_key_aes.h"
+
+#include <vector>
+
+#include "absl/types/optional.h"
+#include "gtest/gtest.h"
+#include "mpc_utils/status_matchers.h"
+#include "openssl/rand.h"
+
+namespace distributed_vector_ole {
+namespace {
+
+class FixedKeyAESTest : public ::testing::TestWithParam<bool> {
+ protected:
+  void SetUp() override {
+    FixedKeyAES::SetHardwareAESEnabled(GetParam());
+    RAND_bytes(reinterpret_cast<uint8_t*>(&key_), sizeof(key_));
+    ASSERT_OK_AND_ASSIGN(aes_, FixedKeyAES::Create(key_));
+    ASSERT_EQ(0, AES_set_encrypt_key(reinterpret_cast<const uint8_t*>(&key_),
+                                     128, &expanded_key_));
+  }
+
+  void TearDown() override { FixedKeyAES::SetHardwareAESEnabled(true); }
+
+  // Encrypts `in` using OpenSSL directly.
+  FixedKeyAES::Block EncryptNaively(FixedKeyAES::Block in) {
+    FixedKeyAES::Block out;
+    AES_encrypt(reinterpret_cast<const uint8_t*>(&in),
+                reinterpret_cast<uint8_t*>(&out), &expanded_key_);
+    return out;
+  }
+
+  std::vector<FixedKeyAES::Block> RandomBlocks(int num_blocks) {
+    std::vector<FixedKeyAES::Block> result(num_blocks);
+    RAND_bytes(reinterpret_cast<uint8_t*>(result.data()),
+               num_blocks * sizeof(FixedKeyAES::Block));
+    return result;
+  }
+
+  FixedKeyAES::Block key_;
+  absl::optional<FixedKeyAES> aes_;
+  AES_KEY expanded_key_;
+};
+
+TEST_P(FixedKeyAESTest, Encrypt) {
+  for (int num_blocks = 0; num_blocks < 3 * FixedKeyAES::kPipelineWidth;
+       num_blocks++) {
+    auto in = RandomBlocks(num_blocks);
+    std::vector<FixedKeyAES::Block> out(num_blocks);
+    aes_->Encrypt(in, absl::MakeSpan(out));
+    for (int i = 0; i < num_blocks; i++) {
+      EXPECT_EQ(out[i], EncryptNaively(in[i]));
+    }
+  }
+}
+
+TEST_P(FixedKeyAESTest, EncryptInPlace) {
+  int num_blocks = 2 * FixedKeyAES::kPipelineWidth + 3;
+  auto in = RandomBlocks(num_blocks);
+  auto out = in;
+  aes_->Encrypt(out, absl::MakeSpan(out));
+  for (int i = 0; i < num_blocks; i++) {
+    EXPECT_EQ(out[i], EncryptNaively(in[i]));
+  }
+}
+
+TEST_P(FixedKeyAESTest, HashWithStride) {
+  for (int stride = 1; stride < 5; stride++) {
+    for (int num_blocks = 0; num_blocks < 3 * FixedKeyAES::kPipelineWidth;
+         num_blocks++) {
+      auto in = RandomBlocks(num_blocks);
+      std::vector<FixedKeyAES::Block> out(num_blocks * stride, 0);
+      aes_->Hash(in, out.data(), stride);
+      for (int i = 0; i < num_blocks * stride; i++) {
+        if (i % stride == 0) {
+          EXPECT_EQ(out[i], EncryptNaively(in[i / stride]) ^ in[i / stride]);
+        } else {
+          EXPECT_EQ(out[i], 0);
+        }
+      }
+    }
+  }
+}
+
+TEST_P(FixedKeyAESTest, HashSingleBlock) {
+  FixedKeyAES::Block in = 42;
+  EXPECT_EQ(aes_->Hash(in), EncryptNaively(in) ^ in);
+}
+
+TEST_P(FixedKeyAESTest, CCRHash) {
+  for (int num_blocks = 0; num_blocks < 3 * FixedKeyAES::kPipelineWidth;
+       num_blocks++) {
+    auto in = RandomBlocks(num_blocks);
+    std::vector<FixedKeyAES::Block> out(2 * num_blocks, 0);
+    aes_->CCRHash(in, out.data(), 2);
+    for (int i = 0; i < num_blocks; i++) {
+      FixedKeyAES::Block sigma = FixedKeyAES::Sigma(in[i]);
+      EXPECT_EQ(out[2 * i], EncryptNaively(sigma) ^ sigma);
+      EXPECT_EQ(out[2 * i + 1], 0);
+    }
+  }
+}
+
+TEST(FixedKeyAESSigmaTest, Sigma) {
+  FixedKeyAES::Block x =
+      absl::MakeUint128(0x0123456789abcdef, 0xfedcba9876543210);
+  EXPECT_EQ(FixedKeyAES::Sigma(x),
+            absl::MakeUint128(0x0123456789abcdef ^ 0xfedcba9876543210,
+                              0x0123456789abcdef));
+}
+
+INSTANTIATE_TEST_SUITE_P(HardwareAES, FixedKeyAESTest,
+                         ::testing::Values(true, false));
+
+}  // namespace
+}  // namespace distributed_vector_ole
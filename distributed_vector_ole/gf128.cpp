@@ -140,6 +140,49 @@ gf128::operator*=(const gf128 &other) {
 
 void gf128::square() { this->operator*=(*this); }
 
+#ifdef USE_ASM
+__attribute__((target("pclmul,sse2")))
+#endif
+gf128
+gf128::GatherDotProduct(const gf128 *x, const int *indices, const gf128 *y,
+                        int64_t n) {
+#ifdef USE_ASM
+  /* carry-less multiplication is linear, so we can add up the 256-bit
+     products as in operator*= and reduce the result once at the end */
+  __m128i mul256_high = _mm_setzero_si128();
+  __m128i mul256_low = _mm_setzero_si128();
+  __m128i mul256_mid = _mm_setzero_si128();
+  for (int64_t i = 0; i < n; ++i) {
+    const __m128i a = _mm_loadu_si128((const __m128i *)&(x[indices[i]].value_));
+    const __m128i b = _mm_loadu_si128((const __m128i *)&(y[i].value_));
+    mul256_high = _mm_xor_si128(mul256_high, _mm_clmulepi64_si128(a, b, 0x11));
+    mul256_low = _mm_xor_si128(mul256_low, _mm_clmulepi64_si128(a, b, 0x00));
+    mul256_mid = _mm_xor_si128(mul256_mid, _mm_clmulepi64_si128(a, b, 0x01));
+    mul256_mid = _mm_xor_si128(mul256_mid, _mm_clmulepi64_si128(a, b, 0x10));
+  }
+  mul256_high = _mm_xor_si128(mul256_high, _mm_srli_si128(mul256_mid, 8));
+  mul256_low = _mm_xor_si128(mul256_low, _mm_slli_si128(mul256_mid, 8));
+
+  /* reduce as in operator*= */
+  const __m128i modulus = _mm_loadl_epi64((const __m128i *)&(modulus_));
+  __m128i tmp = _mm_clmulepi64_si128(mul256_high, modulus, 0x01);
+  mul256_low = _mm_xor_si128(mul256_low, _mm_slli_si128(tmp, 8));
+  mul256_high = _mm_xor_si128(mul256_high, _mm_srli_si128(tmp, 8));
+  tmp = _mm_clmulepi64_si128(mul256_high, modulus, 0x00);
+  mul256_low = _mm_xor_si128(mul256_low, tmp);
+
+  gf128 result;
+  _mm_storeu_si128((__m128i *)result.value_, mul256_low);
+  return result;
+#else
+  gf128 result(0);
+  for (int64_t i = 0; i < n; ++i) {
+    result += x[indices[i]] * y[i];
+  }
+  return result;
+#endif
+}
+
 gf128 gf128::operator+(const gf128 &other) const {
   gf128 result(*this);
   return (result += (other));
@@ -71,6 +71,12 @@ class gf128 {
 
   gf128 inverse() const;
 
+  // Returns the sum of x[indices[i]] * y[i] for all i < n. Adds up the
+  // unreduced products and reduces the sum only once, instead of once per
+  // product as with operator*.
+  static gf128 GatherDotProduct(const gf128 *x, const int *indices,
+                                const gf128 *y, int64_t n);
+
   void randomize();
 
   bool operator==(const gf128 &other) const;
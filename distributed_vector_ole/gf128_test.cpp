@@ -73,4 +73,25 @@ TEST(InverseTest, SimpleTest) {
   EXPECT_EQ(a * a_inv, gf128(1));
 }
 
+TEST(GatherDotProductTest, MatchesMultiplication) {
+  const int64_t n = 100;
+  std::vector<gf128> x(2 * n), y(n);
+  std::vector<int> indices(n);
+  gf128 expected(0);
+  for (int64_t i = 0; i < n; ++i) {
+    x[2 * i] = gf128::random_element();
+    x[2 * i + 1] = gf128::random_element();
+    y[i] = gf128::random_element();
+    indices[i] = static_cast<int>((7 * i) % (2 * n));
+  }
+  for (int64_t i = 0; i < n; ++i) {
+    expected += x[indices[i]] * y[i];
+  }
+
+  EXPECT_EQ(gf128::GatherDotProduct(x.data(), indices.data(), y.data(), n),
+            expected);
+  EXPECT_EQ(gf128::GatherDotProduct(x.data(), indices.data(), y.data(), 0),
+            gf128(0));
+}
+
 }  // namespace distributed_vector_ole
@@ -0,0 +1,307 @@
+//    Distributed Vector-OLE
+//    Copyright (C) 2019 Phillipp Schoppmann and Adria Gascon
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "distributed_vector_ole/ggm_forest.h"
+
+#include <omp.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "mpc_utils/canonical_errors.h"
+#include "mpc_utils/status_macros.h"
+
+namespace distributed_vector_ole {
+
+namespace {
+
+// Returns the number of levels of a tree with the given arity and number of
+// leaves. Must match the tree layout used by GGMTree.
+int NumLevels(int arity, int64_t num_leaves) {
+  return static_cast<int>(1 +
+                          std::ceil(std::log(num_leaves) / std::log(arity)));
+}
+
+// Returns the index of the node at `level` on the path from the root to
+// `leaf`, in a tree with `num_levels` levels.
+int64_t NodeOnPath(int arity, int num_levels, int level, int64_t leaf) {
+  for (int i = level; i < num_levels - 1; i++) {
+    leaf /= arity;
+  }
+  return leaf;
+}
+
+// A range of consecutive trees that are expanded together.
+struct Batch {
+  int first_tree;
+  int end_tree;
+  // Maximum number of levels of all trees in the batch.
+  int num_levels;
+};
+
+}  // namespace
+
+mpc_utils::Status GGMForest::Expand(
+    absl::Span<const int64_t> num_leaves, absl::Span<const Block> seeds,
+    absl::Span<const Block> keys, const LeafCallback &leaf_callback,
+    std::vector<std::vector<std::vector<Block>>> *sibling_wise_xors) {
+  if (seeds.size() != num_leaves.size()) {
+    return mpc_utils::InvalidArgumentError(
+        "`seeds` and `num_leaves` must have the same size");
+  }
+  return ExpandImpl(num_leaves, seeds, {}, {}, keys, leaf_callback,
+                    sibling_wise_xors);
+}
+
+mpc_utils::Status GGMForest::ExpandFromSiblingWiseXOR(
+    absl::Span<const int64_t> num_leaves,
+    absl::Span<const int64_t> missing_indices,
+    absl::Span<const std::vector<std::vector<Block>>> sibling_wise_xors,
+    absl::Span<const Block> keys, const LeafCallback &leaf_callback) {
+  if (missing_indices.size() != num_leaves.size() ||
+      sibling_wise_xors.size() != num_leaves.size()) {
+    return mpc_utils::InvalidArgumentError(
+        "`missing_indices`, `sibling_wise_xors` and `num_leaves` must have the "
+        "same size");
+  }
+  return ExpandImpl(num_leaves, {}, missing_indices, sibling_wise_xors, keys,
+                    leaf_callback, nullptr);
+}
+
+mpc_utils::Status GGMForest::ExpandImpl(
+    absl::Span<const int64_t> num_leaves, absl::Span<const Block> seeds,
+    absl::Span<const int64_t> missing_indices,
+    absl::Span<const std::vector<std::vector<Block>>> received_xors,
+    absl::Span<const Block> keys, const LeafCallback &leaf_callback,
+    std::vector<std::vector<std::vector<Block>>> *sibling_wise_xors) {
+  ASSIGN_OR_RETURN(auto expander,
+                   GGMTree::NodeExpander::Create(keys, construction_));
+  int arity = expander.arity();
+  int num_trees = static_cast<int>(num_leaves.size());
+  bool receiver = !missing_indices.empty();
+
+  if (sibling_wise_xors) {
+    sibling_wise_xors->resize(num_trees);
+  }
+
+  // Compute the level sizes of all trees.
+  level_offsets_.assign(num_trees + 1, 0);
+  level_sizes_.clear();
+  for (int i = 0; i < num_trees; i++) {
+    if (num_leaves[i] < 0 || num_leaves[i] > kMaxLeavesPerTree) {
+      return mpc_utils::InvalidArgumentError(
+          "`num_leaves` must be between 0 and kMaxLeavesPerTree");
+    }
+    if (num_leaves[i] > 0) {
+      int num_levels = NumLevels(arity, num_leaves[i]);
+      int64_t offset = level_sizes_.size();
+      level_sizes_.resize(offset + num_levels);
+      level_sizes_[offset + num_levels - 1] = num_leaves[i];
+      for (int level = num_levels - 2; level >= 0; level--) {
+        level_sizes_[offset + level] =
+            (level_sizes_[offset + level + 1] + arity - 1) / arity;
+      }
+      if (receiver) {
+        if (missing_indices[i] < 0 || missing_indices[i] >= num_leaves[i]) {
+          return mpc_utils::InvalidArgumentError(
+              "`missing_indices[i]` must be smaller than `num_leaves[i]`");
+        }
+        if (static_cast<int>(received_xors[i].size()) != num_levels - 1) {
+          return mpc_utils::InvalidArgumentError(
+              "Dimensions passed in `sibling_wise_xors` do not match "
+              "`num_leaves`");
+        }
+        for (const auto &level_xors : received_xors[i]) {
+          if (static_cast<int>(level_xors.size()) != arity) {
+            return mpc_utils::InvalidArgumentError(
+                "All elements of `sibling_wise_xors` must have length "
+                "`arity`");
+          }
+        }
+      }
+      if (sibling_wise_xors) {
+        (*sibling_wise_xors)[i].assign(num_levels - 1,
+                                       std::vector<Block>(arity, 0));
+      }
+    }
+    level_offsets_[i + 1] = level_sizes_.size();
+  }
+
+  // Group consecutive trees into batches. A batch needs space for two
+  // compacted levels, each of which has at most as many nodes as the batch has
+  // leaves, and for the PRG outputs of one level, which have at most
+  // arity - 1 additional nodes per tree.
+  std::vector<Batch> batches;
+  int64_t batch_buffer_size = 0;
+  for (int i = 0; i < num_trees;) {
+    if (num_leaves[i] == 0) {
+      i++;
+      continue;
+    }
+    Batch batch = {i, i, 0};
+    int64_t batch_leaves = 0;
+    while (batch.end_tree < num_trees &&
+           batch_leaves + num_leaves[batch.end_tree] <= kMaxLeavesPerBatch) {
+      batch_leaves += num_leaves[batch.end_tree];
+      batch.num_levels = std::max(
+          batch.num_levels,
+          static_cast<int>(level_offsets_[batch.end_tree + 1] -
+                           level_offsets_[batch.end_tree]));
+      batch.end_tree++;
+    }
+    batch_buffer_size = std::max(
+        batch_buffer_size,
+        3 * batch_leaves + (arity - 1) * (batch.end_tree - batch.first_tree));
+    batches.push_back(batch);
+    i = batch.end_tree;
+  }
+  if (batches.empty()) {
+    return mpc_utils::OkStatus();
+  }
+
+  int num_batches = static_cast<int>(batches.size());
+  int num_threads =
+      omp_in_parallel() ? 1 : std::min(omp_get_max_threads(), num_batches);
+  if (static_cast<int64_t>(buffer_.size()) < num_threads * batch_buffer_size) {
+    buffer_.resize(num_threads * batch_buffer_size);
+  }
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+  for (int b = 0; b < num_batches; b++) {
+    ExpandBatch(batches[b].first_tree, batches[b].end_tree,
+                batches[b].num_levels, expander, seeds, missing_indices,
+                received_xors, leaf_callback, sibling_wise_xors,
+                buffer_.data() + omp_get_thread_num() * batch_buffer_size);
+  }
+  return mpc_utils::OkStatus();
+}
+
+void GGMForest::ExpandBatch(
+    int first_tree, int end_tree, int num_levels,
+    const GGMTree::NodeExpander &expander, absl::Span<const Block> seeds,
+    absl::Span<const int64_t> missing_indices,
+    absl::Span<const std::vector<std::vector<Block>>> received_xors,
+    const LeafCallback &leaf_callback,
+    std::vector<std::vector<std::vector<Block>>> *sibling_wise_xors,
+    Block *buffer) const {
+  int arity = expander.arity();
+  bool receiver = !missing_indices.empty();
+  int64_t batch_leaves = 0;
+  for (int i = first_tree; i < end_tree; i++) {
+    if (level_offsets_[i + 1] > level_offsets_[i]) {
+      batch_leaves += level_sizes_[level_offsets_[i + 1] - 1];
+    }
+  }
+  // `current` and `next` hold the nodes of all active trees on consecutive
+  // levels, one tree after the other. `children` holds the PRG outputs for
+  // `current`, where the children of current[j] start at children[arity * j].
+  Block *current = buffer;
+  Block *next = buffer + batch_leaves;
+  Block *children = buffer + 2 * batch_leaves;
+  std::vector<Block> xors(arity);
+
+  // Returns the root of tree i. The receiver does not know the root, which is
+  // always on the path to the missing leaf, so it is set to zero.
+  auto root = [&seeds, receiver](int i) {
+    return receiver ? Block(0) : seeds[i];
+  };
+
+  int64_t current_size = 0;
+  for (int i = first_tree; i < end_tree; i++) {
+    if (level_offsets_[i + 1] - level_offsets_[i] == num_levels) {
+      current[current_size++] = root(i);
+    }
+  }
+  for (int step = 0; step < num_levels - 1; step++) {
+    expander.Expand(absl::MakeConstSpan(current, current_size),
+                    arity * current_size, children);
+    // Copy the children that actually exist to `next`, and add the roots of
+    // trees that start at the next level.
+    int64_t position = 0, next_size = 0;
+    for (int i = first_tree; i < end_tree; i++) {
+      int tree_levels =
+          static_cast<int>(level_offsets_[i + 1] - level_offsets_[i]);
+      int level = step - (num_levels - tree_levels);
+      if (tree_levels == 0 || level < -1) {
+        continue;
+      }
+      if (level == -1) {
+        next[next_size++] = root(i);
+        continue;
+      }
+      const int64_t *sizes = &level_sizes_[level_offsets_[i]];
+      const Block *tree_children = children + arity * position;
+      Block *output = next + next_size;
+      int64_t num_children = sizes[level + 1];
+      std::fill(xors.begin(), xors.end(), 0);
+      for (int64_t j = 0; j < num_children; j += arity) {
+        int num_siblings =
+            static_cast<int>(std::min<int64_t>(arity, num_children - j));
+        for (int sibling_index = 0; sibling_index < num_siblings;
+             sibling_index++) {
+          output[j + sibling_index] = tree_children[j + sibling_index];
+          xors[sibling_index] ^= output[j + sibling_index];
+        }
+      }
+      if (!receiver) {
+        if (sibling_wise_xors) {
+          auto &level_xors = (*sibling_wise_xors)[i][level];
+          for (int sibling_index = 0; sibling_index < arity; sibling_index++) {
+            level_xors[sibling_index] ^= xors[sibling_index];
+          }
+        }
+      } else {
+        // The children of the node on the missing path were computed from a
+        // wrong value. Replace them by the XOR of the received sibling-wise
+        // XOR and all other children with the same sibling index, except for
+        // the one on the missing path, which is set to zero.
+        int64_t path_node =
+            NodeOnPath(arity, tree_levels, level, missing_indices[i]);
+        int64_t path_child =
+            NodeOnPath(arity, tree_levels, level + 1, missing_indices[i]);
+        int64_t first_child = path_node * arity;
+        int num_siblings = static_cast<int>(
+            std::min<int64_t>(arity, num_children - first_child));
+        for (int sibling_index = 0; sibling_index < num_siblings;
+             sibling_index++) {
+          Block &child = output[first_child + sibling_index];
+          if (first_child + sibling_index == path_child) {
+            child = 0;
+          } else {
+            child ^= xors[sibling_index] ^
+                     received_xors[i][level][sibling_index];
+          }
+        }
+      }
+      position += sizes[level];
+      next_size += num_children;
+    }
+    std::swap(current, next);
+    current_size = next_size;
+  }
+
+  // All trees are now at their last level.
+  int64_t position = 0;
+  for (int i = first_tree; i < end_tree; i++) {
+    if (level_offsets_[i + 1] == level_offsets_[i]) {
+      continue;
+    }
+    int64_t tree_leaves = level_sizes_[level_offsets_[i + 1] - 1];
+    leaf_callback(i, absl::MakeConstSpan(current + position, tree_leaves));
+    position += tree_leaves;
+  }
+}
+
+}  // namespace distributed_vector_ole
@@ -0,0 +1,132 @@
+//    Distributed Vector-OLE
+//    Copyright (C) 2019 Phillipp Schoppmann and Adria Gascon
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef DISTRIBUTED_VECTOR_OLE_GGM_FOREST_H_
+#define DISTRIBUTED_VECTOR_OLE_GGM_FOREST_H_
+
+// Expands many small GGM trees that share the same keys at once.
+//
+// GGMTree's streaming functions make one PRG call per key and level of each
+// tree, and allocate buffers for each tree. For trees with a few hundred
+// leaves, as they occur in MPFSSKnownIndices, most of these calls are too small
+// to fill the AES pipeline. GGMForest instead groups consecutive trees into
+// batches of at most kMaxLeavesPerBatch leaves, and expands all trees of a
+// batch level by level. The nodes of all trees on a level are stored next to
+// each other, so that a single PRG call per key covers the whole batch. Trees
+// are aligned at their leaves, i.e., trees with fewer levels join the batch
+// later.
+//
+// All batches are expanded in a single buffer owned by the GGMForest, which is
+// reused across calls. Batches are expanded in parallel using OpenMP, unless
+// called from an active parallel region. A GGMForest must not be used by
+// multiple threads at the same time.
+//
+// The trees are the same as the ones computed by GGMTree::ExpandLeaves and
+// GGMTree::ExpandLeavesFromSiblingWiseXOR for the same arguments and
+// construction.
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "absl/types/span.h"
+#include "distributed_vector_ole/fixed_key_aes.h"
+#include "distributed_vector_ole/ggm_tree.h"
+#include "mpc_utils/status.h"
+
+namespace distributed_vector_ole {
+
+class GGMForest {
+ public:
+  using Block = GGMTree::Block;
+
+  // Maximum number of leaves of all trees in a batch.
+  static const int64_t kMaxLeavesPerBatch = 1 << 12;
+
+  // Maximum number of leaves of a single tree. Larger trees should be expanded
+  // using GGMTree::ExpandLeaves, which streams them in chunks.
+  static const int64_t kMaxLeavesPerTree = kMaxLeavesPerBatch;
+
+  // Called once for each tree with all of its leaves. `tree` is the index of
+  // the tree in the arguments passed to Expand or ExpandFromSiblingWiseXOR.
+  // Called concurrently for different trees.
+  using LeafCallback =
+      std::function<void(int tree, absl::Span<const Block> leaves)>;
+
+  // Creates a GGMForest that expands trees using the given construction.
+  explicit GGMForest(GGMTree::Construction construction =
+                         GGMTree::Construction::kOneKeyPerChild)
+      : construction_(construction) {}
+
+  // Expands the i-th tree from seeds[i], with num_leaves[i] leaves, and passes
+  // its leaves to `leaf_callback`. Trees with zero leaves are skipped. The
+  // arity is given by `keys.size()`, or 2 for the half-tree construction. If
+  // `sibling_wise_xors` is not NULL, it is resized to `num_leaves.size()`, and
+  // (*sibling_wise_xors)[i] is set to the sibling-wise XORs of the i-th tree.
+  // Elements for skipped trees are left unchanged.
+  mpc_utils::Status Expand(
+      absl::Span<const int64_t> num_leaves, absl::Span<const Block> seeds,
+      absl::Span<const Block> keys, const LeafCallback &leaf_callback,
+      std::vector<std::vector<std::vector<Block>>> *sibling_wise_xors =
+          nullptr);
+
+  // Receiver side of Expand. Reconstructs the i-th tree from
+  // sibling_wise_xors[i] like GGMTree::ExpandLeavesFromSiblingWiseXOR, except
+  // for the leaf at missing_indices[i], which is set to zero. Trees with zero
+  // leaves are skipped.
+  mpc_utils::Status ExpandFromSiblingWiseXOR(
+      absl::Span<const int64_t> num_leaves,
+      absl::Span<const int64_t> missing_indices,
+      absl::Span<const std::vector<std::vector<Block>>> sibling_wise_xors,
+      absl::Span<const Block> keys, const LeafCallback &leaf_callback);
+
+ private:
+  // Implements Expand and ExpandFromSiblingWiseXOR. Exactly one of `seeds`
+  // and `missing_indices` is non-empty.
+  mpc_utils::Status ExpandImpl(
+      absl::Span<const int64_t> num_leaves, absl::Span<const Block> seeds,
+      absl::Span<const int64_t> missing_indices,
+      absl::Span<const std::vector<std::vector<Block>>> received_xors,
+      absl::Span<const Block> keys, const LeafCallback &leaf_callback,
+      std::vector<std::vector<std::vector<Block>>> *sibling_wise_xors);
+
+  // Expands the trees in [first_tree, end_tree), which have at most
+  // `num_levels` levels, using `buffer` as scratch space, and passes their
+  // leaves to `leaf_callback`. The remaining arguments are as in ExpandImpl.
+  void ExpandBatch(
+      int first_tree, int end_tree, int num_levels,
+      const GGMTree::NodeExpander &expander, absl::Span<const Block> seeds,
+      absl::Span<const int64_t> missing_indices,
+      absl::Span<const std::vector<std::vector<Block>>> received_xors,
+      const LeafCallback &leaf_callback,
+      std::vector<std::vector<std::vector<Block>>> *sibling_wise_xors,
+      Block *buffer) const;
+
+  const GGMTree::Construction construction_;
+
+  // Holds the nodes of two consecutive levels of each batch that is currently
+  // expanded, and the PRG outputs in between.
+  std::vector<Block> buffer_;
+
+  // Number of nodes on each level of each tree, starting at the root. The
+  // levels of tree i start at level_sizes_[level_offsets_[i]].
+  std::vector<int64_t> level_sizes_;
+  std::vector<int64_t> level_offsets_;
+};
+
+}  // namespace distributed_vector_ole
+
+#endif  // DISTRIBUTED_VECTOR_OLE_GGM_FOREST_H_
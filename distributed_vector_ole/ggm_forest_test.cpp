@@ -0,0 +1,175 @@
+//    Distributed Vector-OLE
+//    Copyright (C) 2019 Phillipp Schoppmann and Adria Gascon
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "distributed_vector_ole/ggm_forest.h"
+
+#include <omp.h>
+
+#include <tuple>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "mpc_utils/status_matchers.h"
+
+namespace distributed_vector_ole {
+namespace {
+
+using Block = GGMForest::Block;
+
+// Parameterized by arity and construction.
+class GGMForestTest
+    : public ::testing::TestWithParam<std::tuple<int, GGMTree::Construction>> {
+ protected:
+  GGMForestTest() : forest_(std::get<1>(GetParam())) {}
+
+  void SetUp() override {
+    arity_ = std::get<0>(GetParam());
+    construction_ = std::get<1>(GetParam());
+    keys_.resize(GGMTree::NumKeys(construction_, arity_));
+    for (int i = 0; i < static_cast<int>(keys_.size()); i++) {
+      keys_[i] = Block(1000 + i);
+    }
+  }
+
+  // Expands all trees with `forest_` and checks the leaves and sibling-wise
+  // XORs against GGMTree. Then checks that the receiver recovers all leaves
+  // except the one at `missing_indices[i]`.
+  void CheckForest(const std::vector<int64_t> &num_leaves,
+                   const std::vector<int64_t> &missing_indices) {
+    int num_trees = num_leaves.size();
+    std::vector<Block> seeds(num_trees);
+    for (int i = 0; i < num_trees; i++) {
+      seeds[i] = Block(42 + i);
+    }
+    std::vector<std::vector<Block>> leaves(num_trees);
+    std::vector<std::vector<std::vector<Block>>> xors;
+    ASSERT_TRUE(forest_
+                    .Expand(num_leaves, seeds, keys_,
+                            [&leaves](int tree, absl::Span<const Block> chunk) {
+                              leaves[tree].assign(chunk.begin(), chunk.end());
+                            },
+                            &xors)
+                    .ok());
+    ASSERT_EQ(xors.size(), num_trees);
+
+    std::vector<std::vector<Block>> received_leaves(num_trees);
+    ASSERT_TRUE(
+        forest_
+            .ExpandFromSiblingWiseXOR(
+                num_leaves, missing_indices, xors, keys_,
+                [&received_leaves](int tree, absl::Span<const Block> chunk) {
+                  received_leaves[tree].assign(chunk.begin(), chunk.end());
+                })
+            .ok());
+
+    for (int i = 0; i < num_trees; i++) {
+      if (num_leaves[i] == 0) {
+        EXPECT_TRUE(leaves[i].empty());
+        EXPECT_TRUE(received_leaves[i].empty());
+        continue;
+      }
+      std::vector<Block> expected_leaves(num_leaves[i]);
+      std::vector<std::vector<Block>> expected_xors;
+      ASSERT_TRUE(GGMTree::ExpandLeaves(seeds[i], keys_,
+                                        absl::MakeSpan(expected_leaves),
+                                        &expected_xors, construction_)
+                      .ok());
+      EXPECT_EQ(leaves[i], expected_leaves);
+      EXPECT_EQ(xors[i], expected_xors);
+      ASSERT_EQ(received_leaves[i].size(), num_leaves[i]);
+      for (int64_t j = 0; j < num_leaves[i]; j++) {
+        if (j == missing_indices[i]) {
+          EXPECT_EQ(received_leaves[i][j], 0);
+        } else {
+          EXPECT_EQ(received_leaves[i][j], expected_leaves[j]);
+        }
+      }
+    }
+  }
+
+  int arity_;
+  GGMTree::Construction construction_;
+  std::vector<Block> keys_;
+  GGMForest forest_;
+};
+
+TEST_P(GGMForestTest, SingleTree) {
+  int64_t max_leaves = GGMForest::kMaxLeavesPerTree;
+  for (int64_t num_leaves : {int64_t{1}, int64_t{2}, int64_t{3}, int64_t{17},
+                             int64_t{100}, max_leaves}) {
+    for (int64_t missing_index : {int64_t{0}, num_leaves / 2, num_leaves - 1}) {
+      CheckForest({num_leaves}, {missing_index});
+    }
+  }
+}
+
+TEST_P(GGMForestTest, DifferentSizes) {
+  // Trees of different depths in the same batch, including empty ones.
+  std::vector<int64_t> num_leaves = {1, 0, 2, 100, 5, 0, 37, 16, 300, 1};
+  std::vector<int64_t> missing_indices = {0, 0, 1, 99, 2, 0, 0, 15, 123, 0};
+  CheckForest(num_leaves, missing_indices);
+}
+
+TEST_P(GGMForestTest, ManyBatches) {
+  // Enough trees for multiple batches, processed by multiple threads.
+  omp_set_num_threads(4);
+  std::vector<int64_t> num_leaves, missing_indices;
+  for (int i = 0; i < 200; i++) {
+    num_leaves.push_back(100 + 7 * i);
+    missing_indices.push_back((31 * i) % num_leaves.back());
+  }
+  CheckForest(num_leaves, missing_indices);
+  // Same again, reusing the buffer.
+  CheckForest(num_leaves, missing_indices);
+}
+
+TEST_P(GGMForestTest, TreeTooLarge) {
+  std::vector<int64_t> num_leaves = {GGMForest::kMaxLeavesPerTree + 1};
+  std::vector<Block> seeds = {0};
+  auto status = forest_.Expand(num_leaves, seeds, keys_,
+                               [](int, absl::Span<const Block>) {});
+  ASSERT_FALSE(status.ok());
+  EXPECT_EQ(status.message(),
+            "`num_leaves` must be between 0 and kMaxLeavesPerTree");
+}
+
+TEST_P(GGMForestTest, WrongNumberOfSiblingWiseXORs) {
+  std::vector<int64_t> num_leaves = {100};
+  std::vector<int64_t> missing_indices = {0};
+  std::vector<std::vector<std::vector<Block>>> xors(1);
+  auto status = forest_.ExpandFromSiblingWiseXOR(
+      num_leaves, missing_indices, xors, keys_,
+      [](int, absl::Span<const Block>) {});
+  ASSERT_FALSE(status.ok());
+  EXPECT_EQ(status.message(),
+            "Dimensions passed in `sibling_wise_xors` do not match "
+            "`num_leaves`");
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Arities, GGMForestTest,
+    ::testing::Values(
+        std::make_tuple(2, GGMTree::Construction::kOneKeyPerChild),
+        std::make_tuple(3, GGMTree::Construction::kOneKeyPerChild),
+        std::make_tuple(4, GGMTree::Construction::kOneKeyPerChild),
+        std::make_tuple(8, GGMTree::Construction::kOneKeyPerChild)));
+
+INSTANTIATE_TEST_SUITE_P(
+    HalfTree, GGMForestTest,
+    ::testing::Values(std::make_tuple(2, GGMTree::Construction::kHalfTree)));
+
+}  // namespace
+}  // namespace distributed_vector_ole
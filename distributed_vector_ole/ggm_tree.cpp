@@ -22,6 +22,7 @@
 #include <cassert>
 #include <cmath>
 #include <functional>
+#include <utility>
 
 #include "absl/memory/memory.h"
 #include "absl/types/span.h"
@@ -29,104 +30,83 @@
 #include "mpc_utils/status.h"
 #include "mpc_utils/status_macros.h"
 #include "mpc_utils/statusor.h"
-#include "openssl/err.h"
 #include "openssl/rand.h"
 
 namespace distributed_vector_ole {
 
 namespace {
 
-// Allocates a tree of the given arity with the given number of leaves.
-mpc_utils::StatusOr<std::vector<std::vector<GGMTree::Block>>> AllocateLevels(
+// Computes the number of nodes on each level of a tree of the given arity with
+// the given number of leaves.
+mpc_utils::StatusOr<std::vector<int64_t>> ComputeLevelSizes(
     int arity, int64_t num_leaves) {
   int num_levels =
       static_cast<int>(1 + std::ceil(std::log(num_leaves) / std::log(arity)));
-  int64_t num_blocks_for_level;
-  std::vector<std::vector<GGMTree::Block>> levels(num_levels);
+  std::vector<int64_t> level_sizes(num_levels);
   for (int i = num_levels - 1; i >= 0; i--) {
     if (i == num_levels - 1) {
-      num_blocks_for_level = num_leaves;
+      level_sizes[i] = num_leaves;
     } else {
-      num_blocks_for_level = (num_blocks_for_level + arity - 1) / arity;
+      level_sizes[i] = (level_sizes[i + 1] + arity - 1) / arity;
     }
-    // Initialize all levels to zero.
-    levels[i].resize(num_blocks_for_level, 0);
   }
-  if (levels[0].size() != 1) {
+  if (level_sizes[0] != 1) {
     return mpc_utils::InternalError("First level should always have one block");
   }
   // Not sure copy elision works with implicit StatusOr constructor. Let's be
   // safe, the cost of the move is minimal.
-  return std::move(levels);
+  return std::move(level_sizes);
 }
 
-// XORs `in` in batches of `out.size()` blocks onto `out`.
-void XORBlocks(absl::Span<const GGMTree::Block> in,
-               absl::Span<GGMTree::Block> out) {
-  GGMTree::Block* out_data = out.data();
-  const GGMTree::Block* in_data = in.data();
-  int64_t batch_size = out.size();
-
-  // Use threads for the outer loop over batches.
-  int64_t num_batches = (in.size() + batch_size - 1) / batch_size;
-  for (int64_t batch = 0; batch < num_batches; batch++) {
-    int64_t num_blocks = std::min(
-        batch_size, static_cast<int64_t>(in.size()) - batch * batch_size);
-
-    // The blocks in each batch can be XORed 1:1 onto the result.
-    for (int block = 0; block < num_blocks; block++) {
-      int child = batch * batch_size + block;
-      out_data[block] ^= in_data[child];
-    }
+// Allocates a tree of the given arity with the given number of leaves.
+mpc_utils::StatusOr<std::vector<std::vector<GGMTree::Block>>> AllocateLevels(
+    int arity, int64_t num_leaves) {
+  ASSIGN_OR_RETURN(auto level_sizes, ComputeLevelSizes(arity, num_leaves));
+  std::vector<std::vector<GGMTree::Block>> levels(level_sizes.size());
+  for (int i = 0; i < static_cast<int>(levels.size()); i++) {
+    // Initialize all levels to zero.
+    levels[i].resize(level_sizes[i], 0);
   }
+  return std::move(levels);
 }
 
-// Evaluates the PRG using the given seed and key.
-GGMTree::Block ComputePRG(const GGMTree::Block& seed, const AES_KEY& key) {
-  GGMTree::Block result;
-  AES_encrypt(reinterpret_cast<const uint8_t*>(&seed),
-              reinterpret_cast<uint8_t*>(&result), &key);
-  result ^= seed;
-  return result;
-}
-
-}  // namespace
-
-mpc_utils::StatusOr<std::unique_ptr<GGMTree>> GGMTree::Create(
-    int64_t num_leaves, Block seed, std::vector<Block> keys) {
-  int arity = static_cast<int>(keys.size());
-  if (arity < 2) {
-    return mpc_utils::InvalidArgumentError("arity must be at least 2");
-  }
-  if (num_leaves <= 0) {
-    return mpc_utils::InvalidArgumentError("num_leaves must be positive");
+// Creates a PRG instance for each of the given keys.
+mpc_utils::StatusOr<std::vector<FixedKeyAES>> ExpandKeys(
+    absl::Span<const GGMTree::Block> keys) {
+  std::vector<FixedKeyAES> prgs;
+  prgs.reserve(keys.size());
+  for (const GGMTree::Block& key : keys) {
+    ASSIGN_OR_RETURN(auto prg, FixedKeyAES::Create(key));
+    prgs.push_back(std::move(prg));
   }
+  return std::move(prgs);
+}
 
-  ASSIGN_OR_RETURN(auto levels, AllocateLevels(arity, num_leaves));
-  levels[0][0] = seed;
-
-  // Expand keys.
-  std::vector<AES_KEY> expanded_keys(arity);
-  for (int i = 0; i < arity; i++) {
-    if (0 != AES_set_encrypt_key(reinterpret_cast<uint8_t*>(&keys[i]),
-                                 8 * kBlockSize, &expanded_keys[i])) {
-      return mpc_utils::InternalError(ERR_reason_error_string(ERR_get_error()));
-    }
+// Returns the OpenSSL key schedules of `prgs`.
+std::vector<AES_KEY> GetExpandedKeys(absl::Span<const FixedKeyAES> prgs) {
+  std::vector<AES_KEY> expanded_keys;
+  expanded_keys.reserve(prgs.size());
+  for (const FixedKeyAES& prg : prgs) {
+    expanded_keys.push_back(prg.expanded_key());
   }
-
-  std::unique_ptr<GGMTree> tree = absl::WrapUnique(new GGMTree(
-      std::move(levels), std::move(keys), std::move(expanded_keys)));
-  tree->ExpandSubtree(0, 0);
-  return tree;
+  return expanded_keys;
 }
 
-mpc_utils::StatusOr<std::unique_ptr<GGMTree>> GGMTree::CreateFromSiblingWiseXOR(
+// Checks the arguments passed to CreateFromSiblingWiseXOR and
+// ExpandLeavesFromSiblingWiseXOR.
+mpc_utils::Status CheckSiblingWiseXORArguments(
     int arity, int64_t num_leaves, int64_t missing_index,
-    absl::Span<const std::vector<Block>> sibling_wise_xors,
-    absl::Span<const Block> keys) {
+    absl::Span<const std::vector<GGMTree::Block>> sibling_wise_xors,
+    absl::Span<const GGMTree::Block> keys,
+    GGMTree::Construction construction =
+        GGMTree::Construction::kOneKeyPerChild) {
   if (arity < 2) {
     return mpc_utils::InvalidArgumentError("arity must be at least 2");
   }
+  if (construction == GGMTree::Construction::kHalfTree && arity != 2) {
+    return mpc_utils::InvalidArgumentError(
+        "The half-tree construction requires arity 2");
+  }
   if (num_leaves <= 0) {
     return mpc_utils::InvalidArgumentError("`num_leaves` must be positive");
   }
@@ -148,35 +128,483 @@ mpc_utils::StatusOr<std::unique_ptr<GGMTree>> GGMTree::CreateFromSiblingWiseXOR(
   if (keys.empty()) {
     return mpc_utils::InvalidArgumentError("`keys` must not be empty");
   }
+  if (static_cast<int>(keys.size()) != GGMTree::NumKeys(construction, arity)) {
+    if (construction == GGMTree::Construction::kHalfTree) {
+      return mpc_utils::InvalidArgumentError(
+          "`keys` must have length 1 for the half-tree construction");
+    }
+    return mpc_utils::InvalidArgumentError("`keys` must have length `arity`");
+  }
+  return mpc_utils::OkStatus();
+}
 
-  // Construct path to `missing_index`.
+// Returns the path from the root to `missing_index` on a tree with
+// `num_levels` levels.
+std::vector<int64_t> ComputeMissingPath(int arity, int num_levels,
+                                        int64_t missing_index) {
   std::vector<int64_t> missing_path(num_levels);
   missing_path[num_levels - 1] = missing_index;
   for (int i = num_levels - 2; i >= 0; i--) {
     missing_path[i] = missing_path[i + 1] / arity;
   }
+  return missing_path;
+}
 
-  // Expand keys and allocate tree.
-  std::vector<Block> keys_copy(keys.begin(), keys.end());
-  std::vector<AES_KEY> expanded_keys(arity);
-  for (int i = 0; i < arity; i++) {
-    if (0 != AES_set_encrypt_key(reinterpret_cast<uint8_t*>(&keys_copy[i]),
-                                 8 * kBlockSize, &expanded_keys[i])) {
-      return mpc_utils::InternalError(ERR_reason_error_string(ERR_get_error()));
+// Maximum number of leaves of a subtree that LeafStreamer expands breadth-first
+// in a local buffer. Large enough to keep the PRG pipeline busy, small enough
+// to stay in cache.
+const int64_t kStreamingChunkSize = 1 << 12;
+
+// Number of nodes of a level that GGMTree::ExpandLevel expands before XORing
+// their children onto the sibling-wise XORs.
+const int64_t kExpansionBatchSize = 1 << 10;
+
+// Minimum number of leaves each thread should expand when splitting a single
+// tree across threads. Below this, the cost of starting threads outweighs the
+// benefit.
+const int64_t kMinLeavesPerThread = 1 << 14;
+
+// Number of subtrees per thread a tree is split into when expanding in
+// parallel. Using more than one subtree per thread balances the load on trees
+// whose last level is not full.
+const int kSubtreesPerThread = 4;
+
+// Returns the number of threads to use for expanding a subtree with
+// `num_leaves` leaves. Returns 1 if called from an active parallel region, for
+// example when AllButOneRandomOT already parallelizes over trees.
+int NumExpansionThreads(int64_t num_leaves) {
+  if (omp_in_parallel()) {
+    return 1;
+  }
+  return static_cast<int>(std::max<int64_t>(
+      1, std::min<int64_t>(omp_get_max_threads(),
+                           num_leaves / kMinLeavesPerThread)));
+}
+
+// Returns the index of the first leaf and one past the last leaf of the
+// subtree rooted at the `node`-th node of `level`.
+std::pair<int64_t, int64_t> SubtreeLeafRange(
+    absl::Span<const int64_t> level_sizes, int arity, int level,
+    int64_t node) {
+  int64_t start_node = node, end_node = node + 1;
+  for (; level < static_cast<int>(level_sizes.size()) - 1; level++) {
+    start_node *= arity;
+    end_node = std::min(end_node * arity, level_sizes[level + 1]);
+  }
+  return {start_node, end_node};
+}
+
+// Returns the number of leaves of the subtree rooted at the `node`-th node of
+// `level`.
+int64_t NumLeavesInSubtree(absl::Span<const int64_t> level_sizes, int arity,
+                           int level, int64_t node) {
+  auto range = SubtreeLeafRange(level_sizes, arity, level, node);
+  return range.second - range.first;
+}
+
+// Writes the leaves first_leaf, ..., first_leaf + leaves.size() - 1 to
+// `leaves`, all of which must be in the subtree rooted at the `node`-th node of
+// `level`, which has the given `value`. Only the ancestors of these leaves are
+// expanded, plus at most arity - 1 nodes on each side per level.
+void EvaluateSubtreeRange(absl::Span<const int64_t> level_sizes,
+                          const GGMTree::NodeExpander& expander, int level,
+                          int64_t node, GGMTree::Block value,
+                          int64_t first_leaf,
+                          absl::Span<GGMTree::Block> leaves) {
+  if (leaves.empty()) {
+    return;
+  }
+  int arity = expander.arity();
+  int num_levels = static_cast<int>(level_sizes.size());
+  // The ancestors of the leaves on level l are start_nodes[l], ...,
+  // end_nodes[l] - 1.
+  std::vector<int64_t> start_nodes(num_levels), end_nodes(num_levels);
+  start_nodes[num_levels - 1] = first_leaf;
+  end_nodes[num_levels - 1] = first_leaf + leaves.size();
+  for (int l = num_levels - 2; l >= level; l--) {
+    start_nodes[l] = start_nodes[l + 1] / arity;
+    end_nodes[l] = (end_nodes[l + 1] - 1) / arity + 1;
+  }
+  assert(start_nodes[level] == node && end_nodes[level] == node + 1);
+
+  std::vector<GGMTree::Block> current = {value}, children;
+  for (int l = level; l < num_levels - 1; l++) {
+    int64_t first_child = start_nodes[l] * arity;
+    int64_t end_child = std::min(end_nodes[l] * arity, level_sizes[l + 1]);
+    children.resize(end_child - first_child);
+    expander.Expand(current, children.size(), children.data());
+    current.assign(children.begin() + (start_nodes[l + 1] - first_child),
+                   children.begin() + (end_nodes[l + 1] - first_child));
+  }
+  std::copy(current.begin(), current.end(), leaves.begin());
+}
+
+// Expands subtrees of a GGM tree without materializing the tree. Subtrees with
+// at most kStreamingChunkSize leaves are expanded breadth-first in a local
+// buffer, larger ones depth-first. Therefore only the path from the root to the
+// current chunk and the chunk itself are kept in memory.
+class LeafStreamer {
+ public:
+  // `leaves` and `leaf_callback` may be NULL. If `leaves` is set, leaves are
+  // written to it directly. If `leaf_callback` is set, it is called on every
+  // chunk of leaves. If `level_xors` is set, each node on level l + 1 is XORed
+  // onto (*level_xors)[l][j], where j is the node's sibling index.
+  LeafStreamer(absl::Span<const int64_t> level_sizes,
+               const GGMTree::NodeExpander& expander, GGMTree::Block* leaves,
+               const GGMTree::LeafCallback* leaf_callback,
+               std::vector<std::vector<GGMTree::Block>>* level_xors)
+      : arity_(expander.arity()),
+        num_levels_(level_sizes.size()),
+        level_sizes_(level_sizes),
+        expander_(expander),
+        leaves_(leaves),
+        leaf_callback_(leaf_callback),
+        level_xors_(level_xors),
+        chunk_levels_(0) {
+    int64_t chunk_size = 1;
+    while (chunk_size * arity_ <= kStreamingChunkSize) {
+      chunk_size *= arity_;
+      chunk_levels_++;
+    }
+    if (chunk_levels_ == 0) {
+      chunk_size = arity_;
+      chunk_levels_ = 1;
+    }
+    buffers_[0].resize(chunk_size);
+    buffers_[1].resize(chunk_size);
+  }
+
+  // Expands the subtree rooted at the `node`-th node of `level`, which has the
+  // given `value`.
+  void ExpandSubtree(int level, int64_t node, GGMTree::Block value) {
+    if (num_levels_ - 1 - level <= chunk_levels_) {
+      ExpandChunk(level, node, value);
+      return;
+    }
+    // Compute the children of `value` and descend.
+    int64_t first_child = node * arity_;
+    int num_children = static_cast<int>(std::min(
+        static_cast<int64_t>(arity_), level_sizes_[level + 1] - first_child));
+    std::vector<GGMTree::Block> children(num_children);
+    expander_.Expand(absl::MakeConstSpan(&value, 1), num_children,
+                     children.data());
+    for (int sibling_index = 0; sibling_index < num_children;
+         sibling_index++) {
+      if (level_xors_) {
+        (*level_xors_)[level][sibling_index] ^= children[sibling_index];
+      }
+      ExpandSubtree(level + 1, first_child + sibling_index,
+                    children[sibling_index]);
+    }
+  }
+
+ private:
+  // Expands the subtree rooted at the given node breadth-first.
+  void ExpandChunk(int level, int64_t node, GGMTree::Block value) {
+    GGMTree::Block* current = buffers_[0].data();
+    GGMTree::Block* next = buffers_[1].data();
+    current[0] = value;
+    int64_t start_node = node, end_node = node + 1;
+    for (; level < num_levels_ - 1; level++) {
+      int64_t next_level_size = level_sizes_[level + 1];
+      int64_t next_start_node = start_node * arity_;
+      int64_t next_end_node = std::min(end_node * arity_, next_level_size);
+      // Write the last level directly to `leaves_` if possible.
+      GGMTree::Block* output = next;
+      if (level == num_levels_ - 2 && leaves_) {
+        output = leaves_ + next_start_node;
+      }
+      expander_.Expand(absl::MakeConstSpan(current, end_node - start_node),
+                       next_end_node - next_start_node, output);
+      if (level_xors_) {
+        // `next_start_node` is a multiple of `arity_`, so the sibling index
+        // of output[i] is i % arity_.
+        GGMTree::Block* xors = (*level_xors_)[level].data();
+        int64_t num_nodes = next_end_node - next_start_node;
+        for (int64_t i = 0; i < num_nodes; i += arity_) {
+          int num_siblings =
+              static_cast<int>(std::min<int64_t>(arity_, num_nodes - i));
+          for (int sibling_index = 0; sibling_index < num_siblings;
+               sibling_index++) {
+            xors[sibling_index] ^= output[i + sibling_index];
+          }
+        }
+      }
+      current = output;
+      next = (output == buffers_[0].data()) ? buffers_[1].data()
+                                            : buffers_[0].data();
+      start_node = next_start_node;
+      end_node = next_end_node;
+    }
+    EmitLeaves(start_node, absl::MakeConstSpan(current, end_node - start_node));
+  }
+
+  // Passes `leaves`, the first of which has index `first_leaf`, to the output.
+  void EmitLeaves(int64_t first_leaf, absl::Span<const GGMTree::Block> leaves) {
+    if (leaves_ && leaves.data() != leaves_ + first_leaf) {
+      std::copy(leaves.begin(), leaves.end(), leaves_ + first_leaf);
+    }
+    if (leaf_callback_) {
+      (*leaf_callback_)(first_leaf, leaves);
+    }
+  }
+
+  const int arity_;
+  const int num_levels_;
+  absl::Span<const int64_t> level_sizes_;
+  const GGMTree::NodeExpander& expander_;
+  GGMTree::Block* leaves_;
+  const GGMTree::LeafCallback* leaf_callback_;
+  std::vector<std::vector<GGMTree::Block>>* level_xors_;
+  // Subtrees with at most this many levels below the root are expanded by
+  // ExpandChunk.
+  int chunk_levels_;
+  // Buffers holding two consecutive levels of the current chunk.
+  std::vector<GGMTree::Block> buffers_[2];
+};
+
+// Expands the subtree rooted at the `node`-th node of `level` with the given
+// `value` like LeafStreamer::ExpandSubtree, but splits the work across threads
+// if the subtree is large enough. The top levels of the subtree are expanded
+// serially until there are kSubtreesPerThread subtrees per thread, which are
+// then distributed dynamically. Each thread uses its own LeafStreamer and
+// accumulates its own copy of `level_xors`, which are combined at the end.
+void ExpandSubtreeInParallel(
+    absl::Span<const int64_t> level_sizes,
+    const GGMTree::NodeExpander& expander, GGMTree::Block* leaves,
+    const GGMTree::LeafCallback* leaf_callback,
+    std::vector<std::vector<GGMTree::Block>>* level_xors, int level,
+    int64_t node, GGMTree::Block value) {
+  int arity = expander.arity();
+  int num_levels = static_cast<int>(level_sizes.size());
+  int num_threads = NumExpansionThreads(
+      NumLeavesInSubtree(level_sizes, arity, level, node));
+  if (num_threads == 1) {
+    LeafStreamer streamer(level_sizes, expander, leaves, leaf_callback,
+                          level_xors);
+    streamer.ExpandSubtree(level, node, value);
+    return;
+  }
+
+  // Expand the top levels breadth-first. `frontier[i]` holds the value of the
+  // node with index `first_node + i` on the current level.
+  std::vector<GGMTree::Block> frontier = {value};
+  int64_t first_node = node;
+  while (level < num_levels - 1 &&
+         static_cast<int64_t>(frontier.size()) <
+             kSubtreesPerThread * num_threads) {
+    int64_t next_first_node = first_node * arity;
+    int64_t next_end_node =
+        std::min((first_node + static_cast<int64_t>(frontier.size())) * arity,
+                 level_sizes[level + 1]);
+    std::vector<GGMTree::Block> next(next_end_node - next_first_node);
+    expander.Expand(frontier, next.size(), next.data());
+    for (int64_t i = 0; i < static_cast<int64_t>(next.size()); i++) {
+      if (level_xors) {
+        (*level_xors)[level][i % arity] ^= next[i];
+      }
+    }
+    frontier = std::move(next);
+    first_node = next_first_node;
+    level++;
+  }
+
+  // Expand the subtrees rooted at the frontier in parallel.
+  int num_subtrees = static_cast<int>(frontier.size());
+#pragma omp parallel num_threads(num_threads)
+  {
+    std::vector<std::vector<GGMTree::Block>> thread_xors;
+    if (level_xors) {
+      thread_xors.assign(level_xors->size(),
+                         std::vector<GGMTree::Block>(arity, 0));
+    }
+    LeafStreamer streamer(level_sizes, expander, leaves, leaf_callback,
+                          level_xors ? &thread_xors : nullptr);
+#pragma omp for schedule(dynamic)
+    for (int i = 0; i < num_subtrees; i++) {
+      streamer.ExpandSubtree(level, first_node + i, frontier[i]);
+    }
+    if (level_xors) {
+#pragma omp critical
+      for (int l = level; l < num_levels - 1; l++) {
+        for (int j = 0; j < arity; j++) {
+          (*level_xors)[l][j] ^= thread_xors[l][j];
+        }
+      }
     }
   }
+}
+
+// Implements GGMTree::ExpandLeaves. Exactly one of `leaves` and
+// `leaf_callback` is not NULL.
+mpc_utils::Status ExpandLeavesImpl(
+    int64_t num_leaves, GGMTree::Block seed,
+    absl::Span<const GGMTree::Block> keys, GGMTree::Block* leaves,
+    const GGMTree::LeafCallback* leaf_callback,
+    std::vector<std::vector<GGMTree::Block>>* sibling_wise_xors,
+    GGMTree::Construction construction) {
+  ASSIGN_OR_RETURN(auto expander,
+                   GGMTree::NodeExpander::Create(keys, construction));
+  int arity = expander.arity();
+  if (num_leaves <= 0) {
+    return mpc_utils::InvalidArgumentError("num_leaves must be positive");
+  }
+  ASSIGN_OR_RETURN(auto level_sizes, ComputeLevelSizes(arity, num_leaves));
+  if (sibling_wise_xors) {
+    sibling_wise_xors->assign(level_sizes.size() - 1,
+                              std::vector<GGMTree::Block>(arity, 0));
+  }
+  ExpandSubtreeInParallel(level_sizes, expander, leaves, leaf_callback,
+                          sibling_wise_xors, 0, 0, seed);
+  return mpc_utils::OkStatus();
+}
+
+// Implements GGMTree::ExpandLeavesFromSiblingWiseXOR. Exactly one of `leaves`
+// and `leaf_callback` is not NULL.
+mpc_utils::Status ExpandLeavesFromSiblingWiseXORImpl(
+    int arity, int64_t num_leaves, int64_t missing_index,
+    absl::Span<const std::vector<GGMTree::Block>> sibling_wise_xors,
+    absl::Span<const GGMTree::Block> keys, GGMTree::Block* leaves,
+    const GGMTree::LeafCallback* leaf_callback,
+    GGMTree::Construction construction) {
+  RETURN_IF_ERROR(CheckSiblingWiseXORArguments(arity, num_leaves,
+                                               missing_index, sibling_wise_xors,
+                                               keys, construction));
+  ASSIGN_OR_RETURN(auto level_sizes, ComputeLevelSizes(arity, num_leaves));
+  int num_levels = static_cast<int>(level_sizes.size());
+  if (num_levels != static_cast<int>(sibling_wise_xors.size()) + 1) {
+    return mpc_utils::InvalidArgumentError(
+        "Dimensions passed in `sibling_wise_xors` do not match `num_leaves`");
+  }
+  ASSIGN_OR_RETURN(auto expander,
+                   GGMTree::NodeExpander::Create(keys, construction));
+  std::vector<int64_t> missing_path =
+      ComputeMissingPath(arity, num_levels, missing_index);
+
+  // Same as in CreateFromSiblingWiseXOR, except that the XORs of each level
+  // are accumulated while expanding the subtrees above it.
+  std::vector<std::vector<GGMTree::Block>> level_xors(
+      num_levels - 1, std::vector<GGMTree::Block>(arity, 0));
+  for (int level_index = 1; level_index < num_levels; level_index++) {
+    int64_t node_base = missing_path[level_index - 1] * arity;
+    int num_siblings = std::min(static_cast<int64_t>(arity),
+                                level_sizes[level_index] - node_base);
+    for (int sibling_index = 0; sibling_index < num_siblings; sibling_index++) {
+      if (node_base + sibling_index == missing_path[level_index]) {
+        continue;
+      }
+      ExpandSubtreeInParallel(
+          level_sizes, expander, leaves, leaf_callback, &level_xors,
+          level_index,
+          node_base + sibling_index,
+          level_xors[level_index - 1][sibling_index] ^
+              sibling_wise_xors[level_index - 1][sibling_index]);
+    }
+  }
+
+  // The missing leaf is set to zero.
+  GGMTree::Block zero = 0;
+  if (leaves) {
+    leaves[missing_index] = zero;
+  }
+  if (leaf_callback) {
+    (*leaf_callback)(missing_index, absl::MakeConstSpan(&zero, 1));
+  }
+  return mpc_utils::OkStatus();
+}
+
+}  // namespace
+
+mpc_utils::StatusOr<GGMTree::NodeExpander> GGMTree::NodeExpander::Create(
+    absl::Span<const Block> keys, Construction construction) {
+  int arity = static_cast<int>(keys.size());
+  if (construction == Construction::kHalfTree) {
+    if (keys.size() != 1) {
+      return mpc_utils::InvalidArgumentError(
+          "`keys` must have length 1 for the half-tree construction");
+    }
+    arity = 2;
+  } else if (arity < 2) {
+    return mpc_utils::InvalidArgumentError("arity must be at least 2");
+  }
+  ASSIGN_OR_RETURN(auto prgs, ExpandKeys(keys));
+  return NodeExpander(construction, arity, std::move(prgs));
+}
+
+void GGMTree::NodeExpander::Expand(absl::Span<const Block> parents,
+                                   int64_t num_children,
+                                   Block* children) const {
+  if (construction_ == Construction::kHalfTree) {
+    // One hash per parent for the left children. The right children are
+    // derived from the parents and the left children.
+    prgs_[0].CCRHash(parents.subspan(0, (num_children + 1) / 2), children, 2);
+    for (int64_t i = 0; i < num_children / 2; i++) {
+      children[2 * i + 1] = parents[i] ^ children[2 * i];
+    }
+    return;
+  }
+  for (int sibling_index = 0; sibling_index < arity_; sibling_index++) {
+    // Only parents with index below `num_parents` have a child at
+    // `sibling_index`.
+    int64_t num_parents = (num_children - sibling_index + arity_ - 1) / arity_;
+    if (num_parents <= 0) {
+      continue;
+    }
+    prgs_[sibling_index].Hash(parents.subspan(0, num_parents),
+                              children + sibling_index, arity_);
+  }
+}
+
+mpc_utils::StatusOr<std::unique_ptr<GGMTree>> GGMTree::Create(
+    int64_t num_leaves, Block seed, std::vector<Block> keys) {
+  int arity = static_cast<int>(keys.size());
+  if (arity < 2) {
+    return mpc_utils::InvalidArgumentError("arity must be at least 2");
+  }
+  if (num_leaves <= 0) {
+    return mpc_utils::InvalidArgumentError("num_leaves must be positive");
+  }
+
+  ASSIGN_OR_RETURN(auto levels, AllocateLevels(arity, num_leaves));
+  levels[0][0] = seed;
+
+  // Expand keys.
+  ASSIGN_OR_RETURN(auto prgs, ExpandKeys(keys));
+
+  std::unique_ptr<GGMTree> tree = absl::WrapUnique(
+      new GGMTree(std::move(levels), std::move(keys), std::move(prgs)));
+  tree->ExpandSubtree(0, 0);
+  return tree;
+}
+
+mpc_utils::StatusOr<std::unique_ptr<GGMTree>> GGMTree::CreateFromSiblingWiseXOR(
+    int arity, int64_t num_leaves, int64_t missing_index,
+    absl::Span<const std::vector<Block>> sibling_wise_xors,
+    absl::Span<const Block> keys) {
+  RETURN_IF_ERROR(CheckSiblingWiseXORArguments(
+      arity, num_leaves, missing_index, sibling_wise_xors, keys));
+  int num_levels = sibling_wise_xors.size() + 1;
+
+  // Construct path to `missing_index`.
+  std::vector<int64_t> missing_path =
+      ComputeMissingPath(arity, num_levels, missing_index);
+
+  // Expand keys and allocate tree.
+  std::vector<Block> keys_copy(keys.begin(), keys.end());
+  ASSIGN_OR_RETURN(auto prgs, ExpandKeys(keys_copy));
   ASSIGN_OR_RETURN(auto levels, AllocateLevels(arity, num_leaves));
-  std::unique_ptr<GGMTree> tree = absl::WrapUnique(new GGMTree(
-      std::move(levels), std::move(keys_copy), std::move(expanded_keys)));
+  std::unique_ptr<GGMTree> tree = absl::WrapUnique(
+      new GGMTree(std::move(levels), std::move(keys_copy), std::move(prgs)));
   assert(tree->num_levels() == num_levels);
 
   // Expand tree from the root. At each level, use sibling_wise_xors together
   // with already computed subtrees to compute all missing seeds but one, and
   // expand the subtrees under those.
+  // The sibling-wise XORs of each level are accumulated in
+  // `tree->sibling_wise_xors_` while expanding the subtrees above it.
   for (int level_index = 1; level_index < num_levels; level_index++) {
-    // Compute XOR of all nodes at the current level
-    std::vector<Block> current_level_xors(arity, 0);
-    XORBlocks(tree->levels_[level_index], absl::MakeSpan(current_level_xors));
+    std::vector<Block>& current_level_xors =
+        tree->sibling_wise_xors_[level_index - 1];
     int64_t node_base = missing_path[level_index - 1] * arity;
     int num_siblings = std::min(static_cast<int64_t>(arity),
                                 tree->level_size(level_index) - node_base);
@@ -184,46 +612,263 @@ mpc_utils::StatusOr<std::unique_ptr<GGMTree>> GGMTree::CreateFromSiblingWiseXOR(
       if (node_base + sibling_index == missing_path[level_index]) {
         continue;
       }
-      tree->levels_[level_index][node_base + sibling_index] =
-          current_level_xors[sibling_index] ^
-          sibling_wise_xors[level_index - 1][sibling_index];
+      Block value = current_level_xors[sibling_index] ^
+                    sibling_wise_xors[level_index - 1][sibling_index];
+      tree->levels_[level_index][node_base + sibling_index] = value;
+      // Keep GetSiblingWiseXOR consistent with the tree's levels.
+      current_level_xors[sibling_index] ^= value;
       tree->ExpandSubtree(level_index, node_base + sibling_index);
     }
   }
   return tree;
 }
 
+mpc_utils::Status GGMTree::ExpandLeaves(
+    Block seed, absl::Span<const Block> keys, absl::Span<Block> leaves,
+    std::vector<std::vector<Block>>* sibling_wise_xors,
+    Construction construction) {
+  return ExpandLeavesImpl(leaves.size(), seed, keys, leaves.data(), nullptr,
+                          sibling_wise_xors, construction);
+}
+
+mpc_utils::Status GGMTree::ExpandLeaves(
+    int64_t num_leaves, Block seed, absl::Span<const Block> keys,
+    const LeafCallback& leaf_callback,
+    std::vector<std::vector<Block>>* sibling_wise_xors,
+    Construction construction) {
+  return ExpandLeavesImpl(num_leaves, seed, keys, nullptr, &leaf_callback,
+                          sibling_wise_xors, construction);
+}
+
+mpc_utils::Status GGMTree::ExpandLeavesFromSiblingWiseXOR(
+    int arity, int64_t missing_index,
+    absl::Span<const std::vector<Block>> sibling_wise_xors,
+    absl::Span<const Block> keys, absl::Span<Block> leaves,
+    Construction construction) {
+  return ExpandLeavesFromSiblingWiseXORImpl(arity, leaves.size(), missing_index,
+                                            sibling_wise_xors, keys,
+                                            leaves.data(), nullptr,
+                                            construction);
+}
+
+mpc_utils::Status GGMTree::ExpandLeavesFromSiblingWiseXOR(
+    int arity, int64_t num_leaves, int64_t missing_index,
+    absl::Span<const std::vector<Block>> sibling_wise_xors,
+    absl::Span<const Block> keys, const LeafCallback& leaf_callback,
+    Construction construction) {
+  return ExpandLeavesFromSiblingWiseXORImpl(arity, num_leaves, missing_index,
+                                            sibling_wise_xors, keys, nullptr,
+                                            &leaf_callback, construction);
+}
+
+mpc_utils::Status GGMTree::EvaluateLeaves(int64_t num_leaves, Block seed,
+                                          absl::Span<const Block> keys,
+                                          int64_t first_leaf,
+                                          absl::Span<Block> leaves,
+                                          Construction construction) {
+  ASSIGN_OR_RETURN(auto expander, NodeExpander::Create(keys, construction));
+  if (num_leaves <= 0) {
+    return mpc_utils::InvalidArgumentError("num_leaves must be positive");
+  }
+  if (first_leaf < 0 ||
+      first_leaf + static_cast<int64_t>(leaves.size()) > num_leaves) {
+    return mpc_utils::InvalidArgumentError(
+        "Requested leaves must be between 0 and `num_leaves` - 1");
+  }
+  ASSIGN_OR_RETURN(auto level_sizes,
+                   ComputeLevelSizes(expander.arity(), num_leaves));
+  EvaluateSubtreeRange(level_sizes, expander, 0, 0, seed, first_leaf, leaves);
+  return mpc_utils::OkStatus();
+}
+
+mpc_utils::Status GGMTree::Puncture(
+    int64_t num_leaves, Block seed, absl::Span<const Block> keys,
+    int64_t missing_index, std::vector<std::vector<Block>>* sibling_seeds,
+    Construction construction) {
+  ASSIGN_OR_RETURN(auto expander, NodeExpander::Create(keys, construction));
+  int arity = expander.arity();
+  if (num_leaves <= 0) {
+    return mpc_utils::InvalidArgumentError("num_leaves must be positive");
+  }
+  if (missing_index < 0 || missing_index >= num_leaves) {
+    return mpc_utils::InvalidArgumentError(
+        "`missing_index` must be between 0 and `num_leaves` - 1");
+  }
+  ASSIGN_OR_RETURN(auto level_sizes, ComputeLevelSizes(arity, num_leaves));
+  int num_levels = static_cast<int>(level_sizes.size());
+  std::vector<int64_t> missing_path =
+      ComputeMissingPath(arity, num_levels, missing_index);
+  sibling_seeds->assign(num_levels - 1, std::vector<Block>(arity, 0));
+  Block value = seed;
+  for (int level = 0; level < num_levels - 1; level++) {
+    int64_t first_child = missing_path[level] * arity;
+    int num_children = static_cast<int>(std::min(
+        static_cast<int64_t>(arity), level_sizes[level + 1] - first_child));
+    auto& children = (*sibling_seeds)[level];
+    expander.Expand(absl::MakeConstSpan(&value, 1), num_children,
+                    children.data());
+    Block& path_child = children[missing_path[level + 1] - first_child];
+    value = path_child;
+    path_child = 0;
+  }
+  return mpc_utils::OkStatus();
+}
+
+mpc_utils::Status GGMTree::EvaluatePuncturedLeaves(
+    int arity, int64_t num_leaves, int64_t missing_index,
+    absl::Span<const std::vector<Block>> sibling_seeds,
+    absl::Span<const Block> keys, int64_t first_leaf, absl::Span<Block> leaves,
+    Construction construction) {
+  RETURN_IF_ERROR(CheckSiblingWiseXORArguments(
+      arity, num_leaves, missing_index, sibling_seeds, keys, construction));
+  ASSIGN_OR_RETURN(auto level_sizes, ComputeLevelSizes(arity, num_leaves));
+  int num_levels = static_cast<int>(level_sizes.size());
+  if (num_levels != static_cast<int>(sibling_seeds.size()) + 1) {
+    return mpc_utils::InvalidArgumentError(
+        "Dimensions passed in `sibling_seeds` do not match `num_leaves`");
+  }
+  int64_t end_leaf = first_leaf + static_cast<int64_t>(leaves.size());
+  if (first_leaf < 0 || end_leaf > num_leaves) {
+    return mpc_utils::InvalidArgumentError(
+        "Requested leaves must be between 0 and `num_leaves` - 1");
+  }
+  ASSIGN_OR_RETURN(auto expander, NodeExpander::Create(keys, construction));
+  std::vector<int64_t> missing_path =
+      ComputeMissingPath(arity, num_levels, missing_index);
+
+  // Every leaf except the missing one is in exactly one subtree rooted at a
+  // sibling of the path to `missing_index`. Evaluate the part of the requested
+  // range that falls into each of them.
+  for (int level = 1; level < num_levels; level++) {
+    int64_t node_base = missing_path[level - 1] * arity;
+    int num_siblings = static_cast<int>(std::min(
+        static_cast<int64_t>(arity), level_sizes[level] - node_base));
+    for (int sibling_index = 0; sibling_index < num_siblings; sibling_index++) {
+      int64_t node = node_base + sibling_index;
+      if (node == missing_path[level]) {
+        continue;
+      }
+      auto range = SubtreeLeafRange(level_sizes, arity, level, node);
+      int64_t start = std::max(range.first, first_leaf);
+      int64_t end = std::min(range.second, end_leaf);
+      if (start >= end) {
+        continue;
+      }
+      EvaluateSubtreeRange(level_sizes, expander, level, node,
+                           sibling_seeds[level - 1][sibling_index], start,
+                           leaves.subspan(start - first_leaf, end - start));
+    }
+  }
+  if (missing_index >= first_leaf && missing_index < end_leaf) {
+    leaves[missing_index - first_leaf] = 0;
+  }
+  return mpc_utils::OkStatus();
+}
+
 GGMTree::GGMTree(std::vector<std::vector<Block>> levels,
-                 std::vector<Block> keys, std::vector<AES_KEY> expanded_keys)
+                 std::vector<Block> keys, std::vector<FixedKeyAES> prgs)
     : arity_(keys.size()),
       num_leaves_(levels.back().size()),
       num_levels_(levels.size()),
       levels_(std::move(levels)),
       keys_(std::move(keys)),
-      expanded_keys_(std::move(expanded_keys)) {}
+      prgs_(std::move(prgs)),
+      expanded_keys_(GetExpandedKeys(prgs_)),
+      sibling_wise_xors_(num_levels_ - 1, std::vector<Block>(arity_, 0)) {}
 
-void GGMTree::ExpandSubtree(int start_level, int64_t start_node) {
-  // Iterate over levels, then nodes, then keys.
-  int64_t max_node_index = start_node + 1;
-  for (int level_index = start_level; level_index < num_levels_ - 1;
-       level_index++) {
-    // Account for the fact that the level might not be full.
-    max_node_index = std::min(max_node_index, level_size(level_index));
-
-    for (int64_t node_index = start_node; node_index < max_node_index;
-         node_index++) {
-      int64_t num_siblings =
-          std::min(static_cast<int64_t>(arity_),
-                   level_size(level_index + 1) - node_index * arity_);
+void GGMTree::ExpandLevel(int level_index, int64_t start_node,
+                          int64_t end_node, Block* level_xors) {
+  int64_t next_level_size = level_size(level_index + 1);
+  // Process nodes in batches, so that the children of each batch are still in
+  // cache when XORing them onto `level_xors`. Within a batch, all nodes are
+  // passed to the PRG at once for each key, which allows it to pipeline AES
+  // calls.
+  for (int64_t batch_start = start_node; batch_start < end_node;
+       batch_start += kExpansionBatchSize) {
+    int64_t batch_end = std::min(end_node, batch_start + kExpansionBatchSize);
+    for (int sibling_index = 0; sibling_index < arity_; sibling_index++) {
+      // Only nodes with index below `sibling_end_node` have a child at
+      // `sibling_index`.
+      int64_t sibling_end_node = std::min(
+          batch_end, (next_level_size - sibling_index + arity_ - 1) / arity_);
+      if (sibling_end_node <= batch_start) {
+        continue;
+      }
+      prgs_[sibling_index].Hash(
+          absl::MakeConstSpan(&levels_[level_index][batch_start],
+                              sibling_end_node - batch_start),
+          &levels_[level_index + 1][arity_ * batch_start + sibling_index],
+          arity_);
+    }
+    // The first child of the batch has sibling index 0.
+    const Block* children = &levels_[level_index + 1][arity_ * batch_start];
+    int64_t num_children =
+        std::min(batch_end * arity_, next_level_size) - arity_ * batch_start;
+    for (int64_t i = 0; i < num_children; i += arity_) {
+      int num_siblings =
+          static_cast<int>(std::min<int64_t>(arity_, num_children - i));
       for (int sibling_index = 0; sibling_index < num_siblings;
            sibling_index++) {
-        levels_[level_index + 1][arity_ * node_index + sibling_index] =
-            ComputePRG(levels_[level_index][node_index],
-                       expanded_keys_[sibling_index]);
+        level_xors[sibling_index] ^= children[i + sibling_index];
       }
     }
+  }
+}
+
+void GGMTree::ExpandNodes(int start_level, int64_t start_node, int64_t end_node,
+                          std::vector<std::vector<Block>>* xors) {
+  for (int level_index = start_level; level_index < num_levels_ - 1;
+       level_index++) {
+    ExpandLevel(level_index, start_node, end_node,
+                (*xors)[level_index].data());
+    start_node *= arity_;
+    // Account for the fact that the next level might not be full.
+    end_node = std::min(end_node * arity_, level_size(level_index + 1));
+  }
+}
+
+void GGMTree::ExpandSubtree(int start_level, int64_t start_node) {
+  int64_t end_node = start_node + 1;
+  int64_t first_leaf = start_node, end_leaf = end_node;
+  for (int level_index = start_level; level_index < num_levels_ - 1;
+       level_index++) {
+    first_leaf *= arity_;
+    end_leaf = std::min(end_leaf * arity_, level_size(level_index + 1));
+  }
+  int num_threads = NumExpansionThreads(end_leaf - first_leaf);
+  if (num_threads == 1) {
+    ExpandNodes(start_level, start_node, end_node, &sibling_wise_xors_);
+    return;
+  }
+
+  // Expand the top levels serially until there are enough subtrees to
+  // distribute among threads.
+  while (start_level < num_levels_ - 1 &&
+         end_node - start_node < kSubtreesPerThread * num_threads) {
+    ExpandLevel(start_level, start_node, end_node,
+                sibling_wise_xors_[start_level].data());
     start_node *= arity_;
-    max_node_index *= arity_;
+    end_node = std::min(end_node * arity_, level_size(start_level + 1));
+    start_level++;
+  }
+  // Each thread accumulates its own sibling-wise XORs, which are combined at
+  // the end.
+#pragma omp parallel num_threads(num_threads)
+  {
+    std::vector<std::vector<Block>> thread_xors(num_levels_ - 1,
+                                                std::vector<Block>(arity_, 0));
+#pragma omp for schedule(dynamic)
+    for (int64_t node = start_node; node < end_node; node++) {
+      ExpandNodes(start_level, node, node + 1, &thread_xors);
+    }
+#pragma omp critical
+    for (int level_index = start_level; level_index < num_levels_ - 1;
+         level_index++) {
+      for (int sibling_index = 0; sibling_index < arity_; sibling_index++) {
+        sibling_wise_xors_[level_index][sibling_index] ^=
+            thread_xors[level_index][sibling_index];
+      }
+    }
   }
 }
 
@@ -240,13 +885,7 @@ mpc_utils::StatusOr<GGMTree::Block> GGMTree::GetValueAtNode(
 }
 
 std::vector<std::vector<GGMTree::Block>> GGMTree::GetSiblingWiseXOR() const {
-  std::vector<std::vector<Block>> values(num_levels_ - 1,
-                                         std::vector<Block>(arity_, 0));
-
-  for (int level_index = 0; level_index < num_levels_ - 1; level_index++) {
-    XORBlocks(levels_[level_index + 1], absl::MakeSpan(values[level_index]));
-  }
-  return values;
+  return sibling_wise_xors_;
 }
 
 }  // namespace distributed_vector_ole
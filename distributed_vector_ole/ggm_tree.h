@@ -30,16 +30,37 @@
 // This construction is also used in FLORAM [2]. The advantage is that the keys
 // are public, and can therefore be expanded in advance.
 //
+// The streaming functions below also support the binary half-tree
+// construction [3], which only needs a single key k and one AES call per inner
+// node instead of one per child:
+//
+//    value[left child of p] = H(value[p]),
+//    value[right child of p] = value[p] ^ value[left child of p],
+//
+// where H is FixedKeyAES::CCRHash with key k.
+//
+// Large trees are expanded in parallel using OpenMP, unless the tree is
+// constructed from within an active parallel region.
+//
+// EvaluateLeaves and EvaluatePuncturedLeaves compute individual leaves or
+// ranges of leaves of the same trees without expanding the rest of the tree,
+// i.e., they evaluate the GGM tree as a (punctured) PRF.
+//
 // [1] Goldreich, Oded, Shafi Goldwasser, and Silvio Micali. "How to construct
 // random functions." Journal of the ACM (JACM) 33.4 (1986): 792-807.
 // [2] Doerner, Jack, and Abhi Shelat. "Scaling ORAM for Secure Computation."
 // CCS, ACM, 2017, pp. 523–535.
+// [3] Guo, Xiaojie, et al. "Half-Tree: Halving the Cost of Tree Expansion in
+// COT and DPF." EUROCRYPT 2023.
 
 #include <cstdint>
+#include <functional>
 #include <vector>
 
 #include "absl/numeric/int128.h"
 #include "absl/types/span.h"
+#include "distributed_vector_ole/fixed_key_aes.h"
+#include "mpc_utils/status.h"
 #include "mpc_utils/statusor.h"
 #include "openssl/aes.h"
 #include "openssl/rand.h"
@@ -53,6 +74,50 @@ class GGMTree {
   using Block = absl::uint128;
   static_assert(sizeof(Block) == kBlockSize, "AES block size is not 128");
 
+  // How the children of a node are derived from its value.
+  enum class Construction {
+    // One key per sibling index.
+    kOneKeyPerChild,
+    // Binary half-tree with a single key.
+    kHalfTree,
+  };
+
+  // Returns the number of keys needed for trees of the given construction and
+  // arity.
+  static int NumKeys(Construction construction, int arity) {
+    return construction == Construction::kHalfTree ? 1 : arity;
+  }
+
+  // Computes the children of many nodes at once, using one batched PRG call
+  // per key. Used by the streaming functions below and by GGMForest.
+  class NodeExpander {
+   public:
+    // Returns an error if `keys` does not match `construction`.
+    static mpc_utils::StatusOr<NodeExpander> Create(
+        absl::Span<const Block> keys, Construction construction);
+
+    // Computes the first `num_children` children of `parents`, and writes the
+    // j-th child of parents[i] to children[i * arity() + j]. Only the last
+    // parent may have fewer than arity() children. `children` must not overlap
+    // with `parents`.
+    void Expand(absl::Span<const Block> parents, int64_t num_children,
+                Block *children) const;
+
+    // Returns the number of children of each node.
+    inline int arity() const { return arity_; }
+
+   private:
+    NodeExpander(Construction construction, int arity,
+                 std::vector<FixedKeyAES> prgs)
+        : construction_(construction),
+          arity_(arity),
+          prgs_(std::move(prgs)) {}
+
+    Construction construction_;
+    int arity_;
+    std::vector<FixedKeyAES> prgs_;
+  };
+
   // Constructs a GGMTree from a single seed and the given AES keys.
   static mpc_utils::StatusOr<std::unique_ptr<GGMTree>> Create(
       int64_t num_leaves, Block seed, std::vector<Block> keys);
@@ -79,6 +144,84 @@ class GGMTree {
       absl::Span<const std::vector<Block>> sibling_wise_xors,
       absl::Span<const Block> keys);
 
+  // Called by the streaming functions below for consecutive chunks of leaves.
+  // `first_leaf` is the index of leaves[0] in the tree.
+  using LeafCallback =
+      std::function<void(int64_t first_leaf, absl::Span<const Block> leaves)>;
+
+  // Expands `seed` like Create, but only keeps the path from the root to the
+  // current subtree in memory instead of all levels. The leaves are written to
+  // `leaves`, whose size determines the number of leaves of the tree. The
+  // arity is given by `keys.size()`, or 2 for the half-tree construction,
+  // which takes a single key. If `sibling_wise_xors` is not NULL, it is set to
+  // the output of GetSiblingWiseXOR, which is computed on the same pass.
+  static mpc_utils::Status ExpandLeaves(
+      Block seed, absl::Span<const Block> keys, absl::Span<Block> leaves,
+      std::vector<std::vector<Block>> *sibling_wise_xors = nullptr,
+      Construction construction = Construction::kOneKeyPerChild);
+
+  // Same as above, but passes the leaves to `leaf_callback` in chunks instead
+  // of storing them. Large trees are expanded by multiple threads, in which
+  // case `leaf_callback` is called concurrently for disjoint chunks, in no
+  // particular order. Otherwise chunks are emitted in increasing order.
+  static mpc_utils::Status ExpandLeaves(
+      int64_t num_leaves, Block seed, absl::Span<const Block> keys,
+      const LeafCallback &leaf_callback,
+      std::vector<std::vector<Block>> *sibling_wise_xors = nullptr,
+      Construction construction = Construction::kOneKeyPerChild);
+
+  // Streaming version of CreateFromSiblingWiseXOR. Writes the leaves of the
+  // tree to `leaves`, whose size determines the number of leaves. The missing
+  // leaf is set to zero. Unlike CreateFromSiblingWiseXOR, this also supports
+  // the half-tree construction, in which case `arity` must be 2 and `keys`
+  // must contain a single key.
+  static mpc_utils::Status ExpandLeavesFromSiblingWiseXOR(
+      int arity, int64_t missing_index,
+      absl::Span<const std::vector<Block>> sibling_wise_xors,
+      absl::Span<const Block> keys, absl::Span<Block> leaves,
+      Construction construction = Construction::kOneKeyPerChild);
+
+  // Same as above, but passes the leaves to `leaf_callback` in chunks. Chunks
+  // are not emitted in order, and may be passed concurrently from multiple
+  // threads. The missing leaf is passed as a separate chunk containing a single
+  // zero.
+  static mpc_utils::Status ExpandLeavesFromSiblingWiseXOR(
+      int arity, int64_t num_leaves, int64_t missing_index,
+      absl::Span<const std::vector<Block>> sibling_wise_xors,
+      absl::Span<const Block> keys, const LeafCallback &leaf_callback,
+      Construction construction = Construction::kOneKeyPerChild);
+
+  // Writes the leaves with indices first_leaf, ..., first_leaf + leaves.size()
+  // - 1 of the tree that ExpandLeaves computes for `num_leaves`, `seed`,
+  // `keys`, and `construction` to `leaves`. Only the ancestors of these leaves
+  // are computed, so a single leaf costs O(log(num_leaves)) PRG calls, and no
+  // levels are stored.
+  static mpc_utils::Status EvaluateLeaves(
+      int64_t num_leaves, Block seed, absl::Span<const Block> keys,
+      int64_t first_leaf, absl::Span<Block> leaves,
+      Construction construction = Construction::kOneKeyPerChild);
+
+  // Computes the punctured key for `missing_index`: For each level except the
+  // last one, sets (*sibling_seeds)[l] to the `arity` children of the node on
+  // level l on the path to `missing_index`. The child on the path, and
+  // children that do not exist, are set to zero. Costs O(arity *
+  // log(num_leaves)) PRG calls.
+  static mpc_utils::Status Puncture(
+      int64_t num_leaves, Block seed, absl::Span<const Block> keys,
+      int64_t missing_index, std::vector<std::vector<Block>> *sibling_seeds,
+      Construction construction = Construction::kOneKeyPerChild);
+
+  // Receiver side of EvaluateLeaves. Computes the given leaves from the
+  // `sibling_seeds` returned by Puncture, which have the same layout as
+  // `sibling_wise_xors` in ExpandLeavesFromSiblingWiseXOR. The missing leaf is
+  // set to zero.
+  static mpc_utils::Status EvaluatePuncturedLeaves(
+      int arity, int64_t num_leaves, int64_t missing_index,
+      absl::Span<const std::vector<Block>> sibling_seeds,
+      absl::Span<const Block> keys, int64_t first_leaf,
+      absl::Span<Block> leaves,
+      Construction construction = Construction::kOneKeyPerChild);
+
   // Returns the value at the `node_index`-th node at the given level.
   mpc_utils::StatusOr<Block> GetValueAtNode(int level_index,
                                             int64_t node_index) const;
@@ -91,7 +234,9 @@ class GGMTree {
   // For each level except the last one, returns the sibling-wise XOR of all the
   // children of this level. That is, all the first siblings get XORed together,
   // all the second siblings, and so on. The length of the returned vector is
-  // num_levels() - 1, and each inner vector has length arity().
+  // num_levels() - 1, and each inner vector has length arity(). The XORs are
+  // computed during expansion, so this does not require another pass over the
+  // tree.
   std::vector<std::vector<Block>> GetSiblingWiseXOR() const;
 
   // Returns the number of children of the tree's inner nodes.
@@ -117,9 +262,22 @@ class GGMTree {
 
  private:
   GGMTree(std::vector<std::vector<Block>> levels, std::vector<Block> keys,
-          std::vector<AES_KEY> expanded_keys);
+          std::vector<FixedKeyAES> prgs);
+
+  // Computes the children of nodes `start_node` to `end_node - 1` on the given
+  // level, using one batched PRG call per sibling index. The children are
+  // XORed onto `level_xors` by sibling index.
+  void ExpandLevel(int level_index, int64_t start_node, int64_t end_node,
+                   Block *level_xors);
 
-  // Expands the subtree rooted at the node given by level and node index.
+  // Expands the subtrees rooted at nodes `start_node` to `end_node - 1` on
+  // `start_level` level by level, accumulating sibling-wise XORs in `xors`.
+  void ExpandNodes(int start_level, int64_t start_node, int64_t end_node,
+                   std::vector<std::vector<Block>> *xors);
+
+  // Expands the subtree rooted at the node given by level and node index. Large
+  // subtrees are split into smaller ones below some level, which are expanded
+  // by separate threads.
   void ExpandSubtree(int start_level, int64_t start_node);
 
   const int arity_;
@@ -134,8 +292,14 @@ class GGMTree {
   // Number of keys is equal to `arity_`.
   const std::vector<Block> keys_;
 
+  // PRG instances for each key, used for expanding levels.
+  const std::vector<FixedKeyAES> prgs_;
+
   // Expanded AES round keys computed at construction.
   const std::vector<AES_KEY> expanded_keys_;
+
+  // Sibling-wise XORs of each level, accumulated during expansion.
+  std::vector<std::vector<Block>> sibling_wise_xors_;
 };
 
 }  // namespace distributed_vector_ole
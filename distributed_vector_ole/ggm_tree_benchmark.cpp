@@ -14,13 +14,20 @@
 //    You should have received a copy of the GNU Affero General Public License
 //    along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
+#include <vector>
+
 #include "benchmark/benchmark.h"
+#include "distributed_vector_ole/fixed_key_aes.h"
 #include "distributed_vector_ole/ggm_tree.h"
 
 namespace distributed_vector_ole {
 namespace {
 
+// The template parameter selects between the pipelined AES-NI PRG kernel and
+// the fallback that calls AES_encrypt once per child.
+template <bool hardware_aes>
 static void BM_Create(benchmark::State& state) {
+  FixedKeyAES::SetHardwareAESEnabled(hardware_aes);
   GGMTree::Block seed(42);
   int arity = state.range(0);
   int64_t num_leaves = state.range(1);
@@ -28,11 +35,18 @@ static void BM_Create(benchmark::State& state) {
     auto tree = GGMTree::Create(arity, num_leaves, seed);
     benchmark::DoNotOptimize(tree);
   }
+  FixedKeyAES::SetHardwareAESEnabled(true);
 }
-BENCHMARK(BM_Create)->Ranges({
-    {2, 1024},          // arity
-    {1 << 12, 1 << 24}  // num_leaves
-});
+BENCHMARK_TEMPLATE(BM_Create, true)
+    ->Ranges({
+        {2, 1024},          // arity
+        {1 << 12, 1 << 24}  // num_leaves
+    });
+BENCHMARK_TEMPLATE(BM_Create, false)
+    ->Ranges({
+        {2, 1024},          // arity
+        {1 << 12, 1 << 24}  // num_leaves
+    });
 
 static void BM_SiblingWiseXOR(benchmark::State& state) {
   GGMTree::Block seed(42);
@@ -50,7 +64,9 @@ BENCHMARK(BM_SiblingWiseXOR)
         {1 << 12, 1 << 24}  // num_leaves
     });
 
+template <bool hardware_aes>
 static void BM_CreateFromSiblingWiseXOR(benchmark::State& state) {
+  FixedKeyAES::SetHardwareAESEnabled(hardware_aes);
   GGMTree::Block seed(42);
   int arity = state.range(0);
   int64_t num_leaves = state.range(1);
@@ -62,12 +78,107 @@ static void BM_CreateFromSiblingWiseXOR(benchmark::State& state) {
         arity, num_leaves, missing_index, xors, tree->keys());
     benchmark::DoNotOptimize(tree2);
   }
+  FixedKeyAES::SetHardwareAESEnabled(true);
+}
+BENCHMARK_TEMPLATE(BM_CreateFromSiblingWiseXOR, true)
+    ->Ranges({
+        {2, 1024},          // arity
+        {1 << 12, 1 << 24}  // num_leaves
+    });
+BENCHMARK_TEMPLATE(BM_CreateFromSiblingWiseXOR, false)
+    ->Ranges({
+        {2, 1024},          // arity
+        {1 << 12, 1 << 24}  // num_leaves
+    });
+
+// Streaming expansion into a preallocated leaf vector, including the
+// computation of the sibling-wise XORs. Compare to BM_Create plus
+// BM_SiblingWiseXOR.
+static void BM_ExpandLeaves(benchmark::State& state) {
+  GGMTree::Block seed(42);
+  int arity = state.range(0);
+  int64_t num_leaves = state.range(1);
+  std::vector<GGMTree::Block> keys(arity);
+  for (int i = 0; i < arity; i++) {
+    keys[i] = i;
+  }
+  std::vector<GGMTree::Block> leaves(num_leaves);
+  std::vector<std::vector<GGMTree::Block>> xors;
+  for (auto _ : state) {
+    auto status =
+        GGMTree::ExpandLeaves(seed, keys, absl::MakeSpan(leaves), &xors);
+    benchmark::DoNotOptimize(status);
+    benchmark::DoNotOptimize(leaves.data());
+  }
 }
-BENCHMARK(BM_CreateFromSiblingWiseXOR)
+BENCHMARK(BM_ExpandLeaves)
     ->Ranges({
         {2, 1024},          // arity
         {1 << 12, 1 << 24}  // num_leaves
     });
 
+static void BM_ExpandLeavesFromSiblingWiseXOR(benchmark::State& state) {
+  GGMTree::Block seed(42);
+  int arity = state.range(0);
+  int64_t num_leaves = state.range(1);
+  int missing_index = 42 % num_leaves;
+  auto tree = GGMTree::Create(arity, num_leaves, seed).ValueOrDie();
+  auto xors = tree->GetSiblingWiseXOR();
+  std::vector<GGMTree::Block> leaves(num_leaves);
+  for (auto _ : state) {
+    auto status = GGMTree::ExpandLeavesFromSiblingWiseXOR(
+        arity, missing_index, xors, tree->keys(), absl::MakeSpan(leaves));
+    benchmark::DoNotOptimize(status);
+    benchmark::DoNotOptimize(leaves.data());
+  }
+}
+BENCHMARK(BM_ExpandLeavesFromSiblingWiseXOR)
+    ->Ranges({
+        {2, 1024},          // arity
+        {1 << 12, 1 << 24}  // num_leaves
+    });
+
+// Same as BM_ExpandLeaves and BM_ExpandLeavesFromSiblingWiseXOR with arity 2,
+// but using the half-tree construction.
+static void BM_ExpandHalfTreeLeaves(benchmark::State& state) {
+  GGMTree::Block seed(42);
+  int64_t num_leaves = state.range(0);
+  std::vector<GGMTree::Block> keys = {0};
+  std::vector<GGMTree::Block> leaves(num_leaves);
+  std::vector<std::vector<GGMTree::Block>> xors;
+  for (auto _ : state) {
+    auto status =
+        GGMTree::ExpandLeaves(seed, keys, absl::MakeSpan(leaves), &xors,
+                              GGMTree::Construction::kHalfTree);
+    benchmark::DoNotOptimize(status);
+    benchmark::DoNotOptimize(leaves.data());
+  }
+}
+BENCHMARK(BM_ExpandHalfTreeLeaves)->Range(1 << 12, 1 << 24);
+
+static void BM_ExpandHalfTreeLeavesFromSiblingWiseXOR(
+    benchmark::State& state) {
+  GGMTree::Block seed(42);
+  int64_t num_leaves = state.range(0);
+  int missing_index = 42 % num_leaves;
+  std::vector<GGMTree::Block> keys = {0};
+  std::vector<GGMTree::Block> leaves(num_leaves);
+  std::vector<std::vector<GGMTree::Block>> xors;
+  if (!GGMTree::ExpandLeaves(seed, keys, absl::MakeSpan(leaves), &xors,
+                             GGMTree::Construction::kHalfTree)
+           .ok()) {
+    state.SkipWithError("Expansion failed");
+    return;
+  }
+  for (auto _ : state) {
+    auto status = GGMTree::ExpandLeavesFromSiblingWiseXOR(
+        2, missing_index, xors, keys, absl::MakeSpan(leaves),
+        GGMTree::Construction::kHalfTree);
+    benchmark::DoNotOptimize(status);
+    benchmark::DoNotOptimize(leaves.data());
+  }
+}
+BENCHMARK(BM_ExpandHalfTreeLeavesFromSiblingWiseXOR)->Range(1 << 12, 1 << 24);
+
 }  // namespace
 }  // namespace distributed_vector_ole
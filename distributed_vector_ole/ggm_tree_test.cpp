@@ -16,6 +16,9 @@
 
 #include "distributed_vector_ole/ggm_tree.h"
 
+#include <omp.h>
+
+#include <algorithm>
 #include <cmath>
 
 #include "gtest/gtest.h"
@@ -100,6 +103,23 @@ class GGMTreeTest : public ::testing::Test {
     }
   }
 
+  // Checks that GetSiblingWiseXOR agrees with the XORs computed from the
+  // tree's levels.
+  void CheckSiblingWiseXOR(GGMTree* tree) {
+    auto sums = tree->GetSiblingWiseXOR();
+    ASSERT_EQ(sums.size(), tree->num_levels() - 1);
+    for (int level = 0; level < tree->num_levels() - 1; level++) {
+      for (int sibling = 0; sibling < tree->arity(); sibling++) {
+        GGMTree::Block sum = 0;
+        for (int64_t node = sibling; node < tree->level_size(level + 1);
+             node += tree->arity()) {
+          sum ^= tree->GetValueAtNode(level + 1, node).ValueOrDie();
+        }
+        EXPECT_EQ(sum, sums[level][sibling]);
+      }
+    }
+  }
+
   std::unique_ptr<GGMTree> tree_;
   absl::uint128 seed_;
 };
@@ -128,6 +148,7 @@ TEST_F(GGMTreeTest, Constructor2) {
                                              arity, num_leaves, missing_index,
                                              xors, tree_->keys()));
         CheckExceptOnPathToIndex(tree2.get(), missing_index);
+        CheckSiblingWiseXOR(tree2.get());
       }
     }
   }
@@ -135,19 +156,338 @@ TEST_F(GGMTreeTest, Constructor2) {
 
 TEST_F(GGMTreeTest, GetSiblingXOR) {
   SetUp(8, 1 << 15);
-  auto sums = tree_->GetSiblingWiseXOR();
-  for (int level = 0; level < tree_->num_levels() - 1; level++) {
-    for (int sibling = 0; sibling < tree_->arity(); sibling++) {
-      GGMTree::Block sum = 0;
-      for (int node = 0; node < tree_->level_size(level); node++) {
-        sum ^= tree_->GetValueAtNode(level + 1, node * tree_->arity() + sibling)
-                   .ValueOrDie();
+  CheckSiblingWiseXOR(tree_.get());
+  SetUp(3, 12345);
+  CheckSiblingWiseXOR(tree_.get());
+}
+
+TEST_F(GGMTreeTest, ExpandLeaves) {
+  for (int arity = 2; arity < 10; arity++) {
+    for (int64_t num_leaves : {1, 2, 23, 49, 5000, 10000}) {
+      SetUp(arity, num_leaves);
+      std::vector<GGMTree::Block> leaves(num_leaves);
+      std::vector<std::vector<GGMTree::Block>> xors;
+      ASSERT_TRUE(GGMTree::ExpandLeaves(seed_, tree_->keys(),
+                                        absl::MakeSpan(leaves), &xors)
+                      .ok());
+      for (int64_t i = 0; i < num_leaves; i++) {
+        EXPECT_EQ(leaves[i], tree_->GetValueAtLeaf(i).ValueOrDie());
+      }
+      EXPECT_EQ(xors, tree_->GetSiblingWiseXOR());
+    }
+  }
+}
+
+TEST_F(GGMTreeTest, ExpandLeavesWithCallback) {
+  int64_t num_leaves = 10000;
+  SetUp(2, num_leaves);
+  int64_t next_leaf = 0;
+  auto status = GGMTree::ExpandLeaves(
+      num_leaves, seed_, tree_->keys(),
+      [&](int64_t first_leaf, absl::Span<const GGMTree::Block> leaves) {
+        // Chunks are emitted in order.
+        EXPECT_EQ(first_leaf, next_leaf);
+        for (int64_t i = 0; i < static_cast<int64_t>(leaves.size()); i++) {
+          EXPECT_EQ(leaves[i],
+                    tree_->GetValueAtLeaf(first_leaf + i).ValueOrDie());
+        }
+        next_leaf += leaves.size();
+      });
+  ASSERT_TRUE(status.ok());
+  EXPECT_EQ(next_leaf, num_leaves);
+}
+
+TEST_F(GGMTreeTest, ExpandLeavesFromSiblingWiseXOR) {
+  for (int arity = 2; arity < 10; arity++) {
+    for (int64_t num_leaves : {1, 2, 23, 49, 5000, 10000}) {
+      for (int64_t missing_index :
+           {int64_t(0), 4242 % num_leaves, num_leaves - 1}) {
+        SetUp(arity, num_leaves);
+        auto xors = tree_->GetSiblingWiseXOR();
+        std::vector<GGMTree::Block> leaves(num_leaves, 1);
+        ASSERT_TRUE(GGMTree::ExpandLeavesFromSiblingWiseXOR(
+                        arity, missing_index, xors, tree_->keys(),
+                        absl::MakeSpan(leaves))
+                        .ok());
+        for (int64_t i = 0; i < num_leaves; i++) {
+          if (i == missing_index) {
+            EXPECT_EQ(leaves[i], 0);
+          } else {
+            EXPECT_EQ(leaves[i], tree_->GetValueAtLeaf(i).ValueOrDie());
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST_F(GGMTreeTest, ExpandLeavesFromSiblingWiseXORWithCallback) {
+  int64_t num_leaves = 10000, missing_index = 4242;
+  SetUp(4, num_leaves);
+  auto xors = tree_->GetSiblingWiseXOR();
+  std::vector<int> num_visits(num_leaves, 0);
+  auto status = GGMTree::ExpandLeavesFromSiblingWiseXOR(
+      4, num_leaves, missing_index, xors, tree_->keys(),
+      [&](int64_t first_leaf, absl::Span<const GGMTree::Block> leaves) {
+        for (int64_t i = 0; i < static_cast<int64_t>(leaves.size()); i++) {
+          num_visits[first_leaf + i]++;
+          if (first_leaf + i == missing_index) {
+            EXPECT_EQ(leaves[i], 0);
+          } else {
+            EXPECT_EQ(leaves[i],
+                      tree_->GetValueAtLeaf(first_leaf + i).ValueOrDie());
+          }
+        }
+      });
+  ASSERT_TRUE(status.ok());
+  EXPECT_EQ(num_visits, std::vector<int>(num_leaves, 1));
+}
+
+TEST_F(GGMTreeTest, ParallelExpansion) {
+  // Large enough to be split across threads.
+  int64_t num_leaves = (1 << 17) + 123, missing_index = 4242;
+  int num_threads = omp_get_max_threads();
+  for (int arity : {2, 5}) {
+    omp_set_num_threads(1);
+    SetUp(arity, num_leaves);
+    auto xors = tree_->GetSiblingWiseXOR();
+    std::vector<GGMTree::Block> expected_leaves(num_leaves);
+    for (int64_t i = 0; i < num_leaves; i++) {
+      expected_leaves[i] = tree_->GetValueAtLeaf(i).ValueOrDie();
+    }
+
+    omp_set_num_threads(4);
+    ASSERT_OK_AND_ASSIGN(
+        auto tree2,
+        GGMTree::Create(num_leaves, seed_,
+                        std::vector<GGMTree::Block>(tree_->keys().begin(),
+                                                    tree_->keys().end())));
+    EXPECT_EQ(tree2->GetSiblingWiseXOR(), xors);
+    ASSERT_OK_AND_ASSIGN(auto tree3, GGMTree::CreateFromSiblingWiseXOR(
+                                         arity, num_leaves, missing_index, xors,
+                                         tree_->keys()));
+    std::vector<GGMTree::Block> leaves(num_leaves);
+    std::vector<std::vector<GGMTree::Block>> xors2;
+    ASSERT_TRUE(GGMTree::ExpandLeaves(seed_, tree_->keys(),
+                                      absl::MakeSpan(leaves), &xors2)
+                    .ok());
+    EXPECT_EQ(xors2, xors);
+    std::vector<GGMTree::Block> leaves2(num_leaves);
+    ASSERT_TRUE(GGMTree::ExpandLeavesFromSiblingWiseXOR(
+                    arity, missing_index, xors, tree_->keys(),
+                    absl::MakeSpan(leaves2))
+                    .ok());
+    for (int64_t i = 0; i < num_leaves; i++) {
+      EXPECT_EQ(tree2->GetValueAtLeaf(i).ValueOrDie(), expected_leaves[i]);
+      EXPECT_EQ(leaves[i], expected_leaves[i]);
+      if (i != missing_index) {
+        EXPECT_EQ(tree3->GetValueAtLeaf(i).ValueOrDie(), expected_leaves[i]);
+        EXPECT_EQ(leaves2[i], expected_leaves[i]);
+      }
+    }
+  }
+  omp_set_num_threads(num_threads);
+}
+
+TEST_F(GGMTreeTest, HalfTree) {
+  GGMTree::Block key = 23;
+  std::vector<GGMTree::Block> keys = {key};
+  ASSERT_OK_AND_ASSIGN(auto prg, FixedKeyAES::Create(key));
+  int num_threads = omp_get_max_threads();
+  omp_set_num_threads(4);
+  for (int64_t num_leaves : {1, 2, 23, 49, 5000, (1 << 17) + 123}) {
+    // Expand the tree naively, level by level.
+    int num_levels = static_cast<int>(1 + std::ceil(std::log2(num_leaves)));
+    std::vector<int64_t> level_sizes(num_levels, num_leaves);
+    for (int level = num_levels - 2; level >= 0; level--) {
+      level_sizes[level] = (level_sizes[level + 1] + 1) / 2;
+    }
+    std::vector<GGMTree::Block> level = {seed_};
+    std::vector<std::vector<GGMTree::Block>> expected_xors(
+        num_levels - 1, std::vector<GGMTree::Block>(2, 0));
+    for (int l = 1; l < num_levels; l++) {
+      std::vector<GGMTree::Block> next(level_sizes[l]);
+      for (int64_t i = 0; i < level_sizes[l]; i++) {
+        GGMTree::Block parent = level[i / 2];
+        GGMTree::Block left = prg.CCRHash(parent);
+        next[i] = (i % 2 == 0) ? left : parent ^ left;
+        expected_xors[l - 1][i % 2] ^= next[i];
+      }
+      level = std::move(next);
+    }
+
+    std::vector<GGMTree::Block> leaves(num_leaves);
+    std::vector<std::vector<GGMTree::Block>> xors;
+    ASSERT_TRUE(GGMTree::ExpandLeaves(seed_, keys, absl::MakeSpan(leaves),
+                                      &xors, GGMTree::Construction::kHalfTree)
+                    .ok());
+    EXPECT_EQ(leaves, level);
+    EXPECT_EQ(xors, expected_xors);
+
+    for (int64_t missing_index :
+         {int64_t(0), 4242 % num_leaves, num_leaves - 1}) {
+      std::vector<GGMTree::Block> leaves2(num_leaves, 1);
+      ASSERT_TRUE(GGMTree::ExpandLeavesFromSiblingWiseXOR(
+                      2, missing_index, xors, keys, absl::MakeSpan(leaves2),
+                      GGMTree::Construction::kHalfTree)
+                      .ok());
+      for (int64_t i = 0; i < num_leaves; i++) {
+        EXPECT_EQ(leaves2[i], i == missing_index ? 0 : level[i]);
+      }
+    }
+  }
+  omp_set_num_threads(num_threads);
+}
+
+TEST_F(GGMTreeTest, EvaluateLeaves) {
+  struct Config {
+    int arity;
+    GGMTree::Construction construction;
+  };
+  for (Config config : {Config{2, GGMTree::Construction::kOneKeyPerChild},
+                        Config{3, GGMTree::Construction::kOneKeyPerChild},
+                        Config{8, GGMTree::Construction::kOneKeyPerChild},
+                        Config{2, GGMTree::Construction::kHalfTree}}) {
+    std::vector<GGMTree::Block> keys(
+        GGMTree::NumKeys(config.construction, config.arity));
+    for (int i = 0; i < static_cast<int>(keys.size()); i++) {
+      keys[i] = 100 + i;
+    }
+    for (int64_t num_leaves : {1, 2, 23, 100, 5000}) {
+      std::vector<GGMTree::Block> expected(num_leaves);
+      ASSERT_TRUE(GGMTree::ExpandLeaves(seed_, keys, absl::MakeSpan(expected),
+                                        nullptr, config.construction)
+                      .ok());
+      // Single leaves.
+      for (int64_t i = 0; i < num_leaves; i += 1 + num_leaves / 50) {
+        GGMTree::Block leaf;
+        ASSERT_TRUE(GGMTree::EvaluateLeaves(num_leaves, seed_, keys, i,
+                                            absl::MakeSpan(&leaf, 1),
+                                            config.construction)
+                        .ok());
+        EXPECT_EQ(leaf, expected[i]);
+      }
+      // Ranges, including the whole tree.
+      for (int64_t first_leaf : {int64_t(0), num_leaves / 3}) {
+        for (int64_t end_leaf : {num_leaves / 2 + 1, num_leaves}) {
+          if (end_leaf <= first_leaf) {
+            continue;
+          }
+          std::vector<GGMTree::Block> leaves(end_leaf - first_leaf);
+          ASSERT_TRUE(GGMTree::EvaluateLeaves(num_leaves, seed_, keys,
+                                              first_leaf,
+                                              absl::MakeSpan(leaves),
+                                              config.construction)
+                          .ok());
+          EXPECT_TRUE(std::equal(leaves.begin(), leaves.end(),
+                                 expected.begin() + first_leaf));
+        }
+      }
+
+      // Puncture at a few indices and check the receiver's leaves.
+      for (int64_t missing_index :
+           {int64_t(0), 4242 % num_leaves, num_leaves - 1}) {
+        std::vector<std::vector<GGMTree::Block>> sibling_seeds;
+        ASSERT_TRUE(GGMTree::Puncture(num_leaves, seed_, keys, missing_index,
+                                      &sibling_seeds, config.construction)
+                        .ok());
+        std::vector<GGMTree::Block> leaves(num_leaves, 1);
+        ASSERT_TRUE(GGMTree::EvaluatePuncturedLeaves(
+                        config.arity, num_leaves, missing_index,
+                        sibling_seeds, keys, 0, absl::MakeSpan(leaves),
+                        config.construction)
+                        .ok());
+        for (int64_t i = 0; i < num_leaves; i++) {
+          EXPECT_EQ(leaves[i], i == missing_index ? 0 : expected[i]);
+        }
+        // A range around the missing index.
+        int64_t first_leaf = std::max<int64_t>(0, missing_index - 7);
+        int64_t end_leaf = std::min(num_leaves, missing_index + 9);
+        std::vector<GGMTree::Block> range(end_leaf - first_leaf, 1);
+        ASSERT_TRUE(GGMTree::EvaluatePuncturedLeaves(
+                        config.arity, num_leaves, missing_index,
+                        sibling_seeds, keys, first_leaf,
+                        absl::MakeSpan(range), config.construction)
+                        .ok());
+        for (int64_t i = first_leaf; i < end_leaf; i++) {
+          EXPECT_EQ(range[i - first_leaf],
+                    i == missing_index ? 0 : expected[i]);
+        }
       }
-      EXPECT_EQ(sum, sums[level][sibling]);
     }
   }
 }
 
+TEST_F(GGMTreeTest, EvaluateLeavesOutOfRange) {
+  std::vector<GGMTree::Block> leaves(3);
+  auto status =
+      GGMTree::EvaluateLeaves(10, seed_, {1, 2}, 8, absl::MakeSpan(leaves));
+  EXPECT_EQ(status.code(), mpc_utils::StatusCode::kInvalidArgument);
+  EXPECT_EQ(status.message(),
+            "Requested leaves must be between 0 and `num_leaves` - 1");
+}
+
+TEST_F(GGMTreeTest, PunctureMissingIndexOutOfRange) {
+  std::vector<std::vector<GGMTree::Block>> sibling_seeds;
+  auto status = GGMTree::Puncture(10, seed_, {1, 2}, 10, &sibling_seeds);
+  EXPECT_EQ(status.code(), mpc_utils::StatusCode::kInvalidArgument);
+  EXPECT_EQ(status.message(),
+            "`missing_index` must be between 0 and `num_leaves` - 1");
+}
+
+TEST_F(GGMTreeTest, HalfTreeLeavesXORToSeed) {
+  // Each right child is its parent XOR the left child, so the XOR of all
+  // leaves of a complete half-tree is the seed. This is why AllButOneRandomOT
+  // does not allow packing leaves of half-trees.
+  std::vector<GGMTree::Block> keys = {23};
+  for (int64_t num_leaves : {1, 2, 4, 1024}) {
+    std::vector<GGMTree::Block> leaves(num_leaves);
+    std::vector<std::vector<GGMTree::Block>> xors;
+    ASSERT_TRUE(GGMTree::ExpandLeaves(seed_, keys, absl::MakeSpan(leaves),
+                                      &xors, GGMTree::Construction::kHalfTree)
+                    .ok());
+    GGMTree::Block leaf_xor = 0;
+    for (const auto& leaf : leaves) {
+      leaf_xor ^= leaf;
+    }
+    EXPECT_EQ(leaf_xor, seed_);
+  }
+}
+
+TEST_F(GGMTreeTest, HalfTreeWrongNumberOfKeys) {
+  std::vector<GGMTree::Block> leaves(23);
+  auto status =
+      GGMTree::ExpandLeaves(seed_, {1, 2}, absl::MakeSpan(leaves), nullptr,
+                            GGMTree::Construction::kHalfTree);
+  EXPECT_EQ(status.code(), mpc_utils::StatusCode::kInvalidArgument);
+  EXPECT_EQ(status.message(),
+            "`keys` must have length 1 for the half-tree construction");
+}
+
+TEST_F(GGMTreeTest, HalfTreeArityMustBeTwo) {
+  std::vector<GGMTree::Block> leaves(3);
+  auto status = GGMTree::ExpandLeavesFromSiblingWiseXOR(
+      3, 0, {{1, 2, 3}}, {1}, absl::MakeSpan(leaves),
+      GGMTree::Construction::kHalfTree);
+  EXPECT_EQ(status.code(), mpc_utils::StatusCode::kInvalidArgument);
+  EXPECT_EQ(status.message(), "The half-tree construction requires arity 2");
+}
+
+TEST_F(GGMTreeTest, ExpandLeavesArityMustBeAtLeastTwo) {
+  std::vector<GGMTree::Block> leaves(23);
+  auto status = GGMTree::ExpandLeaves(seed_, {42}, absl::MakeSpan(leaves));
+  EXPECT_EQ(status.code(), mpc_utils::StatusCode::kInvalidArgument);
+  EXPECT_EQ(status.message(), "arity must be at least 2");
+}
+
+TEST_F(GGMTreeTest, ExpandLeavesFromSiblingWiseXORWrongNumberOfKeys) {
+  std::vector<GGMTree::Block> leaves(2);
+  auto status = GGMTree::ExpandLeavesFromSiblingWiseXOR(
+      2, 0, {{23, 42}}, {1, 2, 3}, absl::MakeSpan(leaves));
+  EXPECT_EQ(status.code(), mpc_utils::StatusCode::kInvalidArgument);
+  EXPECT_EQ(status.message(), "`keys` must have length `arity`");
+}
+
 TEST_F(GGMTreeTest, ConstructorArityMustBeAtLeastTwo) {
   auto tree = GGMTree::Create(1, 23, seed_);
   ASSERT_FALSE(tree.ok());
@@ -0,0 +1,254 @@
+//    Distributed Vector-OLE
+//    Copyright (C) 2019 Phillipp Schoppmann and Adria Gascon
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "distributed_vector_ole/internal/all_but_one_random_ot_internal.h"
+
+#ifdef USE_ASM
+#include <emmintrin.h>
+#endif
+
+namespace distributed_vector_ole {
+
+namespace all_but_one_random_ot_internal {
+
+namespace {
+
+static_assert(sizeof(gf128) == sizeof(GGMTree::Block),
+              "gf128 must have the same layout as GGMTree::Block");
+
+#ifdef USE_ASM
+inline __m128i LoadBlock(const GGMTree::Block *in) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+}
+
+// Each iteration takes the low 32 bits of four leaves.
+template <bool negate>
+__attribute__((target("sse2"))) uint32_t UnpackUint32(
+    const GGMTree::Block *leaves, int64_t num_leaves, uint32_t *output) {
+  __m128i sum = _mm_setzero_si128();
+  int64_t i = 0;
+  for (; i + 4 <= num_leaves; i += 4) {
+    __m128i ab = _mm_unpacklo_epi32(LoadBlock(leaves + i),
+                                    LoadBlock(leaves + i + 1));
+    __m128i cd = _mm_unpacklo_epi32(LoadBlock(leaves + i + 2),
+                                    LoadBlock(leaves + i + 3));
+    __m128i values = _mm_unpacklo_epi64(ab, cd);
+    sum = _mm_add_epi32(sum, values);
+    if (negate) {
+      values = _mm_sub_epi32(_mm_setzero_si128(), values);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(output + i), values);
+  }
+  alignas(16) uint32_t lanes[4];
+  _mm_store_si128(reinterpret_cast<__m128i *>(lanes), sum);
+  uint32_t result = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  for (; i < num_leaves; i++) {
+    uint32_t value = static_cast<uint32_t>(leaves[i]);
+    result += value;
+    output[i] = negate ? -value : value;
+  }
+  return result;
+}
+
+// Each iteration takes the low 64 bits of two leaves.
+template <bool negate>
+__attribute__((target("sse2"))) uint64_t UnpackUint64(
+    const GGMTree::Block *leaves, int64_t num_leaves, uint64_t *output) {
+  __m128i sum = _mm_setzero_si128();
+  int64_t i = 0;
+  for (; i + 2 <= num_leaves; i += 2) {
+    __m128i values =
+        _mm_unpacklo_epi64(LoadBlock(leaves + i), LoadBlock(leaves + i + 1));
+    sum = _mm_add_epi64(sum, values);
+    if (negate) {
+      values = _mm_sub_epi64(_mm_setzero_si128(), values);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(output + i), values);
+  }
+  alignas(16) uint64_t lanes[2];
+  _mm_store_si128(reinterpret_cast<__m128i *>(lanes), sum);
+  uint64_t result = lanes[0] + lanes[1];
+  for (; i < num_leaves; i++) {
+    uint64_t value = static_cast<uint64_t>(leaves[i]);
+    result += value;
+    output[i] = negate ? -value : value;
+  }
+  return result;
+}
+
+// Packed version of UnpackUint32, where each leaf holds four elements.
+template <bool negate>
+__attribute__((target("sse2"))) uint32_t UnpackPackedUint32(
+    const GGMTree::Block *leaves, int64_t num_elements, uint32_t *output) {
+  __m128i sum = _mm_setzero_si128();
+  int64_t i = 0;
+  for (; i + 4 <= num_elements; i += 4) {
+    __m128i values = LoadBlock(leaves + i / 4);
+    sum = _mm_add_epi32(sum, values);
+    if (negate) {
+      values = _mm_sub_epi32(_mm_setzero_si128(), values);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(output + i), values);
+  }
+  alignas(16) uint32_t lanes[4];
+  _mm_store_si128(reinterpret_cast<__m128i *>(lanes), sum);
+  uint32_t result = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  for (; i < num_elements; i++) {
+    uint32_t value = static_cast<uint32_t>(leaves[i / 4] >> (32 * (i % 4)));
+    result += value;
+    output[i] = negate ? -value : value;
+  }
+  return result;
+}
+
+// Packed version of UnpackUint64, where each leaf holds two elements.
+template <bool negate>
+__attribute__((target("sse2"))) uint64_t UnpackPackedUint64(
+    const GGMTree::Block *leaves, int64_t num_elements, uint64_t *output) {
+  __m128i sum = _mm_setzero_si128();
+  int64_t i = 0;
+  for (; i + 2 <= num_elements; i += 2) {
+    __m128i values = LoadBlock(leaves + i / 2);
+    sum = _mm_add_epi64(sum, values);
+    if (negate) {
+      values = _mm_sub_epi64(_mm_setzero_si128(), values);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(output + i), values);
+  }
+  alignas(16) uint64_t lanes[2];
+  _mm_store_si128(reinterpret_cast<__m128i *>(lanes), sum);
+  uint64_t result = lanes[0] + lanes[1];
+  if (i < num_elements) {
+    uint64_t value = static_cast<uint64_t>(leaves[i / 2]);
+    result += value;
+    output[i] = negate ? -value : value;
+  }
+  return result;
+}
+
+// Leaves are copied as they are, and summed up using XOR.
+__attribute__((target("sse2"))) GGMTree::Block UnpackGF128(
+    const GGMTree::Block *leaves, int64_t num_leaves, gf128 *output) {
+  __m128i sum = _mm_setzero_si128();
+  for (int64_t i = 0; i < num_leaves; i++) {
+    __m128i value = LoadBlock(leaves + i);
+    sum = _mm_xor_si128(sum, value);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(output + i), value);
+  }
+  GGMTree::Block result;
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(&result), sum);
+  return result;
+}
+#else
+template <bool negate, typename T>
+T UnpackInteger(const GGMTree::Block *leaves, int64_t num_leaves, T *output) {
+  T result = 0;
+  for (int64_t i = 0; i < num_leaves; i++) {
+    T value = static_cast<T>(leaves[i]);
+    result += value;
+    output[i] = negate ? -value : value;
+  }
+  return result;
+}
+
+template <bool negate>
+uint32_t UnpackUint32(const GGMTree::Block *leaves, int64_t num_leaves,
+                      uint32_t *output) {
+  return UnpackInteger<negate>(leaves, num_leaves, output);
+}
+
+template <bool negate>
+uint64_t UnpackUint64(const GGMTree::Block *leaves, int64_t num_leaves,
+                      uint64_t *output) {
+  return UnpackInteger<negate>(leaves, num_leaves, output);
+}
+
+GGMTree::Block UnpackGF128(const GGMTree::Block *leaves, int64_t num_leaves,
+                           gf128 *output) {
+  GGMTree::Block result = 0;
+  for (int64_t i = 0; i < num_leaves; i++) {
+    result ^= leaves[i];
+    output[i] = gf128(leaves[i]);
+  }
+  return result;
+}
+#endif  // USE_ASM
+
+}  // namespace
+
+template <>
+uint32_t UnpackAndSumLeaves<uint32_t>(absl::Span<const GGMTree::Block> leaves,
+                                      absl::Span<uint32_t> output, bool negate,
+                                      int elements_per_leaf) {
+#ifdef USE_ASM
+  if (elements_per_leaf == 4) {
+    if (negate) {
+      return UnpackPackedUint32<true>(leaves.data(), output.size(),
+                                      output.data());
+    }
+    return UnpackPackedUint32<false>(leaves.data(), output.size(),
+                                     output.data());
+  }
+#endif
+  if (elements_per_leaf != 1) {
+    return UnpackAndSumLeavesGeneric(leaves, output, negate,
+                                     elements_per_leaf);
+  }
+  if (negate) {
+    return UnpackUint32<true>(leaves.data(), leaves.size(), output.data());
+  }
+  return UnpackUint32<false>(leaves.data(), leaves.size(), output.data());
+}
+
+template <>
+uint64_t UnpackAndSumLeaves<uint64_t>(absl::Span<const GGMTree::Block> leaves,
+                                      absl::Span<uint64_t> output, bool negate,
+                                      int elements_per_leaf) {
+#ifdef USE_ASM
+  if (elements_per_leaf == 2) {
+    if (negate) {
+      return UnpackPackedUint64<true>(leaves.data(), output.size(),
+                                      output.data());
+    }
+    return UnpackPackedUint64<false>(leaves.data(), output.size(),
+                                     output.data());
+  }
+#endif
+  if (elements_per_leaf != 1) {
+    return UnpackAndSumLeavesGeneric(leaves, output, negate,
+                                     elements_per_leaf);
+  }
+  if (negate) {
+    return UnpackUint64<true>(leaves.data(), leaves.size(), output.data());
+  }
+  return UnpackUint64<false>(leaves.data(), leaves.size(), output.data());
+}
+
+template <>
+gf128 UnpackAndSumLeaves<gf128>(absl::Span<const GGMTree::Block> leaves,
+                                absl::Span<gf128> output, bool negate,
+                                int elements_per_leaf) {
+  if (elements_per_leaf != 1) {
+    return UnpackAndSumLeavesGeneric(leaves, output, negate,
+                                     elements_per_leaf);
+  }
+  // In a field of characteristic 2, negation is the identity.
+  return gf128(UnpackGF128(leaves.data(), leaves.size(), output.data()));
+}
+
+}  // namespace all_but_one_random_ot_internal
+
+}  // namespace distributed_vector_ole
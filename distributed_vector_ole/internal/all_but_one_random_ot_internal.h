@@ -17,6 +17,9 @@
 #ifndef DISTRIBUTED_VECTOR_OLE_INTERNAL_ALL_BUT_ONE_RANDOM_OT_INTERNAL_H
 #define DISTRIBUTED_VECTOR_OLE_INTERNAL_ALL_BUT_ONE_RANDOM_OT_INTERNAL_H
 
+#include <algorithm>
+#include <cstring>
+#include <limits>
 #include <type_traits>
 
 #include "NTL/ZZ_p.h"
@@ -34,21 +37,123 @@ namespace distributed_vector_ole {
 
 namespace all_but_one_random_ot_internal {
 
-// Currently, this method only truncates the leaves of `tree` and writes them to
-// `output`.
-//
-// TODO: Implement packing, where each leaf of the last level actually
-//   represents multiple values of type T if sizeof(T) < sizeof(GGMTree::Block).
-//   This will require an (n-1)-out-of-n-OT on the last level.
+// Maximum number of elements packed into a single leaf.
+constexpr int kMaxElementsPerLeaf = 16;
+
+// Returns the number of Ts that can be packed into a single leaf, such that
+// each of them is still sampled with the given statistical security. This is
+// the largest power of two p <= kMaxElementsPerLeaf such that T can be hashed
+// into from 128 / p bits. Returns 1 if no packing is possible.
+template <typename T>
+int ElementsPerLeaf(double statistical_security) {
+  int elements_per_leaf = 1;
+  while (elements_per_leaf < kMaxElementsPerLeaf &&
+         ScalarHelper<T>::CanBeHashedInto(
+             statistical_security,
+             8 * GGMTree::kBlockSize / (2 * elements_per_leaf))) {
+    elements_per_leaf *= 2;
+  }
+  return elements_per_leaf;
+}
+
+// Returns a mask for the bits of a leaf that make up the element at `slot` if
+// `elements_per_leaf` elements are packed into it.
+inline GGMTree::Block SlotMask(int slot, int elements_per_leaf) {
+  if (elements_per_leaf == 1) {
+    return ~GGMTree::Block(0);
+  }
+  int num_bits = 8 * GGMTree::kBlockSize / elements_per_leaf;
+  return ((GGMTree::Block(1) << num_bits) - 1) << (slot * num_bits);
+}
+
+// If T is an integer type and `elements_per_leaf` Ts fill a leaf exactly,
+// copies the leaves to `output` as they are and returns true. Otherwise returns
+// false.
+template <typename T>
+typename std::enable_if<std::numeric_limits<T>::is_integer, bool>::type
+CopyLeavesIfDense(absl::Span<const GGMTree::Block> leaves, absl::Span<T> output,
+                  int elements_per_leaf) {
+  if (sizeof(T) * elements_per_leaf != GGMTree::kBlockSize) {
+    return false;
+  }
+  std::memcpy(output.data(), leaves.data(), output.size() * sizeof(T));
+  return true;
+}
+
+template <typename T>
+typename std::enable_if<!std::numeric_limits<T>::is_integer, bool>::type
+CopyLeavesIfDense(absl::Span<const GGMTree::Block> leaves, absl::Span<T> output,
+                  int elements_per_leaf) {
+  return false;
+}
+
+// Generic implementation of UnpackAndSumLeaves below.
 template <typename T>
-void UnpackLastLevel(const GGMTree &tree, absl::Span<T> output) {
-  for (int64_t i = 0; i < tree.num_leaves(); ++i) {
-    // ValieOrDie() is okay here as long as i stays in [0, num_leaves).
-    GGMTree::Block leaf = tree.GetValueAtLeaf(i).ValueOrDie();
-    output[i] = ScalarHelper<T>::FromUint128(leaf);
+T UnpackAndSumLeavesGeneric(absl::Span<const GGMTree::Block> leaves,
+                            absl::Span<T> output, bool negate,
+                            int elements_per_leaf) {
+  T sum(0);
+  int64_t output_size = static_cast<int64_t>(output.size());
+  if (CopyLeavesIfDense(leaves, output, elements_per_leaf)) {
+    for (int64_t i = 0; i < output_size; ++i) {
+      sum += output[i];
+      if (negate) {
+        output[i] = -output[i];
+      }
+    }
+    return sum;
+  }
+  int num_bits = 8 * GGMTree::kBlockSize / elements_per_leaf;
+  for (int64_t i = 0; i < static_cast<int64_t>(leaves.size()); ++i) {
+    int64_t first = i * elements_per_leaf;
+    int num_elements = static_cast<int>(
+        std::min<int64_t>(elements_per_leaf, output_size - first));
+    for (int j = 0; j < num_elements; ++j) {
+      absl::uint128 current = leaves[i] >> (j * num_bits);
+      if (num_bits < 128) {
+        current %= (absl::uint128(1) << num_bits);
+      }
+      output[first + j] = ScalarHelper<T>::FromUint128(current);
+      sum += output[first + j];
+      if (negate) {
+        output[first + j] = -output[first + j];
+      }
+    }
   }
+  return sum;
 }
 
+// Converts `leaves` to Ts and writes them to `output`. If `negate` is true,
+// the negated values are written instead. Returns the sum of the converted
+// leaves (before negation). This fuses the passes over the leaves needed by
+// SPFSSKnownIndex into one.
+//
+// Each leaf is split into `elements_per_leaf` slots of equal size, and each
+// slot is converted to a T, starting with the least significant bits. The
+// last leaf may be used only partially, i.e., `output` must have more than
+// (leaves.size() - 1) * elements_per_leaf and at most
+// leaves.size() * elements_per_leaf elements.
+template <typename T>
+T UnpackAndSumLeaves(absl::Span<const GGMTree::Block> leaves,
+                     absl::Span<T> output, bool negate,
+                     int elements_per_leaf = 1) {
+  return UnpackAndSumLeavesGeneric(leaves, output, negate, elements_per_leaf);
+}
+
+// Vectorized specializations, see all_but_one_random_ot_internal.cpp.
+template <>
+uint32_t UnpackAndSumLeaves<uint32_t>(absl::Span<const GGMTree::Block> leaves,
+                                      absl::Span<uint32_t> output, bool negate,
+                                      int elements_per_leaf);
+template <>
+uint64_t UnpackAndSumLeaves<uint64_t>(absl::Span<const GGMTree::Block> leaves,
+                                      absl::Span<uint64_t> output, bool negate,
+                                      int elements_per_leaf);
+template <>
+gf128 UnpackAndSumLeaves<gf128>(absl::Span<const GGMTree::Block> leaves,
+                                absl::Span<gf128> output, bool negate,
+                                int elements_per_leaf);
+
 // Conversion functions between EMP and GGMTree blocks.
 inline GGMTree::Block EMPToGGMTreeBlock(emp::block in) {
   return absl::MakeUint128(static_cast<uint64_t>(in[1]),
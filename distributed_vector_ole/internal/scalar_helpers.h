@@ -55,6 +55,12 @@ struct ScalarHelper {
   // instances of T with probability at least 1 - 2^-statistical_security.
   static bool CanBeHashedInto(double statistical_security = 40,
                               int hash_bits = 128);
+  // Returns the sum of x[indices[i]] * y[i] for all i < n.
+  static T GatherDotProduct(const T *x, const int *indices, const T *y,
+                            int64_t n);
+  // Returns true if the characteristic of T is even, i.e., if reducing modulo
+  // 2 is a ring homomorphism from T to F_2.
+  static bool HasEvenCharacteristic();
 };
 
 // Integers, including absl::uint128.
@@ -70,10 +76,20 @@ struct ScalarHelper<
                                         int hash_bits = 128) {
     return hash_bits >= SizeOf() * 8;
   }
+  // Integers are computed modulo 2^(8 * sizeof(T)).
+  static constexpr bool HasEvenCharacteristic() { return true; }
   static void Randomize(absl::Span<T> output) {
     RAND_bytes(reinterpret_cast<uint8_t *>(output.data()),
                output.size() * sizeof(T));
   }
+  static T GatherDotProduct(const T *x, const int *indices, const T *y,
+                            int64_t n) {
+    T result(0);
+    for (int64_t i = 0; i < n; i++) {
+      result += x[indices[i]] * y[i];
+    }
+    return result;
+  }
 };
 
 // GF128 elements.
@@ -93,10 +109,15 @@ struct ScalarHelper<gf128> {
                                         int hash_bits = 128) {
     return hash_bits >= SizeOf() * 8;
   }
+  static constexpr bool HasEvenCharacteristic() { return true; }
   static void Randomize(absl::Span<gf128> output) {
     RAND_bytes(reinterpret_cast<uint8_t *>(output.data()),
                output.size() * sizeof(gf128));
   }
+  static gf128 GatherDotProduct(const gf128 *x, const int *indices,
+                                const gf128 *y, int64_t n) {
+    return gf128::GatherDotProduct(x, indices, y, n);
+  }
 };
 
 // NTL modular integers.
@@ -127,11 +148,11 @@ struct ScalarHelperImpl<NTL::ZZ_p> {
     uint64_t modulus_high = NTL::conv<uint64_t>(NTL::ZZ_p::modulus() >> 64);
     absl::uint128 modulus = absl::MakeUint128(modulus_high, modulus_low);
     if (modulus == 0) {  // Modulus is a multiple of 2**128
-      return true;
+      return hash_bits >= 128;
     }
     absl::uint128 max_value = absl::Uint128Max();
     if (hash_bits < 128) {
-      max_value /= (absl::uint128(1) << hash_bits);
+      max_value >>= 128 - hash_bits;
     }
     absl::uint128 rem = ((max_value % modulus) + 1) % modulus;
     return hash_bits - std::log2(double(rem)) > statistical_security;
@@ -142,6 +163,19 @@ struct ScalarHelperImpl<NTL::ZZ_p> {
       output[i] = std::move(ntl_vec[i]);
     }
   }
+  static NTL::ZZ_p GatherDotProduct(const NTL::ZZ_p *x, const int *indices,
+                                    const NTL::ZZ_p *y, int64_t n) {
+    // Multiply without reduction, and only reduce the sum.
+    NTL::ZZ sum(0), product;
+    for (int64_t i = 0; i < n; i++) {
+      NTL::mul(product, NTL::rep(x[indices[i]]), NTL::rep(y[i]));
+      sum += product;
+    }
+    return NTL::conv<NTL::ZZ_p>(sum);
+  }
+  static bool HasEvenCharacteristic() {
+    return !NTL::IsOdd(NTL::ZZ_p::modulus());
+  }
 };
 // NTL::zz_p.
 template <>
@@ -157,7 +191,7 @@ struct ScalarHelperImpl<NTL::zz_p> {
                                           // to fit in a long.
     absl::uint128 max_value = absl::Uint128Max();
     if (hash_bits < 128) {
-      max_value /= (absl::uint128(1) << hash_bits);
+      max_value >>= 128 - hash_bits;
     }
     absl::uint128 rem = ((max_value % modulus) + 1) % modulus;
     return hash_bits - std::log2(double(rem)) > statistical_security;
@@ -168,6 +202,25 @@ struct ScalarHelperImpl<NTL::zz_p> {
       output[i] = ntl_vec[i];
     }
   }
+  static NTL::zz_p GatherDotProduct(const NTL::zz_p *x, const int *indices,
+                                    const NTL::zz_p *y, int64_t n) {
+    // Products of two reduced elements have at most 2 * NTL_SP_NBITS <= 124
+    // bits, so we can add up 15 of them before reducing, and 15 more after
+    // each reduction.
+    static_assert(NTL_SP_NBITS <= 62, "NTL::zz_p modulus too large");
+    long modulus = NTL::zz_p::modulus();
+    absl::uint128 sum = 0;
+    for (int64_t i = 0; i < n; i++) {
+      sum += absl::uint128(static_cast<uint64_t>(NTL::rep(x[indices[i]]))) *
+             static_cast<uint64_t>(NTL::rep(y[i]));
+      if (i % 15 == 14) {
+        sum %= modulus;
+      }
+    }
+    return NTL::conv<NTL::zz_p>(
+        static_cast<long>(absl::Uint128Low64(sum % modulus)));
+  }
+  static bool HasEvenCharacteristic() { return NTL::zz_p::modulus() % 2 == 0; }
 };
 
 // Common to all modular integers.
@@ -191,6 +244,13 @@ struct ScalarHelper<
   static void Randomize(absl::Span<T> output) {
     ScalarHelperImpl<T>::Randomize(output);
   }
+  static T GatherDotProduct(const T *x, const int *indices, const T *y,
+                            int64_t n) {
+    return ScalarHelperImpl<T>::GatherDotProduct(x, indices, y, n);
+  }
+  static bool HasEvenCharacteristic() {
+    return ScalarHelperImpl<T>::HasEvenCharacteristic();
+  }
 };
 
 }  // namespace distributed_vector_ole
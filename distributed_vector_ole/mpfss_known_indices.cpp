@@ -23,13 +23,21 @@
 namespace distributed_vector_ole {
 
 MPFSSKnownIndices::MPFSSKnownIndices(std::unique_ptr<CuckooHasher> hasher,
+                                     absl::uint128 hasher_seed,
+                                     BucketMapping bucket_mapping,
                                      std::unique_ptr<SPFSSKnownIndex> spfss,
                                      mpc_utils::comm_channel* channel)
-    : hasher_(std::move(hasher)), spfss_(std::move(spfss)), channel_(channel) {}
+    : hasher_(std::move(hasher)),
+      hasher_seed_(hasher_seed),
+      bucket_mapping_(bucket_mapping),
+      spfss_(std::move(spfss)),
+      channel_(channel) {}
 
 mpc_utils::StatusOr<std::unique_ptr<MPFSSKnownIndices>>
 MPFSSKnownIndices::Create(mpc_utils::comm_channel* channel,
-                          double statistical_security) {
+                          double statistical_security, int arity,
+                          GGMTree::Construction construction,
+                          BucketMapping bucket_mapping) {
   if (!channel) {
     return mpc_utils::InvalidArgumentError("`channel` must not be NULL");
   }
@@ -44,7 +52,8 @@ MPFSSKnownIndices::Create(mpc_utils::comm_channel* channel,
   std::unique_ptr<SPFSSKnownIndex> spfss;
   channel->sync();
   ASSIGN_OR_RETURN(spfss,
-                   SPFSSKnownIndex::Create(channel, statistical_security));
+                   SPFSSKnownIndex::Create(channel, statistical_security,
+                                           arity, construction));
 
   // Seed CuckooHasher: lower ID sends seed to higher ID.
   absl::uint128 hasher_seed;
@@ -56,13 +65,18 @@ MPFSSKnownIndices::Create(mpc_utils::comm_channel* channel,
     channel->recv(hasher_seed);
   }
 
-  // Allocate CuckooHasher.
-  ASSIGN_OR_RETURN(auto hasher,
-                   CuckooHasher::Create(hasher_seed, kNumHashFunctions,
-                                        statistical_security));
+  // Allocate CuckooHasher. The indices fit into 64 bits, so we can use the
+  // batched AES hash functions, which are much faster than the default ones
+  // when hashing the whole output in UpdateBuckets.
+  ASSIGN_OR_RETURN(
+      auto hasher,
+      CuckooHasher::Create(hasher_seed, kNumHashFunctions, statistical_security,
+                           /*stash_size=*/0,
+                           CuckooHasher::HashFamily::kBatchedAES));
 
-  return absl::WrapUnique(
-      new MPFSSKnownIndices(std::move(hasher), std::move(spfss), channel));
+  return absl::WrapUnique(new MPFSSKnownIndices(std::move(hasher), hasher_seed,
+                                                bucket_mapping,
+                                                std::move(spfss), channel));
 }
 
 mpc_utils::Status MPFSSKnownIndices::UpdateBuckets(int64_t output_size,
@@ -71,17 +85,132 @@ mpc_utils::Status MPFSSKnownIndices::UpdateBuckets(int64_t output_size,
       !cached_output_size_ || *cached_output_size_ != output_size ||
       !cached_num_indices_ || *cached_num_indices_ != num_indices;
   if (needs_update) {
-    std::vector<int64_t> all_indices(output_size);
-    std::iota(all_indices.begin(), all_indices.end(), 0);
-    ASSIGN_OR_RETURN(int64_t num_buckets,
-                     hasher_->GetOptimalNumberOfBuckets(num_indices));
-    ASSIGN_OR_RETURN(
-        buckets_,
-        hasher_->HashSimple(absl::MakeConstSpan(all_indices), num_buckets));
+    if (bucket_mapping_ == BucketMapping::kRegular) {
+      if (num_indices < 1 || output_size < num_indices) {
+        return mpc_utils::InvalidArgumentError(
+            "For BucketMapping::kRegular, `num_indices` must be between 1 "
+            "and `output_size`");
+      }
+    } else if (bucket_mapping_ == BucketMapping::kImplicit) {
+      ASSIGN_OR_RETURN(int64_t num_buckets,
+                       hasher_->GetOptimalNumberOfBuckets(num_indices));
+      ASSIGN_OR_RETURN(auto implicit_buckets,
+                       PermutationBuckets::Create(hasher_seed_,
+                                                  kNumHashFunctions,
+                                                  output_size, num_buckets));
+      implicit_buckets_ = implicit_buckets;
+    } else {
+      ASSIGN_OR_RETURN(int64_t num_buckets,
+                       hasher_->GetOptimalNumberOfBuckets(num_indices));
+      std::vector<int64_t> all_indices(output_size);
+      std::iota(all_indices.begin(), all_indices.end(), 0);
+      ASSIGN_OR_RETURN(
+          buckets_,
+          hasher_->HashSimple(absl::MakeConstSpan(all_indices), num_buckets));
+    }
     cached_output_size_ = output_size;
     cached_num_indices_ = num_indices;
   }
   return mpc_utils::OkStatus();
 }
 
+int64_t MPFSSKnownIndices::NumBuckets() const {
+  switch (bucket_mapping_) {
+    case BucketMapping::kRegular:
+      return *cached_num_indices_;
+    case BucketMapping::kImplicit:
+      return implicit_buckets_->num_buckets();
+    default:
+      return buckets_.size();
+  }
+}
+
+int64_t MPFSSKnownIndices::BucketStart(int64_t i) const {
+  switch (bucket_mapping_) {
+    case BucketMapping::kRegular:
+      return RegularBlockStart(*cached_output_size_, *cached_num_indices_, i);
+    case BucketMapping::kImplicit:
+      return implicit_buckets_->BucketStart(i);
+    default:
+      return buckets_.offsets()[i];
+  }
+}
+
+int64_t MPFSSKnownIndices::BucketSize(int64_t i) const {
+  switch (bucket_mapping_) {
+    case BucketMapping::kRegular:
+      return BucketStart(i + 1) - BucketStart(i);
+    case BucketMapping::kImplicit:
+      return implicit_buckets_->BucketSize(i);
+    default:
+      return buckets_[i].size();
+  }
+}
+
+int64_t MPFSSKnownIndices::NumBucketElements() const {
+  switch (bucket_mapping_) {
+    case BucketMapping::kRegular:
+      return *cached_output_size_;
+    case BucketMapping::kImplicit:
+      return implicit_buckets_->num_elements();
+    default:
+      return buckets_.elements().size();
+  }
+}
+
+mpc_utils::StatusOr<std::vector<int64_t>> MPFSSKnownIndices::HashCuckoo(
+    absl::Span<const int64_t> indices) const {
+  switch (bucket_mapping_) {
+    case BucketMapping::kRegular: {
+      std::vector<int64_t> result(indices.size());
+      for (int64_t i = 0; i < static_cast<int64_t>(indices.size()); i++) {
+        if (indices[i] < BucketStart(i) || indices[i] >= BucketStart(i + 1)) {
+          return mpc_utils::InvalidArgumentError(
+              "For BucketMapping::kRegular, `indices[i]` must lie in the i-th "
+              "block");
+        }
+        result[i] = i;
+      }
+      return result;
+    }
+    case BucketMapping::kImplicit:
+      return implicit_buckets_->HashCuckoo(indices);
+    default: {
+      // The hashes of all possible indices are already in buckets_, so we
+      // don't need to hash `indices` again.
+      if (static_cast<int64_t>(indices.size()) > buckets_.size()) {
+        return mpc_utils::InvalidArgumentError(
+            "`indices.size()` must not be larger than the number of buckets");
+      }
+      std::vector<absl::InlinedVector<int64_t, kNumHashFunctions>> hashes(
+          indices.size());
+      for (int64_t i = 0; i < static_cast<int64_t>(indices.size()); i++) {
+        for (int64_t position : buckets_.PositionsOf(indices[i])) {
+          hashes[i].push_back(buckets_.BucketOf(position));
+        }
+      }
+      return CuckooHasher::InsertCuckoo<kNumHashFunctions>(
+          absl::MakeConstSpan(hashes), buckets_.size());
+    }
+  }
+}
+
+int64_t MPFSSKnownIndices::IndexInBucket(int64_t bucket, int64_t index) const {
+  if (bucket_mapping_ == BucketMapping::kRegular) {
+    return index - BucketStart(bucket);
+  }
+  if (implicit_buckets_) {
+    int j = 0;
+    while (implicit_buckets_->Bucket(index, j) != bucket) {
+      j++;
+    }
+    return implicit_buckets_->OffsetInBucket(index, j);
+  }
+  // We can assume the bucket is sorted, as it is created in ascending order in
+  // UpdateBuckets, and HashSimple preserves the order.
+  return std::lower_bound(buckets_[bucket].begin(), buckets_[bucket].end(),
+                          index) -
+         buckets_[bucket].begin();
+}
+
 }  // namespace distributed_vector_ole
\ No newline at end of file
@@ -36,7 +36,9 @@
 #include "Eigen/Dense"
 #include "NTL/ZZ_p.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/types/any.h"
 #include "distributed_vector_ole/cuckoo_hasher.h"
+#include "distributed_vector_ole/permutation_buckets.h"
 #include "distributed_vector_ole/scalar_vector_gilboa_product.h"
 #include "distributed_vector_ole/spfss_known_index.h"
 #include "mpc_utils/boost_serialization/eigen.hpp"
@@ -49,25 +51,69 @@ using Vector = Eigen::Matrix<T, 1, Eigen::Dynamic>;
 
 class MPFSSKnownIndices {
  public:
+  // Determines how output indices are mapped to buckets. Both parties must use
+  // the same mapping.
+  enum class BucketMapping {
+    // Hashes all output indices with CuckooHasher::HashSimple in
+    // UpdateBuckets, and stores the resulting buckets, which take
+    // 3 * output_size int64_t values per instance.
+    kPrecomputed,
+    // Uses PermutationBuckets, which computes bucket sizes and the positions of
+    // indices in their buckets on the fly from the shared seed. Uses no memory
+    // proportional to the output size besides the bucket outputs themselves,
+    // at the cost of evaluating the hash functions on all indices in each run.
+    kImplicit,
+    // Splits the output into num_indices blocks of (almost) equal size, see
+    // RegularBlockStart, and uses each block as one bucket. Requires that the
+    // i-th index lies in the i-th block, as is the case for regular LPN noise.
+    // Needs no hashing at all, only num_indices SPFSS instances instead of
+    // NumBuckets(num_indices) for the other mappings, and each SPFSS writes
+    // directly into its block of the output.
+    kRegular,
+  };
+
   // Creates an instance of MPFSSKnownIndices that communicates over the
   // given comm_channel. Optionally accepts a pointer to an existing
   // ScalarVectorGilboaProduct instance. If omitted, a new instance will be
   // created with the given statistical security parameter and managed by this
-  // class.
+  // class. `arity` and `construction` determine the GGM trees used for SPFSS,
+  // see AllButOneRandomOT::Create.
   static mpc_utils::StatusOr<std::unique_ptr<MPFSSKnownIndices>> Create(
-      mpc_utils::comm_channel *channel, double statistical_security = 40);
+      mpc_utils::comm_channel *channel, double statistical_security = 40,
+      int arity = 2,
+      GGMTree::Construction construction =
+          GGMTree::Construction::kOneKeyPerChild,
+      BucketMapping bucket_mapping = BucketMapping::kPrecomputed);
 
   // Does nothing if cached_output_size_ == output_size. Otherwise hashes the
-  // interval [0, output_size) using hasher_, and saves the result in buckets_.
-  // Saves computation time if called before Run*.
+  // interval [0, output_size) using hasher_, and saves the result in buckets_,
+  // or, for BucketMapping::kImplicit, only sets up implicit_buckets_. For
+  // BucketMapping::kRegular, only checks the sizes. Saves computation time if
+  // called before Run*.
   mpc_utils::Status UpdateBuckets(int64_t output_size, int num_indices);
 
   // Returns the number of buckets used for cuckoo hashing the given number of
-  // indices.
+  // indices. This is also the size of the VOLE correlation needed by
+  // Run*VectorOLE. For BucketMapping::kRegular, returns `num_indices`.
   mpc_utils::StatusOr<int> NumBuckets(int num_indices) {
+    if (bucket_mapping_ == BucketMapping::kRegular && num_indices >= 0) {
+      return num_indices;
+    }
     return hasher_->GetOptimalNumberOfBuckets(num_indices);
   }
 
+  // Returns the bucket mapping passed at construction.
+  BucketMapping bucket_mapping() const { return bucket_mapping_; }
+
+  // Returns the start of the i-th block for BucketMapping::kRegular, where
+  // 0 <= i <= num_indices. Block i consists of the output indices in
+  // [RegularBlockStart(output_size, num_indices, i),
+  //  RegularBlockStart(output_size, num_indices, i + 1)).
+  static int64_t RegularBlockStart(int64_t output_size, int num_indices,
+                                   int64_t i) {
+    return i * output_size / num_indices;
+  }
+
   // Runs the ValueProvider side of the protocol. `output` must point to an
   // array of pre-allocated Ts.
   template <typename T>
@@ -96,7 +142,11 @@ class MPFSSKnownIndices {
   template <typename T>
   mpc_utils::Status RunValueProviderVectorOLE(T x, int y_len,
                                               absl::Span<const T> w,
-                                              absl::Span<T> output);
+                                              absl::Span<T> output) {
+    return RunValueProviderVectorOLEBatched<T>(
+        absl::MakeConstSpan(&x, 1), y_len, absl::MakeConstSpan(&w, 1),
+        absl::MakeConstSpan(&output, 1));
+  }
 
   // Runs the IndexProvider side of the Vector-OLE optimized protocol. See
   // RunValueProviderVectorOLE for a description. `u` and `v` must have sizes
@@ -106,18 +156,110 @@ class MPFSSKnownIndices {
                                               absl::Span<const int64_t> indices,
                                               absl::Span<const T> u,
                                               absl::Span<const T> v,
-                                              absl::Span<T> output);
+                                              absl::Span<T> output) {
+    return RunIndexProviderVectorOLEBatched<T>(
+        absl::MakeConstSpan(&y, 1), absl::MakeConstSpan(&indices, 1),
+        absl::MakeConstSpan(&u, 1), absl::MakeConstSpan(&v, 1),
+        absl::MakeConstSpan(&output, 1));
+  }
+
+  // Batched version of RunValueProviderVectorOLE, which runs one independent
+  // instance (or job) for each element of `x`, with the correlation `w[i]`
+  // and the output `outputs[i]`. All jobs must have the same `y_len` and the
+  // same output size. The jobs share all communication rounds: the masked
+  // vectors of all jobs are received in one message, and all SPFSS instances
+  // are run together, i.e., with a single batch of OTs.
+  template <typename T>
+  mpc_utils::Status RunValueProviderVectorOLEBatched(
+      absl::Span<const T> x, int y_len,
+      absl::Span<const absl::Span<const T>> w,
+      absl::Span<const absl::Span<T>> outputs);
+
+  // Batched version of RunIndexProviderVectorOLE, see
+  // RunValueProviderVectorOLEBatched. All jobs must have the same number of
+  // indices and the same output size.
+  template <typename T>
+  mpc_utils::Status RunIndexProviderVectorOLEBatched(
+      absl::Span<const absl::Span<const T>> y,
+      absl::Span<const absl::Span<const int64_t>> indices,
+      absl::Span<const absl::Span<const T>> u,
+      absl::Span<const absl::Span<const T>> v,
+      absl::Span<const absl::Span<T>> outputs);
 
  private:
   MPFSSKnownIndices(std::unique_ptr<CuckooHasher> hasher,
+                    absl::uint128 hasher_seed, BucketMapping bucket_mapping,
                     std::unique_ptr<SPFSSKnownIndex> spfss,
                     mpc_utils::comm_channel *channel);
 
+  // Return the number of buckets, the position of the first element of the
+  // i-th bucket, and the total number of elements in all buckets, for the
+  // current bucket mapping. Only valid after calling UpdateBuckets.
+  int64_t NumBuckets() const;
+  int64_t BucketStart(int64_t i) const;
+  int64_t BucketSize(int64_t i) const;
+  int64_t NumBucketElements() const;
+
+  // Hashes `indices` into the buckets using Cuckoo Hashing. Returns the index
+  // into `indices` for each bucket, or -1 for empty buckets. For
+  // BucketMapping::kRegular, checks that each index lies in its block instead.
+  // For BucketMapping::kPrecomputed, reuses the hashes stored in buckets_.
+  mpc_utils::StatusOr<std::vector<int64_t>> HashCuckoo(
+      absl::Span<const int64_t> indices) const;
+
+  // Returns the position of `index` in `bucket`, which must be one of the
+  // buckets of `index`.
+  int64_t IndexInBucket(int64_t bucket, int64_t index) const;
+
+  // Buffers for the outputs of the SPFSS instances in Run*VectorOLE, reused
+  // across calls.
+  template <typename T>
+  struct BucketOutputArena {
+    // The outputs of all buckets, one after the other in the same layout as
+    // the buckets. The SPFSS instances write their outputs directly into this
+    // buffer, so it never needs to be cleared. Unused for
+    // BucketMapping::kRegular, where the buckets have the same layout as the
+    // final output.
+    // For batched calls, the outputs of all jobs are stored one after the
+    // other, with `outputs_per_job` elements each.
+    std::vector<T> outputs;
+    int64_t outputs_per_job = 0;
+    // The part of `outputs`, or of the final output, for each bucket, again
+    // one job after the other.
+    std::vector<absl::Span<T>> spans;
+  };
+
+  // Returns the BucketOutputArena for T, and sizes it for the current buckets
+  // and one job for each element of `outputs`, which must all have the same
+  // size. Only allocates memory on the first call for each T, or if the
+  // buckets grew since the last call.
+  template <typename T>
+  BucketOutputArena<T> *PrepareBucketOutputs(
+      absl::Span<const absl::Span<T>> outputs);
+
+  // Sets each element of `output` to the sum of its entries in all buckets,
+  // where `bucket_outputs` is stored in the same layout as the buckets. Each
+  // output is computed independently, so this runs in parallel without write
+  // conflicts. For BucketMapping::kImplicit, outputs are processed in tiles of
+  // kGatherTileSize, and the positions of each tile are computed on the fly.
+  template <typename T>
+  void GatherBucketOutputs(absl::Span<const T> bucket_outputs,
+                           absl::Span<T> output);
+
   // Number of hash functions for cuckoo hashing.
   static const int kNumHashFunctions = 3;
 
-  // Precomputed mapping of output indices to buckets.
-  std::vector<std::vector<int64_t>> buckets_;
+  // Number of outputs per tile in GatherBucketOutputs with
+  // BucketMapping::kImplicit.
+  static const int64_t kGatherTileSize = 1 << 10;
+
+  // Precomputed mapping of output indices to buckets. Empty for
+  // BucketMapping::kImplicit.
+  CuckooHasher::Buckets buckets_;
+
+  // Implicit mapping of output indices to buckets. Only set for
+  // BucketMapping::kImplicit.
+  absl::optional<PermutationBuckets> implicit_buckets_;
 
   // Output size that buckets_ was computed for. Will be updated if
   // Run{Server,Client} is called with a different size.
@@ -130,6 +272,23 @@ class MPFSSKnownIndices {
   // CuckooHasher instance used for assigning indices to buckets.
   std::unique_ptr<CuckooHasher> hasher_;
 
+  // Seed of hasher_, shared by both parties. Also used for implicit_buckets_.
+  absl::uint128 hasher_seed_;
+
+  // See BucketMapping.
+  const BucketMapping bucket_mapping_;
+
+  // Holds a BucketOutputArena<T> for the T used in the last call to
+  // Run*VectorOLE.
+  absl::any bucket_output_arena_;
+
+  // Position of each index in its bucket, reused across calls to
+  // RunIndexProviderVectorOLE.
+  std::vector<int64_t> index_in_bucket_;
+
+  // Copy of the indices of one job, sorted to check for duplicates.
+  std::vector<int64_t> sorted_indices_;
+
   // Single-point FSS instance.
   std::unique_ptr<SPFSSKnownIndex> spfss_;
 
@@ -138,134 +297,256 @@ class MPFSSKnownIndices {
 };
 
 template <typename T>
-mpc_utils::Status MPFSSKnownIndices::RunValueProviderVectorOLE(
-    T x, int y_len, absl::Span<const T> w, absl::Span<T> output) {
+mpc_utils::Status MPFSSKnownIndices::RunValueProviderVectorOLEBatched(
+    absl::Span<const T> x, int y_len, absl::Span<const absl::Span<const T>> w,
+    absl::Span<const absl::Span<T>> outputs) {
   if (y_len < 1) {
     return mpc_utils::InvalidArgumentError("`y_len` must be positive");
   }
-  RETURN_IF_ERROR(UpdateBuckets(output.size(), y_len));
-  int num_buckets = buckets_.size();
+  int num_jobs = static_cast<int>(x.size());
+  if (static_cast<int>(w.size()) != num_jobs ||
+      static_cast<int>(outputs.size()) != num_jobs) {
+    return mpc_utils::InvalidArgumentError(
+        "`x`, `w`, and `outputs` must have the same size");
+  }
+  if (num_jobs == 0) {
+    return mpc_utils::OkStatus();
+  }
+  for (int j = 1; j < num_jobs; j++) {
+    if (outputs[j].size() != outputs[0].size()) {
+      return mpc_utils::InvalidArgumentError(
+          "All `outputs` must have the same size");
+    }
+  }
+  RETURN_IF_ERROR(UpdateBuckets(outputs[0].size(), y_len));
+  int num_buckets = NumBuckets();
+  for (int j = 0; j < num_jobs; j++) {
+    if (static_cast<int>(w[j].size()) != num_buckets) {
+      return mpc_utils::InvalidArgumentError(
+          "All `w` must have size NumBuckets(y_len)");
+    }
+  }
 
-  // Receive masked and permuted y from other party and compute our share of xy
-  // as (u+y)x-w.
+  // Receive masked and permuted y of all jobs from other party and compute
+  // our share of xy as (u+y)x-w for each job.
   Vector<T> y_masked;
   channel_->recv(y_masked);
-  Vector<T> val_share =
-      y_masked * x - Eigen::Map<const Vector<T>>(w.data(), w.size());
-
-  // Zero out `output`.
-  std::fill(output.begin(), output.end(), T(0));
-
-  std::vector<std::vector<T>> bucket_outputs(num_buckets);
-  std::vector<absl::Span<T>> bucket_output_spans(num_buckets);
-  for (int i = 0; i < num_buckets; i++) {
-    bucket_outputs[i] = std::vector<T>(buckets_[i].size(), T(0));
-    bucket_output_spans[i] = absl::MakeSpan(bucket_outputs[i]);
+  if (y_masked.size() != num_jobs * num_buckets) {
+    return mpc_utils::InternalError(
+        "Received masked vectors of the wrong size");
+  }
+  Vector<T> val_share(num_jobs * num_buckets);
+  for (int j = 0; j < num_jobs; j++) {
+    val_share.segment(j * num_buckets, num_buckets) =
+        y_masked.segment(j * num_buckets, num_buckets) * x[j] -
+        Eigen::Map<const Vector<T>>(w[j].data(), w[j].size());
   }
-  // Compute FSS for each bucket, and map the results  back to `output`.
+
+  // Compute FSS for each bucket of each job, and map the results back to
+  // `outputs`.
+  BucketOutputArena<T> *arena = PrepareBucketOutputs(outputs);
   RETURN_IF_ERROR(spfss_->RunValueProviderBatched<T>(
-      val_share, absl::MakeSpan(bucket_output_spans)));
-  for (int i = 0; i < num_buckets; i++) {
-    for (int j = 0; j < static_cast<int>(buckets_[i].size()); j++) {
-      output[buckets_[i][j]] += bucket_outputs[i][j];
+      val_share, absl::MakeSpan(arena->spans)));
+  if (bucket_mapping_ != BucketMapping::kRegular) {
+    for (int j = 0; j < num_jobs; j++) {
+      GatherBucketOutputs(absl::MakeConstSpan(arena->outputs)
+                              .subspan(j * arena->outputs_per_job,
+                                       arena->outputs_per_job),
+                          outputs[j]);
     }
   }
   return mpc_utils::OkStatus();
 }
 
 template <typename T>
-mpc_utils::Status MPFSSKnownIndices::RunIndexProviderVectorOLE(
-    absl::Span<const T> y, absl::Span<const int64_t> indices,
-    absl::Span<const T> u, absl::Span<const T> v, absl::Span<T> output) {
-  if (y.size() != indices.size()) {
+mpc_utils::Status MPFSSKnownIndices::RunIndexProviderVectorOLEBatched(
+    absl::Span<const absl::Span<const T>> y,
+    absl::Span<const absl::Span<const int64_t>> indices,
+    absl::Span<const absl::Span<const T>> u,
+    absl::Span<const absl::Span<const T>> v,
+    absl::Span<const absl::Span<T>> outputs) {
+  int num_jobs = static_cast<int>(y.size());
+  if (static_cast<int>(indices.size()) != num_jobs ||
+      static_cast<int>(u.size()) != num_jobs ||
+      static_cast<int>(v.size()) != num_jobs ||
+      static_cast<int>(outputs.size()) != num_jobs) {
     return mpc_utils::InvalidArgumentError(
-        "`y` and `indices` must have the same size");
+        "`y`, `indices`, `u`, `v`, and `outputs` must have the same size");
   }
-  if (output.size() < indices.size()) {
-    return mpc_utils::InvalidArgumentError(
-        "`output` must be at least as long as `indices`");
+  if (num_jobs == 0) {
+    return mpc_utils::OkStatus();
   }
-  if (y.empty()) {
-    return mpc_utils::InvalidArgumentError(
-        "`y` and `indices` must not be empty");
-  }
-  for (int i = 0; i < static_cast<int>(indices.size()); i++) {
-    if (indices[i] > static_cast<int64_t>(output.size())) {
+  for (int j = 0; j < num_jobs; j++) {
+    if (y[j].size() != indices[j].size()) {
       return mpc_utils::InvalidArgumentError(
-          absl::StrCat("`indices[", i, "`] out of range"));
+          "`y` and `indices` must have the same size");
     }
-  }
-  RETURN_IF_ERROR(UpdateBuckets(output.size(), y.size()));
-  int num_buckets = buckets_.size();
-  // Checking for uniqueness of `indices` takes time, so we only do that if
-  // cuckoo hashing fails.
-  auto status = hasher_->HashCuckoo(indices, num_buckets);
-  if (!status.ok() && mpc_utils::IsInternal(status.status()) &&
-      status.status().message() ==
-          "Failed to insert element, maximum number of tries exhausted") {
-    // Probably due to repeating indices.
-    absl::flat_hash_set<int64_t> indices_set(indices.begin(), indices.end());
-    if (indices.size() != indices_set.size()) {
-      return mpc_utils::InvalidArgumentError("All `indices` must be unique");
+    if (outputs[j].size() < indices[j].size()) {
+      return mpc_utils::InvalidArgumentError(
+          "`output` must be at least as long as `indices`");
+    }
+    if (y[j].empty()) {
+      return mpc_utils::InvalidArgumentError(
+          "`y` and `indices` must not be empty");
+    }
+    for (int i = 0; i < static_cast<int>(indices[j].size()); i++) {
+      if (indices[j][i] < 0 ||
+          indices[j][i] >= static_cast<int64_t>(outputs[j].size())) {
+        return mpc_utils::InvalidArgumentError(
+            absl::StrCat("`indices[", i, "`] out of range"));
+      }
+    }
+    if (y[j].size() != y[0].size() || outputs[j].size() != outputs[0].size()) {
+      return mpc_utils::InvalidArgumentError(
+          "All jobs must have the same number of indices and output size");
     }
   }
-  ASSIGN_OR_RETURN(auto hashed_inputs, std::move(status));
-
-  // y padded with zeros and permuted according to hashed_inputs:
-  // y_permuted[i] = y[j] if hashed_inputs[i] == j, and 0 if hashed_inputs[i] ==
-  // -1.
-  Vector<T> y_permuted(num_buckets);
+  RETURN_IF_ERROR(UpdateBuckets(outputs[0].size(), y[0].size()));
+  int num_buckets = NumBuckets();
+
+  // y of each job padded with zeros and permuted according to its
+  // hashed_inputs: y_permuted[j * num_buckets + i] = y[j][k] if
+  // hashed_inputs[i] == k, and 0 if hashed_inputs[i] == -1. Also computes the
+  // position of each index in its bucket.
+  Vector<T> y_permuted(num_jobs * num_buckets);
   std::fill(y_permuted.begin(), y_permuted.end(), T(0));
-  for (int i = 0; i < num_buckets; i++) {
-    if (hashed_inputs[i] != -1) {
-      y_permuted[i] = y[hashed_inputs[i]];
+  index_in_bucket_.assign(num_jobs * num_buckets, 0);
+  for (int j = 0; j < num_jobs; j++) {
+    // Cuckoo hashing finds a place for repeated indices as long as they have
+    // enough distinct buckets, so we need to check for uniqueness first.
+    sorted_indices_.assign(indices[j].begin(), indices[j].end());
+    std::sort(sorted_indices_.begin(), sorted_indices_.end());
+    if (std::adjacent_find(sorted_indices_.begin(), sorted_indices_.end()) !=
+        sorted_indices_.end()) {
+      return mpc_utils::InvalidArgumentError("All `indices` must be unique");
+    }
+    ASSIGN_OR_RETURN(auto hashed_inputs, HashCuckoo(indices[j]));
+    if (static_cast<int>(u[j].size()) != num_buckets ||
+        static_cast<int>(v[j].size()) != num_buckets) {
+      return mpc_utils::InvalidArgumentError(
+          "All `u` and `v` must have size NumBuckets(y.size())");
+    }
+    int64_t offset = j * num_buckets;
+    for (int i = 0; i < num_buckets; i++) {
+      if (hashed_inputs[i] != -1) {
+        y_permuted[offset + i] = y[j][hashed_inputs[i]];
+      }
+    }
+#pragma omp parallel for schedule(guided)
+    for (int i = 0; i < num_buckets; i++) {
+      if (hashed_inputs[i] == -1) {
+        continue;
+      }
+      index_in_bucket_[offset + i] =
+          IndexInBucket(i, indices[j][hashed_inputs[i]]);
     }
-  }
 
-  // Mask y_permuted with u and send it over. Our share of xy is v.
-  y_permuted += Eigen::Map<const Vector<T>>(u.data(), u.size());
+    // Mask y_permuted with u. Our share of xy is v.
+    y_permuted.segment(offset, num_buckets) +=
+        Eigen::Map<const Vector<T>>(u[j].data(), u[j].size());
+  }
   channel_->send(y_permuted);
   channel_->flush();
 
-  // Zero out `output`.
-  std::fill(output.begin(), output.end(), T(0));
+  // The SPFSS shares of all jobs are computed together, so we need all of v in
+  // one place.
+  absl::Span<const T> v_all = v[0];
+  std::vector<T> v_concatenated;
+  if (num_jobs > 1) {
+    v_concatenated.reserve(num_jobs * num_buckets);
+    for (int j = 0; j < num_jobs; j++) {
+      v_concatenated.insert(v_concatenated.end(), v[j].begin(), v[j].end());
+    }
+    v_all = v_concatenated;
+  }
+  BucketOutputArena<T> *arena = PrepareBucketOutputs(outputs);
+  RETURN_IF_ERROR(spfss_->RunIndexProviderBatched(
+      v_all, absl::MakeConstSpan(index_in_bucket_),
+      absl::MakeSpan(arena->spans)));
+  if (bucket_mapping_ != BucketMapping::kRegular) {
+    for (int j = 0; j < num_jobs; j++) {
+      GatherBucketOutputs(absl::MakeConstSpan(arena->outputs)
+                              .subspan(j * arena->outputs_per_job,
+                                       arena->outputs_per_job),
+                          outputs[j]);
+    }
+  }
+  return mpc_utils::OkStatus();
+}
+
+template <typename T>
+MPFSSKnownIndices::BucketOutputArena<T> *
+MPFSSKnownIndices::PrepareBucketOutputs(
+    absl::Span<const absl::Span<T>> outputs) {
+  auto *arena = absl::any_cast<BucketOutputArena<T>>(&bucket_output_arena_);
+  if (!arena) {
+    bucket_output_arena_ = BucketOutputArena<T>();
+    arena = absl::any_cast<BucketOutputArena<T>>(&bucket_output_arena_);
+  }
+  int num_jobs = static_cast<int>(outputs.size());
+  int num_buckets = NumBuckets();
+  bool regular = bucket_mapping_ == BucketMapping::kRegular;
+  arena->outputs_per_job = regular ? 0 : NumBucketElements();
+  // Only reallocates if the buffers grow beyond their capacity.
+  arena->outputs.resize(num_jobs * arena->outputs_per_job);
+  arena->spans.resize(num_jobs * num_buckets);
+  for (int j = 0; j < num_jobs; j++) {
+    absl::Span<T> job_outputs =
+        regular ? outputs[j]
+                : absl::MakeSpan(arena->outputs)
+                      .subspan(j * arena->outputs_per_job,
+                               arena->outputs_per_job);
+    absl::Span<T> *spans = arena->spans.data() + j * num_buckets;
+    for (int i = 0; i < num_buckets; i++) {
+      spans[i] = job_outputs.subspan(BucketStart(i), BucketSize(i));
+    }
+  }
+  return arena;
+}
 
-  std::vector<std::vector<T>> bucket_outputs(num_buckets);
-  std::vector<absl::Span<T>> bucket_output_spans(num_buckets);
-  std::vector<int64_t> index_in_bucket(num_buckets, 0);
+template <typename T>
+void MPFSSKnownIndices::GatherBucketOutputs(absl::Span<const T> bucket_outputs,
+                                            absl::Span<T> output) {
   NTLContext<T> context;
   context.save();
+  int64_t output_size = output.size();
+  if (!implicit_buckets_) {
 #pragma omp parallel
-  {
-    context.restore();
-#pragma omp for schedule(guided)
-    for (int i = 0; i < num_buckets; i++) {
+    {
       context.restore();
-      if (buckets_[i].empty()) {
-        continue;
-      }
-      bucket_outputs[i] = std::vector<T>(buckets_[i].size(), T(0));
-      bucket_output_spans[i] = absl::MakeSpan(bucket_outputs[i]);
-      if (hashed_inputs[i] != -1) {
-        // Find the index in the bucket. We can assume the bucket is sorted,
-        // as it is created in ascending order in UpdateBuckets, and
-        // HashSimple preserves the order.
-        index_in_bucket[i] =
-            std::lower_bound(buckets_[i].begin(), buckets_[i].end(),
-                             indices[hashed_inputs[i]]) -
-            buckets_[i].begin();
+#pragma omp for schedule(static)
+      for (int64_t i = 0; i < output_size; i++) {
+        T sum(0);
+        for (int64_t position : buckets_.PositionsOf(i)) {
+          sum += bucket_outputs[position];
+        }
+        output[i] = sum;
       }
     }
+    return;
   }
-  RETURN_IF_ERROR(
-      spfss_->RunIndexProviderBatched(v, absl::MakeConstSpan(index_in_bucket),
-                                      absl::MakeSpan(bucket_output_spans)));
-  for (int i = 0; i < num_buckets; i++) {
-    for (int j = 0; j < static_cast<int>(buckets_[i].size()); j++) {
-      output[buckets_[i][j]] += bucket_outputs[i][j];
+  int64_t num_tiles = (output_size + kGatherTileSize - 1) / kGatherTileSize;
+#pragma omp parallel
+  {
+    context.restore();
+    std::vector<int64_t> positions(kNumHashFunctions * kGatherTileSize);
+#pragma omp for schedule(static)
+    for (int64_t tile = 0; tile < num_tiles; tile++) {
+      int64_t first_output = tile * kGatherTileSize;
+      int64_t tile_size =
+          std::min(kGatherTileSize, output_size - first_output);
+      implicit_buckets_->Positions(
+          first_output,
+          absl::MakeSpan(positions).subspan(0, kNumHashFunctions * tile_size));
+      for (int64_t i = 0; i < tile_size; i++) {
+        T sum(0);
+        for (int j = 0; j < kNumHashFunctions; j++) {
+          sum += bucket_outputs[positions[i * kNumHashFunctions + j]];
+        }
+        output[first_output + i] = sum;
+      }
     }
   }
-  return mpc_utils::OkStatus();
 }
 
 }  // namespace distributed_vector_ole
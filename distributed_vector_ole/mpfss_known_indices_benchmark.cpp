@@ -42,14 +42,21 @@ int GetNumIndicesForLength(int length) {
   return 0;
 }
 
+// Runs MPFSS on vectors of the given length, using GGM trees of the given
+// arity and the given bucket mapping.
 template <typename T, bool measure_communication>
-static void BM_RunNative(benchmark::State &state) {
+static void RunBenchmark(
+    benchmark::State &state, int64_t length, int arity,
+    MPFSSKnownIndices::BucketMapping bucket_mapping =
+        MPFSSKnownIndices::BucketMapping::kPrecomputed) {
   mpc_utils::testing::CommChannelTestHelper helper(measure_communication);
-  int64_t length = state.range(0);
   comm_channel *chan0 = helper.GetChannel(0);
   comm_channel *chan1 = helper.GetChannel(1);
   emp::initialize_relic();
-  auto mpfss0 = MPFSSKnownIndices::Create(chan0).ValueOrDie();
+  auto mpfss0 = MPFSSKnownIndices::Create(
+                    chan0, 40, arity, GGMTree::Construction::kOneKeyPerChild,
+                    bucket_mapping)
+                    .ValueOrDie();
 
   // Compute number of indices and VOLE correlation.
   int y_len = GetNumIndicesForLength(length);
@@ -63,9 +70,13 @@ static void BM_RunNative(benchmark::State &state) {
   // Spawn a thread that acts as the server.
   NTLContext<T> ntl_context;
   ntl_context.save();
-  std::thread thread1([chan1, length, &ntl_context, y_len, &w, &x] {
+  std::thread thread1([chan1, length, arity, bucket_mapping, &ntl_context,
+                       y_len, &w, &x] {
     ntl_context.restore();
-    auto mpfss1 = MPFSSKnownIndices::Create(chan1).ValueOrDie();
+    auto mpfss1 = MPFSSKnownIndices::Create(
+                      chan1, 40, arity, GGMTree::Construction::kOneKeyPerChild,
+                      bucket_mapping)
+                      .ValueOrDie();
     bool keep_running;
     std::vector<T> output1(length);
     do {
@@ -81,7 +92,13 @@ static void BM_RunNative(benchmark::State &state) {
   std::vector<T> y(y_len);
   std::fill(y.begin(), y.end(), T(42));
   std::vector<int64_t> indices(y_len);
-  std::iota(indices.begin(), indices.end(), 0);
+  if (bucket_mapping == MPFSSKnownIndices::BucketMapping::kRegular) {
+    for (int i = 0; i < y_len; i++) {
+      indices[i] = MPFSSKnownIndices::RegularBlockStart(length, y_len, i);
+    }
+  } else {
+    std::iota(indices.begin(), indices.end(), 0);
+  }
   mpfss0->RunIndexProviderVectorOLE<T>(y, indices, u, v,
                                        absl::MakeSpan(output0));
   for (auto _ : state) {
@@ -104,6 +121,145 @@ static void BM_RunNative(benchmark::State &state) {
       benchmark::Counter(bytes_sent0, benchmark::Counter::kAvgIterations);
   state.counters["BytesSentReceiver"] =
       benchmark::Counter(bytes_sent1, benchmark::Counter::kAvgIterations);
+  state.counters["NumBuckets"] = num_buckets;
+}
+
+// Runs `num_jobs` MPFSS instances on vectors of the given length in a single
+// batched call, which shares one OT batch and one round of messages between all
+// of them. Comparing to `num_jobs` = 1 shows the savings in round trips.
+template <typename T, bool measure_communication>
+static void RunBatchedBenchmark(benchmark::State &state, int64_t length,
+                                int num_jobs) {
+  mpc_utils::testing::CommChannelTestHelper helper(measure_communication);
+  comm_channel *chan0 = helper.GetChannel(0);
+  comm_channel *chan1 = helper.GetChannel(1);
+  emp::initialize_relic();
+  auto mpfss0 = MPFSSKnownIndices::Create(
+                    chan0, 40, 2, GGMTree::Construction::kOneKeyPerChild)
+                    .ValueOrDie();
+
+  // Compute number of indices and VOLE correlation. All jobs use the same
+  // inputs, which does not matter for the running time.
+  int y_len = GetNumIndicesForLength(length);
+  T x(23);
+  int num_buckets = mpfss0->NumBuckets(y_len).ValueOrDie();
+  Vector<T> u(num_buckets), v(num_buckets), w(num_buckets);
+  ScalarHelper<T>::Randomize(absl::MakeSpan(u));
+  ScalarHelper<T>::Randomize(absl::MakeSpan(v));
+  w = u * x + v;
+  std::vector<T> xs(num_jobs, x);
+  std::vector<absl::Span<const T>> us(num_jobs, u), vs(num_jobs, v),
+      ws(num_jobs, w);
+
+  // Spawn a thread that acts as the server.
+  NTLContext<T> ntl_context;
+  ntl_context.save();
+  std::thread thread1([chan1, length, num_jobs, &ntl_context, y_len, &ws,
+                       &xs] {
+    ntl_context.restore();
+    auto mpfss1 = MPFSSKnownIndices::Create(
+                      chan1, 40, 2, GGMTree::Construction::kOneKeyPerChild)
+                      .ValueOrDie();
+    bool keep_running;
+    std::vector<std::vector<T>> outputs1(num_jobs, std::vector<T>(length));
+    std::vector<absl::Span<T>> output_spans1;
+    for (auto &output : outputs1) {
+      output_spans1.push_back(absl::MakeSpan(output));
+    }
+    do {
+      mpfss1->RunValueProviderVectorOLEBatched<T>(xs, y_len, ws,
+                                                  output_spans1);
+      benchmark::DoNotOptimize(outputs1);
+      chan1->recv(keep_running);
+    } while (keep_running);
+  });
+
+  // Run the client in the main thread.
+  std::vector<std::vector<T>> outputs0(num_jobs, std::vector<T>(length));
+  std::vector<absl::Span<T>> output_spans0;
+  for (auto &output : outputs0) {
+    output_spans0.push_back(absl::MakeSpan(output));
+  }
+  std::vector<T> y(y_len);
+  std::fill(y.begin(), y.end(), T(42));
+  std::vector<int64_t> indices(y_len);
+  std::iota(indices.begin(), indices.end(), 0);
+  std::vector<absl::Span<const T>> ys(num_jobs, y);
+  std::vector<absl::Span<const int64_t>> indices_spans(num_jobs, indices);
+  mpfss0->RunIndexProviderVectorOLEBatched<T>(ys, indices_spans, us, vs,
+                                              output_spans0);
+  for (auto _ : state) {
+    chan0->send(true);
+    chan0->flush();
+    mpfss0->RunIndexProviderVectorOLEBatched<T>(ys, indices_spans, us, vs,
+                                                output_spans0);
+    benchmark::DoNotOptimize(outputs0);
+  }
+  chan0->send(false);
+  chan0->flush();
+  thread1.join();
+
+  int64_t bytes_sent0 = 0, bytes_sent1 = 0;
+  if (measure_communication) {
+    bytes_sent0 = chan0->get_num_bytes_sent();
+    bytes_sent1 = chan1->get_num_bytes_sent();
+  }
+  state.counters["BytesSentSender"] =
+      benchmark::Counter(bytes_sent0, benchmark::Counter::kAvgIterations);
+  state.counters["BytesSentReceiver"] =
+      benchmark::Counter(bytes_sent1, benchmark::Counter::kAvgIterations);
+  state.SetItemsProcessed(state.iterations() * num_jobs);
+}
+
+template <typename T, bool measure_communication>
+static void BM_RunNative(benchmark::State &state) {
+  RunBenchmark<T, measure_communication>(state, state.range(0), 2);
+}
+
+// Sweeps over the arity of the GGM trees. The first argument is the length,
+// the second one the arity.
+template <typename T, bool measure_communication>
+static void BM_RunArity(benchmark::State &state) {
+  RunBenchmark<T, measure_communication>(state, state.range(0),
+                                         state.range(1));
+}
+
+// Uses BucketMapping::kImplicit, which computes the buckets on the fly.
+template <typename T, bool measure_communication>
+static void BM_RunImplicitBuckets(benchmark::State &state) {
+  RunBenchmark<T, measure_communication>(
+      state, state.range(0), 2, MPFSSKnownIndices::BucketMapping::kImplicit);
+}
+
+// Uses BucketMapping::kRegular, i.e., regular noise without hashing.
+template <typename T, bool measure_communication>
+static void BM_RunRegularBuckets(benchmark::State &state) {
+  RunBenchmark<T, measure_communication>(
+      state, state.range(0), 2, MPFSSKnownIndices::BucketMapping::kRegular);
+}
+
+// Batches several jobs into one call. The first argument is the length, the
+// second one the number of jobs.
+template <typename T, bool measure_communication>
+static void BM_RunBatched(benchmark::State &state) {
+  RunBatchedBenchmark<T, measure_communication>(state, state.range(0),
+                                                state.range(1));
+}
+
+static void BatchedArguments(benchmark::internal::Benchmark *b) {
+  for (int64_t length = 1 << 12; length <= 1 << 20; length *= 4) {
+    for (int num_jobs : {1, 2, 4, 8}) {
+      b->Args({length, num_jobs});
+    }
+  }
+}
+
+static void ArityArguments(benchmark::internal::Benchmark *b) {
+  for (int64_t length = 1 << 12; length <= 1 << 22; length *= 4) {
+    for (int arity : {2, 4, 8, 16}) {
+      b->Args({length, arity});
+    }
+  }
 }
 
 template <int num_bits, bool measure_communication>
@@ -151,6 +307,22 @@ BENCHMARK_TEMPLATE(BM_RunNative, gf128, false)
     ->RangeMultiplier(4)
     ->Range(1 << 12, 1 << 22);
 
+// Timing (implicit buckets).
+BENCHMARK_TEMPLATE(BM_RunImplicitBuckets, uint64_t, false)
+    ->RangeMultiplier(4)
+    ->Range(1 << 12, 1 << 22);
+BENCHMARK_TEMPLATE(BM_RunImplicitBuckets, absl::uint128, false)
+    ->RangeMultiplier(4)
+    ->Range(1 << 12, 1 << 22);
+
+// Timing (regular buckets).
+BENCHMARK_TEMPLATE(BM_RunRegularBuckets, uint64_t, false)
+    ->RangeMultiplier(4)
+    ->Range(1 << 12, 1 << 22);
+BENCHMARK_TEMPLATE(BM_RunRegularBuckets, absl::uint128, false)
+    ->RangeMultiplier(4)
+    ->Range(1 << 12, 1 << 22);
+
 // Timing (NTL).
 BENCHMARK_TEMPLATE(BM_RunNTL, 8, false)
     ->RangeMultiplier(4)
@@ -205,5 +377,13 @@ BENCHMARK_TEMPLATE(BM_RunNTL, 128, true)
     ->RangeMultiplier(4)
     ->Range(1 << 12, 1 << 22);
 
+// Arity sweep (timing and communication).
+BENCHMARK_TEMPLATE(BM_RunArity, uint64_t, false)->Apply(ArityArguments);
+BENCHMARK_TEMPLATE(BM_RunArity, uint64_t, true)->Apply(ArityArguments);
+
+// Batching sweep (timing and communication).
+BENCHMARK_TEMPLATE(BM_RunBatched, uint64_t, false)->Apply(BatchedArguments);
+BENCHMARK_TEMPLATE(BM_RunBatched, uint64_t, true)->Apply(BatchedArguments);
+
 }  // namespace
 }  // namespace distributed_vector_ole
\ No newline at end of file
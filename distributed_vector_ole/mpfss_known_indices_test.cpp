@@ -32,14 +32,27 @@ class MPFSSKnownIndicesTest : public ::testing::Test {
   MPFSSKnownIndicesTest() : helper_(false) {}
   void SetUp() {
     emp::initialize_relic();
+    CreateInstances(MPFSSKnownIndices::BucketMapping::kPrecomputed);
+  }
+
+  // (Re-)creates both MPFSSKnownIndices instances with the given bucket
+  // mapping.
+  void CreateInstances(MPFSSKnownIndices::BucketMapping bucket_mapping) {
+    bucket_mapping_ = bucket_mapping;
     comm_channel *chan0 = helper_.GetChannel(0);
     comm_channel *chan1 = helper_.GetChannel(1);
-    std::thread thread1([this, chan1] {
-      ASSERT_OK_AND_ASSIGN(mpfss_known_indices_1_,
-                           MPFSSKnownIndices::Create(chan1));
+    std::thread thread1([this, chan1, bucket_mapping] {
+      ASSERT_OK_AND_ASSIGN(
+          mpfss_known_indices_1_,
+          MPFSSKnownIndices::Create(chan1, 40, 2,
+                                    GGMTree::Construction::kOneKeyPerChild,
+                                    bucket_mapping));
     });
-    ASSERT_OK_AND_ASSIGN(mpfss_known_indices_0_,
-                         MPFSSKnownIndices::Create(chan0));
+    ASSERT_OK_AND_ASSIGN(
+        mpfss_known_indices_0_,
+        MPFSSKnownIndices::Create(chan0, 40, 2,
+                                  GGMTree::Construction::kOneKeyPerChild,
+                                  bucket_mapping));
     thread1.join();
   }
 
@@ -79,7 +92,19 @@ class MPFSSKnownIndicesTest : public ::testing::Test {
     std::vector<T> y(num_indices);
     std::fill(y.begin(), y.end(), T(23));
     std::vector<int64_t> indices(num_indices);
-    std::iota(indices.begin(), indices.end(), 0);
+    if (bucket_mapping_ == MPFSSKnownIndices::BucketMapping::kRegular) {
+      // One index in each block, at varying positions.
+      for (int i = 0; i < num_indices; i++) {
+        int64_t block_start =
+            MPFSSKnownIndices::RegularBlockStart(size, num_indices, i);
+        int64_t block_size =
+            MPFSSKnownIndices::RegularBlockStart(size, num_indices, i + 1) -
+            block_start;
+        indices[i] = block_start + i % block_size;
+      }
+    } else {
+      std::iota(indices.begin(), indices.end(), 0);
+    }
     std::vector<T> output_0(size), output_1(size);
 
     // Generate VOLE correlation to use.
@@ -121,7 +146,84 @@ class MPFSSKnownIndicesTest : public ::testing::Test {
     }
   }
 
+  // Runs `num_jobs` jobs with different x, y, and indices in a single batched
+  // call.
+  void TestVectorOLEBatched(int size, int num_indices, int num_jobs) {
+    ASSERT_OK_AND_ASSIGN(int num_buckets,
+                         mpfss_known_indices_0_->NumBuckets(num_indices));
+    std::vector<T> x(num_jobs);
+    std::vector<std::vector<T>> y(num_jobs, std::vector<T>(num_indices));
+    std::vector<std::vector<int64_t>> indices(
+        num_jobs, std::vector<int64_t>(num_indices));
+    std::vector<Vector<T>> u(num_jobs), v(num_jobs), w(num_jobs);
+    std::vector<std::vector<T>> output_0(num_jobs, std::vector<T>(size)),
+        output_1(num_jobs, std::vector<T>(size));
+    for (int j = 0; j < num_jobs; j++) {
+      x[j] = T(j + 2);
+      std::fill(y[j].begin(), y[j].end(), T(23 + j));
+      for (int i = 0; i < num_indices; i++) {
+        int64_t block_start =
+            MPFSSKnownIndices::RegularBlockStart(size, num_indices, i);
+        int64_t block_size =
+            MPFSSKnownIndices::RegularBlockStart(size, num_indices, i + 1) -
+            block_start;
+        indices[j][i] = block_start + (i + j) % block_size;
+      }
+      u[j].resize(num_buckets);
+      v[j].resize(num_buckets);
+      ScalarHelper<T>::Randomize(absl::MakeSpan(u[j]));
+      ScalarHelper<T>::Randomize(absl::MakeSpan(v[j]));
+      w[j] = u[j] * x[j] + v[j];
+    }
+    std::vector<absl::Span<const T>> y_spans, u_spans, v_spans, w_spans;
+    std::vector<absl::Span<const int64_t>> indices_spans;
+    std::vector<absl::Span<T>> output_0_spans, output_1_spans;
+    for (int j = 0; j < num_jobs; j++) {
+      y_spans.push_back(y[j]);
+      u_spans.push_back(u[j]);
+      v_spans.push_back(v[j]);
+      w_spans.push_back(w[j]);
+      indices_spans.push_back(indices[j]);
+      output_0_spans.push_back(absl::MakeSpan(output_0[j]));
+      output_1_spans.push_back(absl::MakeSpan(output_1[j]));
+    }
+
+    // Run protocol.
+    NTLContext<T> ntl_context;
+    ntl_context.save();
+    std::thread thread1([&] {
+      ntl_context.restore();
+      ASSERT_TRUE(mpfss_known_indices_1_
+                      ->RunIndexProviderVectorOLEBatched<T>(
+                          y_spans, indices_spans, u_spans, v_spans,
+                          output_1_spans)
+                      .ok());
+    });
+    EXPECT_TRUE(mpfss_known_indices_0_
+                    ->RunValueProviderVectorOLEBatched<T>(
+                        x, num_indices, w_spans, output_0_spans)
+                    .ok());
+    thread1.join();
+
+    // Check correctness.
+    for (int j = 0; j < num_jobs; j++) {
+      absl::flat_hash_map<int64_t, T> nonzero_map;
+      for (int i = 0; i < num_indices; i++) {
+        nonzero_map[indices[j][i]] = x[j] * y[j][i];
+      }
+      for (int i = 0; i < size; i++) {
+        T sum = output_0[j][i] + output_1[j][i];
+        if (nonzero_map.contains(i)) {
+          EXPECT_EQ(sum, nonzero_map[i]);
+        } else {
+          EXPECT_EQ(sum, T(0));
+        }
+      }
+    }
+  }
+
   mpc_utils::testing::CommChannelTestHelper helper_;
+  MPFSSKnownIndices::BucketMapping bucket_mapping_;
   std::unique_ptr<MPFSSKnownIndices> mpfss_known_indices_0_;
   std::unique_ptr<MPFSSKnownIndices> mpfss_known_indices_1_;
 };
@@ -145,6 +247,110 @@ TYPED_TEST(MPFSSKnownIndicesTest, TestVectorOLEVaryingNumIndices) {
   }
 }
 
+TYPED_TEST(MPFSSKnownIndicesTest, TestVectorOLEReusesBucketOutputs) {
+  // Bucket outputs are kept between calls, so run with shrinking and growing
+  // sizes on the same instances.
+  for (int size : {5000, 100, 10, 100, 5000}) {
+    this->TestVectorOLE(size, 3);
+  }
+}
+
+TYPED_TEST(MPFSSKnownIndicesTest, TestVectorOLEImplicitBuckets) {
+  this->CreateInstances(MPFSSKnownIndices::BucketMapping::kImplicit);
+  for (int size : {10, 100, 5000}) {
+    this->TestAllModuliVectorOLE(size, 3);
+  }
+  this->TestAllModuliVectorOLE(100, 30);
+}
+
+TYPED_TEST(MPFSSKnownIndicesTest, TestVectorOLERegularBuckets) {
+  this->CreateInstances(MPFSSKnownIndices::BucketMapping::kRegular);
+  for (int size : {10, 100, 5000}) {
+    this->TestAllModuliVectorOLE(size, 3);
+  }
+  this->TestAllModuliVectorOLE(100, 30);
+  this->TestAllModuliVectorOLE(30, 30);
+}
+
+TYPED_TEST(MPFSSKnownIndicesTest, TestVectorOLEBatched) {
+  for (auto bucket_mapping : {MPFSSKnownIndices::BucketMapping::kPrecomputed,
+                              MPFSSKnownIndices::BucketMapping::kImplicit,
+                              MPFSSKnownIndices::BucketMapping::kRegular}) {
+    this->CreateInstances(bucket_mapping);
+    for (int num_jobs : {1, 3}) {
+      this->TestVectorOLEBatched(100, 10, num_jobs);
+    }
+    // Single calls still work after batched ones.
+    this->TestVectorOLE(100, 10);
+  }
+  this->CreateInstances(MPFSSKnownIndices::BucketMapping::kPrecomputed);
+  this->TestVectorOLEBatched(1000, 30, 3);
+}
+
+TYPED_TEST(MPFSSKnownIndicesTest, TestBatchedNoJobs) {
+  EXPECT_TRUE(this->mpfss_known_indices_0_
+                  ->template RunValueProviderVectorOLEBatched<TypeParam>(
+                      {}, 1, {}, {})
+                  .ok());
+  EXPECT_TRUE(this->mpfss_known_indices_0_
+                  ->template RunIndexProviderVectorOLEBatched<TypeParam>(
+                      {}, {}, {}, {}, {})
+                  .ok());
+}
+
+TYPED_TEST(MPFSSKnownIndicesTest, TestBatchedDifferentNumberOfJobs) {
+  std::vector<TypeParam> output(2);
+  std::vector<absl::Span<TypeParam>> outputs = {absl::MakeSpan(output)};
+  auto status = this->mpfss_known_indices_0_
+                    ->template RunValueProviderVectorOLEBatched<TypeParam>(
+                        {TypeParam(0), TypeParam(1)}, 1, {}, outputs);
+  ASSERT_FALSE(status.ok());
+  EXPECT_EQ(status.message(),
+            "`x`, `w`, and `outputs` must have the same size");
+  status = this->mpfss_known_indices_0_
+               ->template RunIndexProviderVectorOLEBatched<TypeParam>(
+                   {}, {}, {}, {}, outputs);
+  ASSERT_FALSE(status.ok());
+  EXPECT_EQ(status.message(),
+            "`y`, `indices`, `u`, `v`, and `outputs` must have the same size");
+}
+
+TYPED_TEST(MPFSSKnownIndicesTest, TestBatchedDifferentOutputSizes) {
+  std::vector<TypeParam> output_0(2), output_1(3), y = {TypeParam(1)};
+  std::vector<int64_t> indices = {0};
+  std::vector<absl::Span<TypeParam>> outputs = {absl::MakeSpan(output_0),
+                                                absl::MakeSpan(output_1)};
+  std::vector<absl::Span<const TypeParam>> ys = {y, y};
+  std::vector<absl::Span<const int64_t>> indices_spans = {indices, indices};
+  auto status = this->mpfss_known_indices_0_
+                    ->template RunIndexProviderVectorOLEBatched<TypeParam>(
+                        ys, indices_spans, ys, ys, outputs);
+  ASSERT_FALSE(status.ok());
+  EXPECT_EQ(status.message(),
+            "All jobs must have the same number of indices and output size");
+  std::vector<TypeParam> x = {TypeParam(0), TypeParam(1)};
+  status = this->mpfss_known_indices_0_
+               ->template RunValueProviderVectorOLEBatched<TypeParam>(
+                   x, 1, ys, outputs);
+  ASSERT_FALSE(status.ok());
+  EXPECT_EQ(status.message(), "All `outputs` must have the same size");
+}
+
+TYPED_TEST(MPFSSKnownIndicesTest, TestRegularIndexOutsideBlock) {
+  this->CreateInstances(MPFSSKnownIndices::BucketMapping::kRegular);
+  std::vector<TypeParam> output(10);
+  std::vector<TypeParam> u(2), v(2);
+  // The blocks are [0, 5) and [5, 10).
+  auto status = this->mpfss_known_indices_0_
+                    ->template RunIndexProviderVectorOLE<TypeParam>(
+                        {TypeParam(0), TypeParam(1)}, {6, 7}, u, v,
+                        absl::MakeSpan(output));
+  ASSERT_FALSE(status.ok());
+  EXPECT_EQ(status.message(),
+            "For BucketMapping::kRegular, `indices[i]` must lie in the i-th "
+            "block");
+}
+
 TYPED_TEST(MPFSSKnownIndicesTest, TestDifferentLenghts) {
   std::vector<TypeParam> output(2);
   auto status = this->mpfss_known_indices_0_
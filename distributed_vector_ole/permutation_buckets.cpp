@@ -0,0 +1,182 @@
+//    Distributed Vector-OLE
+//    Copyright (C) 2019 Phillipp Schoppmann and Adria Gascon
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "distributed_vector_ole/permutation_buckets.h"
+
+#include "absl/container/inlined_vector.h"
+#include "distributed_vector_ole/cuckoo_hasher.h"
+#include "mpc_utils/canonical_errors.h"
+#include "mpc_utils/status_macros.h"
+
+namespace distributed_vector_ole {
+
+PermutationBuckets::PermutationBuckets(FixedKeyAES aes, int num_hash_functions,
+                                       int64_t num_inputs, int64_t num_buckets)
+    : aes_(aes),
+      num_hash_functions_(num_hash_functions),
+      num_inputs_(num_inputs),
+      num_buckets_(num_buckets),
+      num_bits_(0) {
+  while ((int64_t{1} << num_bits_) < num_inputs) {
+    num_bits_++;
+  }
+  num_low_bits_ = num_bits_ / 2;
+}
+
+mpc_utils::StatusOr<PermutationBuckets> PermutationBuckets::Create(
+    absl::uint128 seed, int num_hash_functions, int64_t num_inputs,
+    int64_t num_buckets) {
+  if (num_hash_functions <= 0) {
+    return mpc_utils::InvalidArgumentError(
+        "`num_hash_functions` must be positive");
+  }
+  if (num_inputs <= 0) {
+    return mpc_utils::InvalidArgumentError("`num_inputs` must be positive");
+  }
+  if (num_buckets <= 0) {
+    return mpc_utils::InvalidArgumentError("`num_buckets` must be positive");
+  }
+  ASSIGN_OR_RETURN(auto aes, FixedKeyAES::Create(seed));
+  return PermutationBuckets(aes, num_hash_functions, num_inputs, num_buckets);
+}
+
+int64_t PermutationBuckets::OffsetInBucket(int64_t input,
+                                           int hash_function) const {
+  int64_t value = Permute(input, hash_function);
+  int64_t bucket = BucketOfValue(value);
+  return hash_function * WidthOfBucket(bucket) + value -
+         FirstValueOfBucket(bucket);
+}
+
+void PermutationBuckets::Positions(int64_t first_input,
+                                   absl::Span<int64_t> positions) const {
+  int64_t num_inputs = positions.size() / num_hash_functions_;
+  std::vector<uint64_t> values(num_inputs);
+  std::vector<FixedKeyAES::Block> scratch(num_inputs);
+  for (int j = 0; j < num_hash_functions_; j++) {
+    for (int64_t i = 0; i < num_inputs; i++) {
+      values[i] = first_input + i;
+    }
+    PermuteBatch(j, absl::MakeSpan(values), absl::MakeSpan(scratch));
+    for (int64_t i = 0; i < num_inputs; i++) {
+      int64_t value = values[i];
+      int64_t bucket = BucketOfValue(value);
+      positions[i * num_hash_functions_ + j] =
+          BucketStart(bucket) + j * WidthOfBucket(bucket) + value -
+          FirstValueOfBucket(bucket);
+    }
+  }
+}
+
+mpc_utils::StatusOr<std::vector<int64_t>> PermutationBuckets::HashCuckoo(
+    absl::Span<const int64_t> inputs, int stash_size) const {
+  int64_t num_inputs = inputs.size();
+  std::vector<uint64_t> values(num_inputs);
+  std::vector<FixedKeyAES::Block> scratch(num_inputs);
+  for (int64_t i = 0; i < num_inputs; i++) {
+    if (inputs[i] < 0 || inputs[i] >= num_inputs_) {
+      return mpc_utils::InvalidArgumentError(
+          "All `inputs` must be between 0 and `num_inputs` - 1");
+    }
+  }
+  std::vector<absl::InlinedVector<int64_t, CuckooHasher::kDefaultHashFunctions>>
+      hashes(num_inputs,
+             absl::InlinedVector<int64_t, CuckooHasher::kDefaultHashFunctions>(
+                 num_hash_functions_));
+  for (int j = 0; j < num_hash_functions_; j++) {
+    std::copy(inputs.begin(), inputs.end(), values.begin());
+    PermuteBatch(j, absl::MakeSpan(values), absl::MakeSpan(scratch));
+    for (int64_t i = 0; i < num_inputs; i++) {
+      hashes[i][j] = BucketOfValue(values[i]);
+    }
+  }
+  return CuckooHasher::InsertCuckoo<CuckooHasher::kDefaultHashFunctions>(
+      absl::MakeConstSpan(hashes), num_buckets_, stash_size);
+}
+
+int64_t PermutationBuckets::Permute(int64_t input, int hash_function) const {
+  uint64_t value = input;
+  FixedKeyAES::Block scratch;
+  PermuteBatch(hash_function, absl::MakeSpan(&value, 1),
+               absl::MakeSpan(&scratch, 1));
+  return value;
+}
+
+void PermutationBuckets::PermuteBatch(
+    int hash_function, absl::Span<uint64_t> values,
+    absl::Span<FixedKeyAES::Block> scratch) const {
+  FeistelBatch(hash_function, values, scratch);
+  // Cycle walking: Apply the Feistel network again to all values that are out
+  // of range, until all of them are in range. Since the domain has less than
+  // twice as many elements as the range, this takes less than two rounds in
+  // expectation.
+  std::vector<int64_t> pending;
+  for (int64_t i = 0; i < static_cast<int64_t>(values.size()); i++) {
+    if (values[i] >= static_cast<uint64_t>(num_inputs_)) {
+      pending.push_back(i);
+    }
+  }
+  std::vector<uint64_t> walking;
+  while (!pending.empty()) {
+    int64_t num_walking = pending.size();
+    walking.resize(num_walking);
+    for (int64_t i = 0; i < num_walking; i++) {
+      walking[i] = values[pending[i]];
+    }
+    FeistelBatch(hash_function, absl::MakeSpan(walking),
+                 scratch.subspan(0, num_walking));
+    int64_t num_pending = 0;
+    for (int64_t i = 0; i < num_walking; i++) {
+      values[pending[i]] = walking[i];
+      if (walking[i] >= static_cast<uint64_t>(num_inputs_)) {
+        pending[num_pending++] = pending[i];
+      }
+    }
+    pending.resize(num_pending);
+  }
+}
+
+void PermutationBuckets::FeistelBatch(
+    int hash_function, absl::Span<uint64_t> values,
+    absl::Span<FixedKeyAES::Block> scratch) const {
+  int num_high_bits = num_bits_ - num_low_bits_;
+  uint64_t low_mask = (uint64_t{1} << num_low_bits_) - 1;
+  uint64_t high_mask = (uint64_t{1} << num_high_bits) - 1;
+  int64_t size = values.size();
+  for (int round = 0; round < kNumRounds; round++) {
+    // Even rounds update the low half using the high half, odd rounds the
+    // other way round. The round function is AES on the hash function, the
+    // round, and the unchanged half.
+    bool update_low = round % 2 == 0;
+    uint64_t tweak = (static_cast<uint64_t>(hash_function) << 32) | round;
+    for (int64_t i = 0; i < size; i++) {
+      uint64_t half =
+          update_low ? values[i] >> num_low_bits_ : values[i] & low_mask;
+      scratch[i] = absl::MakeUint128(tweak, half);
+    }
+    aes_.Encrypt(scratch.subspan(0, size), scratch.subspan(0, size));
+    for (int64_t i = 0; i < size; i++) {
+      uint64_t f = absl::Uint128Low64(scratch[i]);
+      if (update_low) {
+        values[i] ^= f & low_mask;
+      } else {
+        values[i] ^= (f & high_mask) << num_low_bits_;
+      }
+    }
+  }
+}
+
+}  // namespace distributed_vector_ole
@@ -0,0 +1,162 @@
+//    Distributed Vector-OLE
+//    Copyright (C) 2019 Phillipp Schoppmann and Adria Gascon
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef DISTRIBUTED_VECTOR_OLE_PERMUTATION_BUCKETS_H_
+#define DISTRIBUTED_VECTOR_OLE_PERMUTATION_BUCKETS_H_
+
+// Simple hashing of the interval [0, num_inputs) into buckets, where the
+// buckets are never stored.
+//
+// CuckooHasher::HashSimple hashes each input independently, so the size of a
+// bucket and the offset of an input in it are only known after hashing all
+// inputs, and have to be stored. PermutationBuckets instead derives the j-th
+// hash function from a pseudorandom permutation pi_j of [0, num_inputs): input
+// x goes to bucket floor(pi_j(x) * num_buckets / num_inputs). Bucket i thus
+// receives the values from ceil(i * num_inputs / num_buckets) up to, but not
+// including, ceil((i + 1) * num_inputs / num_buckets). Each hash function puts
+// either floor(num_inputs / num_buckets) or ceil(num_inputs / num_buckets)
+// inputs into each bucket, so no bucket is empty if num_inputs >= num_buckets,
+// and the position of x in its bucket follows from pi_j(x). The buckets are
+// laid out as in CuckooHasher::Buckets, i.e., one after the other, where
+// bucket i holds the inputs of hash function 0 ordered by pi_0, then the ones
+// of hash function 1, and so on.
+//
+// The permutations are 4-round Feistel networks over the smallest power of two
+// that is at least num_inputs, with AES as the round function, and cycle
+// walking [1] to restrict them to [0, num_inputs). The number of buckets
+// should be chosen using CuckooHasher::GetOptimalNumberOfBuckets. This assumes
+// that the hash functions are independent, which is a close approximation as
+// long as the number of inputs inserted with HashCuckoo is much smaller than
+// num_inputs.
+//
+// [1] Black, John, and Phillip Rogaway. "Ciphers with arbitrary finite
+// domains." CT-RSA 2002.
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/numeric/int128.h"
+#include "absl/types/span.h"
+#include "distributed_vector_ole/fixed_key_aes.h"
+#include "mpc_utils/statusor.h"
+
+namespace distributed_vector_ole {
+
+class PermutationBuckets {
+ public:
+  // Number of Feistel rounds of each permutation.
+  static const int kNumRounds = 4;
+
+  // Creates a mapping of [0, num_inputs) to `num_buckets` buckets, using
+  // `num_hash_functions` permutations derived from `seed`.
+  //
+  // Returns INVALID_ARGUMENT if any of the sizes is not positive.
+  static mpc_utils::StatusOr<PermutationBuckets> Create(
+      absl::uint128 seed, int num_hash_functions, int64_t num_inputs,
+      int64_t num_buckets);
+
+  // Returns the number of buckets.
+  int64_t num_buckets() const { return num_buckets_; }
+
+  // Returns the total number of elements in all buckets, i.e.,
+  // num_hash_functions * num_inputs.
+  int64_t num_elements() const { return num_hash_functions_ * num_inputs_; }
+
+  // Returns the position of the first element of bucket i.
+  int64_t BucketStart(int64_t i) const {
+    return num_hash_functions_ * FirstValueOfBucket(i);
+  }
+
+  // Returns the number of elements in bucket i.
+  int64_t BucketSize(int64_t i) const {
+    return num_hash_functions_ * WidthOfBucket(i);
+  }
+
+  // Returns the bucket of `input` under the given hash function.
+  int64_t Bucket(int64_t input, int hash_function) const {
+    return BucketOfValue(Permute(input, hash_function));
+  }
+
+  // Returns the position of `input` in the bucket of the given hash function,
+  // counting from BucketStart of that bucket.
+  int64_t OffsetInBucket(int64_t input, int hash_function) const;
+
+  // Sets positions[i * num_hash_functions + j] to the position of input
+  // first_input + i under the j-th hash function, counting from the start of
+  // the first bucket. `positions.size()` must be a multiple of the number of
+  // hash functions. Evaluates all permutations on the whole range at once, so
+  // it should be called on tiles of a few hundred inputs or more.
+  void Positions(int64_t first_input, absl::Span<int64_t> positions) const;
+
+  // Hashes `inputs`, which must be unique and in [0, num_inputs), using Cuckoo
+  // Hashing with the hash functions defined above and a stash of `stash_size`
+  // elements. Returns a vector of indices into `inputs` as
+  // CuckooHasher::HashCuckoo, with the stash at the end.
+  //
+  // Returns INVALID_ARGUMENT if an input is out of range.
+  // Returns INTERNAL if insertion fails.
+  mpc_utils::StatusOr<std::vector<int64_t>> HashCuckoo(
+      absl::Span<const int64_t> inputs, int stash_size = 0) const;
+
+ private:
+  PermutationBuckets(FixedKeyAES aes, int num_hash_functions,
+                     int64_t num_inputs, int64_t num_buckets);
+
+  // Returns the bucket of value pi_j(x), i.e., floor(value * num_buckets /
+  // num_inputs).
+  int64_t BucketOfValue(int64_t value) const {
+    return static_cast<int64_t>(absl::uint128(value) * num_buckets_ /
+                                num_inputs_);
+  }
+
+  // Returns the smallest value pi_j(x) in bucket i, i.e., ceil(i * num_inputs /
+  // num_buckets). Returns num_inputs for i = num_buckets.
+  int64_t FirstValueOfBucket(int64_t i) const {
+    return static_cast<int64_t>(
+        (absl::uint128(i) * num_inputs_ + num_buckets_ - 1) / num_buckets_);
+  }
+
+  // Returns the number of inputs in bucket i for each hash function.
+  int64_t WidthOfBucket(int64_t i) const {
+    return FirstValueOfBucket(i + 1) - FirstValueOfBucket(i);
+  }
+
+  // Returns pi_j(input) for j = hash_function.
+  int64_t Permute(int64_t input, int hash_function) const;
+
+  // Replaces each element of `values` by its image under pi_j, for j =
+  // hash_function. `scratch` must have the same size as `values`.
+  void PermuteBatch(int hash_function, absl::Span<uint64_t> values,
+                    absl::Span<FixedKeyAES::Block> scratch) const;
+
+  // Applies the Feistel network of `hash_function` to all elements of
+  // `values` once, mapping [0, 2^num_bits_) to itself.
+  void FeistelBatch(int hash_function, absl::Span<uint64_t> values,
+                    absl::Span<FixedKeyAES::Block> scratch) const;
+
+  FixedKeyAES aes_;
+  int num_hash_functions_;
+  int64_t num_inputs_;
+  int64_t num_buckets_;
+  // The Feistel networks split their inputs into a low half of
+  // num_low_bits_ bits and a high half of num_bits_ - num_low_bits_ bits.
+  int num_bits_;
+  int num_low_bits_;
+};
+
+}  // namespace distributed_vector_ole
+
+#endif  // DISTRIBUTED_VECTOR_OLE_PERMUTATION_BUCKETS_H_
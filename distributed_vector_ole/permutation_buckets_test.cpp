@@ -0,0 +1,204 @@
+//    Distributed Vector-OLE
+//    Copyright (C) 2019 Phillipp Schoppmann and Adria Gascon
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "distributed_vector_ole/permutation_buckets.h"
+
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include "distributed_vector_ole/cuckoo_hasher.h"
+#include "gtest/gtest.h"
+#include "mpc_utils/status_matchers.h"
+
+namespace distributed_vector_ole {
+namespace {
+
+const absl::uint128 kSeed = 0x1234567890;
+
+void TestLayout(int64_t num_inputs, int64_t num_buckets,
+                int num_hash_functions) {
+  ASSERT_OK_AND_ASSIGN(auto buckets,
+                       PermutationBuckets::Create(kSeed, num_hash_functions,
+                                                  num_inputs, num_buckets));
+  EXPECT_EQ(buckets.num_buckets(), num_buckets);
+  EXPECT_EQ(buckets.num_elements(), num_hash_functions * num_inputs);
+  // Buckets are stored one after the other.
+  EXPECT_EQ(buckets.BucketStart(0), 0);
+  for (int64_t i = 0; i < num_buckets; i++) {
+    EXPECT_EQ(buckets.BucketStart(i) + buckets.BucketSize(i),
+              i + 1 < num_buckets ? buckets.BucketStart(i + 1)
+                                  : buckets.num_elements());
+  }
+
+  // Compute positions in tiles of different sizes.
+  std::vector<int64_t> positions(num_hash_functions * num_inputs);
+  for (int64_t first_input = 0, tile = 1; first_input < num_inputs;
+       first_input += tile, tile *= 2) {
+    int64_t tile_size = std::min(tile, num_inputs - first_input);
+    buckets.Positions(first_input,
+                      absl::MakeSpan(positions)
+                          .subspan(first_input * num_hash_functions,
+                                   tile_size * num_hash_functions));
+  }
+
+  // Each position is used exactly once, and lies in the right bucket.
+  std::vector<int> counts(buckets.num_elements(), 0);
+  for (int64_t i = 0; i < num_inputs; i++) {
+    for (int j = 0; j < num_hash_functions; j++) {
+      int64_t position = positions[i * num_hash_functions + j];
+      ASSERT_GE(position, 0);
+      ASSERT_LT(position, buckets.num_elements());
+      counts[position]++;
+      int64_t bucket = buckets.Bucket(i, j);
+      ASSERT_GE(bucket, 0);
+      ASSERT_LT(bucket, num_buckets);
+      EXPECT_EQ(position,
+                buckets.BucketStart(bucket) + buckets.OffsetInBucket(i, j));
+      EXPECT_LT(buckets.OffsetInBucket(i, j), buckets.BucketSize(bucket));
+    }
+  }
+  for (int count : counts) {
+    EXPECT_EQ(count, 1);
+  }
+}
+
+TEST(PermutationBucketsTest, TestLayout) {
+  for (int num_hash_functions : {1, 2, 3}) {
+    TestLayout(1, 1, num_hash_functions);
+    TestLayout(10, 4, num_hash_functions);
+    TestLayout(5, 20, num_hash_functions);
+    TestLayout(1000, 37, num_hash_functions);
+    TestLayout(1 << 12, 64, num_hash_functions);
+    TestLayout(12345, 678, num_hash_functions);
+  }
+}
+
+TEST(PermutationBucketsTest, TestBucketsAreBalanced) {
+  int64_t num_inputs = 1000, num_buckets = 10;
+  ASSERT_OK_AND_ASSIGN(
+      auto buckets,
+      PermutationBuckets::Create(kSeed, 3, num_inputs, num_buckets));
+  std::vector<int64_t> counts(num_buckets, 0);
+  for (int64_t i = 0; i < num_inputs; i++) {
+    for (int j = 0; j < 3; j++) {
+      counts[buckets.Bucket(i, j)]++;
+    }
+  }
+  for (int64_t i = 0; i < num_buckets; i++) {
+    EXPECT_EQ(counts[i], 300);
+    EXPECT_EQ(buckets.BucketSize(i), 300);
+  }
+}
+
+TEST(PermutationBucketsTest, TestAllBucketsAreUsed) {
+  // With ceil(num_inputs / num_buckets) inputs per bucket, only 50 of the 69
+  // buckets would be used here.
+  for (auto sizes : std::vector<std::pair<int64_t, int64_t>>{
+           {100, 69}, {100, 100}, {1000, 37}, {12345, 678}}) {
+    int64_t num_inputs = sizes.first, num_buckets = sizes.second;
+    ASSERT_OK_AND_ASSIGN(
+        auto buckets,
+        PermutationBuckets::Create(kSeed, 3, num_inputs, num_buckets));
+    int64_t min_size = 3 * (num_inputs / num_buckets);
+    std::vector<int64_t> counts(num_buckets, 0);
+    for (int64_t i = 0; i < num_inputs; i++) {
+      for (int j = 0; j < 3; j++) {
+        counts[buckets.Bucket(i, j)]++;
+      }
+    }
+    for (int64_t i = 0; i < num_buckets; i++) {
+      EXPECT_GT(counts[i], 0);
+      EXPECT_EQ(counts[i], buckets.BucketSize(i));
+      // Widths differ by at most one per hash function.
+      EXPECT_GE(buckets.BucketSize(i), min_size);
+      EXPECT_LE(buckets.BucketSize(i), min_size + 3);
+    }
+  }
+}
+
+TEST(PermutationBucketsTest, TestDifferentSeeds) {
+  int64_t num_inputs = 1000;
+  ASSERT_OK_AND_ASSIGN(auto buckets0,
+                       PermutationBuckets::Create(0, 1, num_inputs, 1));
+  ASSERT_OK_AND_ASSIGN(auto buckets1,
+                       PermutationBuckets::Create(1, 1, num_inputs, 1));
+  std::vector<int64_t> positions0(num_inputs), positions1(num_inputs);
+  buckets0.Positions(0, absl::MakeSpan(positions0));
+  buckets1.Positions(0, absl::MakeSpan(positions1));
+  EXPECT_NE(positions0, positions1);
+}
+
+TEST(PermutationBucketsTest, TestCuckooHashing) {
+  int64_t num_inputs = 1 << 16;
+  int num_indices = 1000;
+  ASSERT_OK_AND_ASSIGN(auto hasher, CuckooHasher::Create(kSeed, 3));
+  ASSERT_OK_AND_ASSIGN(int64_t num_buckets,
+                       hasher->GetOptimalNumberOfBuckets(num_indices));
+  ASSERT_OK_AND_ASSIGN(
+      auto buckets,
+      PermutationBuckets::Create(kSeed, 3, num_inputs, num_buckets));
+  std::vector<int64_t> indices(num_indices);
+  for (int i = 0; i < num_indices; i++) {
+    indices[i] = (int64_t{7919} * i) % num_inputs;
+  }
+  ASSERT_OK_AND_ASSIGN(auto hashed, buckets.HashCuckoo(indices));
+  ASSERT_EQ(hashed.size(), num_buckets);
+  // With a stash, the stash entries come after the buckets.
+  ASSERT_OK_AND_ASSIGN(auto hashed_with_stash, buckets.HashCuckoo(indices, 2));
+  ASSERT_EQ(hashed_with_stash.size(), num_buckets + 2);
+  std::vector<int> counts(num_indices, 0);
+  for (int64_t i = 0; i < num_buckets; i++) {
+    if (hashed[i] == -1) {
+      continue;
+    }
+    counts[hashed[i]]++;
+    bool found = false;
+    for (int j = 0; j < 3; j++) {
+      found |= buckets.Bucket(indices[hashed[i]], j) == i;
+    }
+    EXPECT_TRUE(found);
+  }
+  for (int count : counts) {
+    EXPECT_EQ(count, 1);
+  }
+}
+
+TEST(PermutationBucketsTest, TestCuckooHashingOutOfRange) {
+  ASSERT_OK_AND_ASSIGN(auto buckets,
+                       PermutationBuckets::Create(kSeed, 3, 100, 10));
+  std::vector<int64_t> indices = {1, 100};
+  auto status = buckets.HashCuckoo(indices);
+  ASSERT_FALSE(status.ok());
+  EXPECT_EQ(status.status().message(),
+            "All `inputs` must be between 0 and `num_inputs` - 1");
+}
+
+TEST(PermutationBucketsTest, TestInvalidSizes) {
+  auto status = PermutationBuckets::Create(kSeed, 0, 100, 10);
+  ASSERT_FALSE(status.ok());
+  EXPECT_EQ(status.status().message(),
+            "`num_hash_functions` must be positive");
+  status = PermutationBuckets::Create(kSeed, 3, 0, 10);
+  ASSERT_FALSE(status.ok());
+  EXPECT_EQ(status.status().message(), "`num_inputs` must be positive");
+  status = PermutationBuckets::Create(kSeed, 3, 100, 0);
+  ASSERT_FALSE(status.ok());
+  EXPECT_EQ(status.status().message(), "`num_buckets` must be positive");
+}
+
+}  // namespace
+}  // namespace distributed_vector_ole
@@ -24,7 +24,8 @@ SPFSSKnownIndex::SPFSSKnownIndex(
     : channel_(channel), all_but_one_rot_(std::move(all_but_one_rot)) {}
 
 mpc_utils::StatusOr<std::unique_ptr<SPFSSKnownIndex>> SPFSSKnownIndex::Create(
-    mpc_utils::comm_channel* channel, double statistical_security) {
+    mpc_utils::comm_channel* channel, double statistical_security, int arity,
+    GGMTree::Construction construction, bool pack_leaves) {
   if (!channel) {
     return mpc_utils::InvalidArgumentError("`channel` must not be NULL");
   }
@@ -32,9 +33,14 @@ mpc_utils::StatusOr<std::unique_ptr<SPFSSKnownIndex>> SPFSSKnownIndex::Create(
     return mpc_utils::InvalidArgumentError(
         "`statistical_security` must not be negative.");
   }
-  // Create AllButOneRandomOT protocol.
+  // Create AllButOneRandomOT protocol. Packing leaves is insecure with the
+  // half-tree construction, see AllButOneRandomOT::Create.
+  if (construction == GGMTree::Construction::kHalfTree) {
+    pack_leaves = false;
+  }
   ASSIGN_OR_RETURN(auto all_but_one_rot,
-                   AllButOneRandomOT::Create(channel, statistical_security));
+                   AllButOneRandomOT::Create(channel, statistical_security,
+                                             arity, pack_leaves, construction));
   return absl::WrapUnique(
       new SPFSSKnownIndex(channel, std::move(all_but_one_rot)));
 }
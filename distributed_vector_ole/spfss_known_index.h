@@ -46,9 +46,18 @@ namespace distributed_vector_ole {
 class SPFSSKnownIndex {
  public:
   // Creates an instance of SPFSSKnownIndex that communicates over the given
-  // comm_channel. This corresponds to an instance of AllButOneRandomOT.
+  // comm_channel. This corresponds to an instance of AllButOneRandomOT, whose
+  // GGM trees have the given arity and construction. If `pack_leaves` is true,
+  // multiple outputs are derived from each leaf where possible, see
+  // AllButOneRandomOT::Create. Leaves are never packed with the half-tree
+  // construction. Both parties must use the same arity, construction, and
+  // `pack_leaves`.
   static mpc_utils::StatusOr<std::unique_ptr<SPFSSKnownIndex>> Create(
-      mpc_utils::comm_channel *channel, double statistical_security = 40);
+      mpc_utils::comm_channel *channel, double statistical_security = 40,
+      int arity = 2,
+      GGMTree::Construction construction =
+          GGMTree::Construction::kOneKeyPerChild,
+      bool pack_leaves = true);
 
   // Runs the ValueProvider side of the protocol. `output` must point to an
   // array of pre-allocated Ts.
@@ -107,22 +116,13 @@ mpc_utils::Status SPFSSKnownIndex::RunValueProviderBatched(
     return mpc_utils::InvalidArgumentError(
         "`val-shares` and `outputs` must have the same size");
   }
-  RETURN_IF_ERROR(all_but_one_rot_->RunSenderBatched(outputs));
-  std::vector<T> sums(val_shares.begin(), val_shares.end());
-  T *sums_data = sums.data();  // OpenMP wants a pointer.
-  int len = static_cast<int>(val_shares.size());
-  NTLContext<T> context;
-  context.save();
-#pragma omp parallel
-  {
-    context.restore();
-#pragma omp for schedule(guided)
-    for (int j = 0; j < len; j++) {
-      for (int64_t i = 0; i < static_cast<int64_t>(outputs[j].size()); ++i) {
-        sums_data[j] += outputs[j][i];
-        outputs[j][i] = -outputs[j][i];
-      }
-    }
+  // Let AllButOneRandomOT compute the sums of all outputs and negate them
+  // while expanding the trees.
+  std::vector<T> sums(val_shares.size());
+  RETURN_IF_ERROR(all_but_one_rot_->RunSenderBatched(
+      outputs, absl::MakeSpan(sums), /*negate=*/true));
+  for (int j = 0; j < static_cast<int>(val_shares.size()); j++) {
+    sums[j] += val_shares[j];
   }
   channel_->send(sums);
   channel_->flush();
@@ -138,25 +138,18 @@ mpc_utils::Status SPFSSKnownIndex::RunIndexProviderBatched(
     return mpc_utils::InvalidArgumentError(
         "`val-shares`, `indices`, and `outputs` must have the same size");
   }
-  RETURN_IF_ERROR(all_but_one_rot_->RunReceiverBatched(indices, outputs));
-  std::vector<T> sums(val_shares.begin(), val_shares.end());
-  std::vector<T> sums_server;
-  T *sums_data = sums.data();  // OpenMP wants a pointer.
+  // The output at `indices[j]` is zero, so the sum computed by
+  // AllButOneRandomOT is the sum of all other outputs.
+  std::vector<T> sums(val_shares.size());
+  RETURN_IF_ERROR(all_but_one_rot_->RunReceiverBatched(indices, outputs,
+                                                       absl::MakeSpan(sums)));
   int len = static_cast<int>(val_shares.size());
-  NTLContext<T> context;
-  context.save();
-#pragma omp parallel
-  {
-    context.restore();
-#pragma omp for schedule(guided)
-    for (int j = 0; j < len; j++) {
-      for (int64_t i = 0; i < static_cast<int64_t>(outputs[j].size()); ++i) {
-        if (i != indices[j]) {
-          sums_data[j] -= outputs[j][i];
-        }
-      }
-    }
+  for (int j = 0; j < len; j++) {
+    T sum = val_shares[j];
+    sum -= sums[j];
+    sums[j] = sum;
   }
+  std::vector<T> sums_server;
   channel_->recv(sums_server);
   for (int j = 0; j < len; j++) {
     if (outputs[j].empty()) {
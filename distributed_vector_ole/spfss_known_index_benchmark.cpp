@@ -22,10 +22,14 @@
 namespace distributed_vector_ole {
 namespace {
 
+// Runs SPFSS on vectors of the given length, using GGM trees of the given
+// arity and construction, with or without packing leaves.
 template <typename T, bool measure_communication>
-static void BM_RunNative(benchmark::State &state) {
+static void RunBenchmark(benchmark::State &state, int64_t length, int arity,
+                         GGMTree::Construction construction =
+                             GGMTree::Construction::kOneKeyPerChild,
+                         bool pack_leaves = true) {
   mpc_utils::testing::CommChannelTestHelper helper(measure_communication);
-  int64_t length = state.range(0);
   comm_channel *chan0 = helper.GetChannel(0);
   comm_channel *chan1 = helper.GetChannel(1);
   emp::initialize_relic();
@@ -33,9 +37,12 @@ static void BM_RunNative(benchmark::State &state) {
   // Spawn a thread that acts as the server.
   NTLContext<T> ntl_context;
   ntl_context.save();
-  std::thread thread1([chan1, length, &ntl_context] {
+  std::thread thread1([chan1, length, arity, construction, pack_leaves,
+                       &ntl_context] {
     ntl_context.restore();
-    auto spfss1 = SPFSSKnownIndex::Create(chan1).ValueOrDie();
+    auto spfss1 =
+        SPFSSKnownIndex::Create(chan1, 40, arity, construction, pack_leaves)
+            .ValueOrDie();
     bool keep_running;
     std::vector<T> output1(length);
     T share1(23);
@@ -47,7 +54,9 @@ static void BM_RunNative(benchmark::State &state) {
   });
 
   // Run the client in the main thread.
-  auto spfss0 = SPFSSKnownIndex::Create(chan0).ValueOrDie();
+  auto spfss0 =
+      SPFSSKnownIndex::Create(chan0, 40, arity, construction, pack_leaves)
+          .ValueOrDie();
   std::vector<T> output0(length);
   T share0(42);
   int index = 0;
@@ -74,6 +83,44 @@ static void BM_RunNative(benchmark::State &state) {
       benchmark::Counter(bytes_sent1, benchmark::Counter::kAvgIterations);
 }
 
+template <typename T, bool measure_communication>
+static void BM_RunNative(benchmark::State &state) {
+  RunBenchmark<T, measure_communication>(state, state.range(0), 2);
+}
+
+// Sweeps over the arity of the GGM trees. The first argument is the length,
+// the second one the arity.
+template <typename T, bool measure_communication>
+static void BM_RunArity(benchmark::State &state) {
+  RunBenchmark<T, measure_communication>(state, state.range(0),
+                                         state.range(1));
+}
+
+// Binary GGM trees using the half-tree construction, which never packs
+// leaves. Compare to BM_RunUnpacked, not BM_RunNative, to see the effect of
+// the construction alone.
+template <typename T, bool measure_communication>
+static void BM_RunHalfTree(benchmark::State &state) {
+  RunBenchmark<T, measure_communication>(state, state.range(0), 2,
+                                         GGMTree::Construction::kHalfTree);
+}
+
+// Binary GGM trees with one key per child, without packing leaves. Baseline
+// for BM_RunHalfTree.
+template <typename T, bool measure_communication>
+static void BM_RunUnpacked(benchmark::State &state) {
+  RunBenchmark<T, measure_communication>(
+      state, state.range(0), 2, GGMTree::Construction::kOneKeyPerChild, false);
+}
+
+static void ArityArguments(benchmark::internal::Benchmark *b) {
+  for (int64_t length = 1 << 12; length <= 1 << 22; length *= 4) {
+    for (int arity : {2, 4, 8, 16}) {
+      b->Args({length, arity});
+    }
+  }
+}
+
 template <typename T, int num_bits, bool measure_communication>
 static void BM_RunNTL(benchmark::State &state) {
   switch (num_bits) {
@@ -212,5 +259,30 @@ BENCHMARK_TEMPLATE(BM_RunNTL, NTL::zz_p, 60, true)
     ->RangeMultiplier(4)
     ->Range(1 << 12, 1 << 22);
 
+// Arity sweep (timing and communication).
+BENCHMARK_TEMPLATE(BM_RunArity, uint64_t, false)->Apply(ArityArguments);
+BENCHMARK_TEMPLATE(BM_RunArity, gf128, false)->Apply(ArityArguments);
+BENCHMARK_TEMPLATE(BM_RunArity, uint64_t, true)->Apply(ArityArguments);
+
+// Half-tree construction and its unpacked baseline (timing and communication).
+BENCHMARK_TEMPLATE(BM_RunHalfTree, uint64_t, false)
+    ->RangeMultiplier(4)
+    ->Range(1 << 12, 1 << 22);
+BENCHMARK_TEMPLATE(BM_RunHalfTree, gf128, false)
+    ->RangeMultiplier(4)
+    ->Range(1 << 12, 1 << 22);
+BENCHMARK_TEMPLATE(BM_RunHalfTree, uint64_t, true)
+    ->RangeMultiplier(4)
+    ->Range(1 << 12, 1 << 22);
+BENCHMARK_TEMPLATE(BM_RunUnpacked, uint64_t, false)
+    ->RangeMultiplier(4)
+    ->Range(1 << 12, 1 << 22);
+BENCHMARK_TEMPLATE(BM_RunUnpacked, gf128, false)
+    ->RangeMultiplier(4)
+    ->Range(1 << 12, 1 << 22);
+BENCHMARK_TEMPLATE(BM_RunUnpacked, uint64_t, true)
+    ->RangeMultiplier(4)
+    ->Range(1 << 12, 1 << 22);
+
 }  // namespace
 }  // namespace distributed_vector_ole
\ No newline at end of file
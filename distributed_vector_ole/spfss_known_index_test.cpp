@@ -37,14 +37,25 @@ template <typename T>
 class SPFSSKnownIndexTest : public ::testing::Test {
  protected:
   SPFSSKnownIndexTest() : helper_(false) {}
-  void SetUp() {
+  void SetUp() { CreateInstances(true); }
+
+  // (Re-)creates both SPFSSKnownIndex instances, packing leaves if
+  // `pack_leaves` is true.
+  void CreateInstances(bool pack_leaves) {
     comm_channel *chan0 = helper_.GetChannel(0);
     comm_channel *chan1 = helper_.GetChannel(1);
-    std::thread thread1([this, chan1] {
-      ASSERT_OK_AND_ASSIGN(spfss_known_index_1_,
-                           SPFSSKnownIndex::Create(chan1));
+    std::thread thread1([this, chan1, pack_leaves] {
+      ASSERT_OK_AND_ASSIGN(
+          spfss_known_index_1_,
+          SPFSSKnownIndex::Create(chan1, 40, 2,
+                                  GGMTree::Construction::kOneKeyPerChild,
+                                  pack_leaves));
     });
-    ASSERT_OK_AND_ASSIGN(spfss_known_index_0_, SPFSSKnownIndex::Create(chan0));
+    ASSERT_OK_AND_ASSIGN(
+        spfss_known_index_0_,
+        SPFSSKnownIndex::Create(chan0, 40, 2,
+                                GGMTree::Construction::kOneKeyPerChild,
+                                pack_leaves));
     thread1.join();
   }
 
@@ -128,6 +139,18 @@ TYPED_TEST(SPFSSKnownIndexTest, TestSmallVectors) {
   }
 }
 
+TYPED_TEST(SPFSSKnownIndexTest, TestWithoutPacking) {
+  if (std::is_same<TypeParam, NTL::ZZ_p>::value) {
+    NTL::ZZ_p::init(NTL::conv<NTL::ZZ>("18446744073709551557"));  // 2^64 - 59
+  } else if (std::is_same<TypeParam, NTL::zz_p>::value) {
+    NTL::zz_p::init(65521);  // 2^16 - 15
+  }
+  this->CreateInstances(false);
+  for (int size : {1, 10, 1000}) {
+    this->TestVector(size, size / 2);
+  }
+}
+
 TEST(SPFSSKnownIndex, TestNullChannel) {
   auto status = SPFSSKnownIndex::Create(nullptr);
   ASSERT_FALSE(status.ok());